@@ -0,0 +1,116 @@
+#include "admission_controller.h"
+
+#include <algorithm>
+
+// Boost
+#include <boost/asio/post.hpp>
+
+namespace {
+
+// 許可したハンドラが実行されずに破棄された場合（インスタンスが終了した場合）に
+// 枠を返すためのもの
+struct Ticket {
+  std::shared_ptr<AdmissionController> controller;
+  bool used = false;
+  ~Ticket() {
+    if (!used) {
+      controller->Release();
+    }
+  }
+};
+
+}  // namespace
+
+std::shared_ptr<AdmissionController> AdmissionController::Create(
+    const Config& config) {
+  return std::shared_ptr<AdmissionController>(new AdmissionController(config));
+}
+
+AdmissionController::AdmissionController(const Config& config)
+    : config_(config),
+      limit_(config.max_in_flight),
+      connect_time_ms_(Histogram::LatencyMsBounds()) {
+  config_.min_in_flight =
+      std::clamp(config_.min_in_flight, 1, config_.max_in_flight);
+}
+
+void AdmissionController::Request(boost::asio::io_context& ioc,
+                                  std::function<void()> on_admitted) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  queue_.push_back({&ioc, std::move(on_admitted)});
+  Dispatch();
+}
+
+void AdmissionController::Done(bool success,
+                               std::chrono::milliseconds latency) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  in_flight_ -= 1;
+  if (success) {
+    succeeded_ += 1;
+    connect_time_ms_.Add(latency.count());
+  } else {
+    failed_ += 1;
+  }
+  bool slow = latency > config_.latency_threshold;
+  if (success && slow) {
+    slow_ += 1;
+  }
+
+  if (success && !slow) {
+    // 上限まで少しずつ増やす（上限の数だけ成功すると 1 増える）
+    limit_ = std::min<double>(config_.max_in_flight, limit_ + 1.0 / limit_);
+  } else {
+    // 1 回の混雑で何度も減らさないように、閾値の時間内は 1 回だけ半分にする
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_backoff_at_ > config_.latency_threshold) {
+      last_backoff_at_ = now;
+      limit_ = std::max<double>(config_.min_in_flight, limit_ / 2);
+      backoffs_ += 1;
+    }
+  }
+  Dispatch();
+}
+
+void AdmissionController::Release() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  in_flight_ -= 1;
+  Dispatch();
+}
+
+void AdmissionController::Cancel(boost::asio::io_context& ioc) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  queue_.erase(
+      std::remove_if(queue_.begin(), queue_.end(),
+                     [&ioc](const Waiter& w) { return w.ioc == &ioc; }),
+      queue_.end());
+}
+
+AdmissionController::Stats AdmissionController::GetStats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  Stats st;
+  st.limit = limit_;
+  st.in_flight = in_flight_;
+  st.queued = queue_.size();
+  st.admitted = admitted_;
+  st.succeeded = succeeded_;
+  st.failed = failed_;
+  st.slow = slow_;
+  st.backoffs = backoffs_;
+  st.connect_time_ms = connect_time_ms_.GetSnapshot();
+  return st;
+}
+
+void AdmissionController::Dispatch() {
+  while (!queue_.empty() && in_flight_ < (int)limit_) {
+    auto w = std::move(queue_.front());
+    queue_.pop_front();
+    in_flight_ += 1;
+    admitted_ += 1;
+    auto ticket = std::make_shared<Ticket>();
+    ticket->controller = shared_from_this();
+    boost::asio::post(*w.ioc, [ticket, f = std::move(w.on_admitted)]() {
+      ticket->used = true;
+      f();
+    });
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef ADMISSION_CONTROLLER_H_
+#define ADMISSION_CONTROLLER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Boost
+#include <boost/asio/io_context.hpp>
+
+#include "histogram.h"
+
+// プロセス全体で同時に接続処理中の仮想クライアント数を制限する
+//
+// 接続処理は WebSocket の接続から connection.created を受信するまでとする。
+// 上限は AIMD で調整し、接続が成功して時間も閾値以内なら少しずつ増やし、
+// 失敗するか閾値を超えたら半分にする。
+// 複数のインスタンスのスレッドから呼ばれるので、全て mutex で保護している。
+class AdmissionController
+    : public std::enable_shared_from_this<AdmissionController> {
+ public:
+  struct Config {
+    // 同時に接続処理できる数の上限
+    int max_in_flight = 0;
+    // 減らす時の下限
+    int min_in_flight = 1;
+    // これより接続に時間がかかったら上限を減らす
+    std::chrono::milliseconds latency_threshold = std::chrono::seconds(5);
+  };
+
+  static std::shared_ptr<AdmissionController> Create(const Config& config);
+
+  // 接続処理を始めて良くなったら ioc で on_admitted を呼ぶ
+  // on_admitted が呼ばれたら、必ず Done か Release を呼ぶこと
+  void Request(boost::asio::io_context& ioc, std::function<void()> on_admitted);
+  // 接続処理が終わった
+  void Done(bool success, std::chrono::milliseconds latency);
+  // 結果を上限の調整に使わずに枠を返す
+  void Release();
+  // インスタンスが終了する時に、まだ許可していない要求を捨てる
+  void Cancel(boost::asio::io_context& ioc);
+
+  struct Stats {
+    double limit;
+    int in_flight;
+    int queued;
+    uint64_t admitted;
+    uint64_t succeeded;
+    uint64_t failed;
+    uint64_t slow;
+    uint64_t backoffs;
+    HistogramSnapshot connect_time_ms;
+  };
+  Stats GetStats() const;
+
+ private:
+  AdmissionController(const Config& config);
+  // mutex_ をロックした状態で呼ぶ
+  void Dispatch();
+
+  struct Waiter {
+    boost::asio::io_context* ioc;
+    std::function<void()> on_admitted;
+  };
+
+  Config config_;
+  mutable std::mutex mutex_;
+  double limit_;
+  int in_flight_ = 0;
+  std::deque<Waiter> queue_;
+  std::chrono::steady_clock::time_point last_backoff_at_;
+  uint64_t admitted_ = 0;
+  uint64_t succeeded_ = 0;
+  uint64_t failed_ = 0;
+  uint64_t slow_ = 0;
+  uint64_t backoffs_ = 0;
+  Histogram connect_time_ms_;
+};
+
+#endif
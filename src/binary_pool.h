@@ -3,12 +3,30 @@
 
 #include <algorithm>
 #include <array>
+#include <cstring>
 #include <memory>
+#include <random>
 #include <string>
+#include <vector>
 
 class BinaryPool {
  public:
-  BinaryPool(int pool_size) {
+  // プールの中身の種類
+  // 圧縮の効き具合が変わるので、DataChannel の compress の負荷を測るのに使う
+  enum class Payload {
+    // 乱数（圧縮できない）
+    Random,
+    // 決まった単語をランダムに並べたテキスト
+    Dictionary,
+    // JSON 風のテキスト
+    Json,
+    // random_ratio の割合で乱数、残りを単語のテキストにしたもの
+    Mixed,
+  };
+
+  BinaryPool(int pool_size,
+             Payload payload = Payload::Random,
+             double random_ratio = 0.5) {
     std::array<int, 2 * std::mt19937_64::state_size> seed;
     std::random_device r;
     std::generate(seed.begin(), seed.end(), std::ref(r));
@@ -19,26 +37,112 @@ class BinaryPool {
     size_ = n * sizeof(uint64_t);
     bin_.reset(new uint8_t[size_]);
     uint8_t* p = bin_.get();
-    for (int i = 0; i < n; i++) {
-      *(uint64_t*)p = engine_();
-      p += sizeof(uint64_t);
+    switch (payload) {
+      case Payload::Random:
+        FillRandom(p, size_);
+        break;
+      case Payload::Dictionary:
+        FillWords(p, size_);
+        break;
+      case Payload::Json:
+        FillJson(p, size_);
+        break;
+      case Payload::Mixed: {
+        // 圧縮はある程度の長さの繰り返しを探すので、ブロック単位で混ぜる
+        const int block = 64;
+        std::bernoulli_distribution is_random(random_ratio);
+        for (int i = 0; i < size_; i += block) {
+          const int len = std::min(block, size_ - i);
+          if (is_random(engine_)) {
+            FillRandom(p + i, len);
+          } else {
+            FillWords(p + i, len);
+          }
+        }
+        break;
+      }
     }
   }
   std::string Get(int min_size, int max_size) {
+    std::string r;
+    Fill(r, 0, min_size, max_size);
+    return r;
+  }
+
+  // r の offset 以降をランダムなサイズのバイナリで埋める
+  // r の容量が足りていればメモリ確保は発生しない
+  void Fill(std::string& r, size_t offset, int min_size, int max_size) {
     int size = std::uniform_int_distribution<int>(min_size, max_size)(engine_);
     int pos = std::uniform_int_distribution<int>(0, size_ - 1)(engine_);
-    std::string r;
-    r.reserve(size);
+    r.resize(offset + size);
     auto p = (const char*)bin_.get();
-    // pos から pos + size (size_ を超えると 0 からループ) までのバイナリを返す
+    char* q = r.data() + offset;
+    // pos から pos + size (size_ を超えると 0 からループ) までのバイナリを書き込む
     while (size > 0) {
       const int start = pos % size_;
       const int n = std::min(size, size_ - start);
-      r.insert(r.end(), p + start, p + start + n);
+      memcpy(q, p + start, n);
+      q += n;
       pos += n;
       size -= n;
     }
-    return r;
+  }
+
+ private:
+  void FillRandom(uint8_t* p, int size) {
+    while (size > 0) {
+      uint64_t v = engine_();
+      const int n = std::min<int>(size, sizeof(v));
+      memcpy(p, &v, n);
+      p += n;
+      size -= n;
+    }
+  }
+
+  static const std::vector<std::string>& Words() {
+    static const std::vector<std::string> words = {
+        "hello",   "world",  "sora",    "zakuro",   "message", "channel",
+        "data",    "video",  "audio",   "client",   "server",  "event",
+        "update",  "status", "user",    "room",     "join",    "leave",
+        "connect", "ok",     "error",   "true",     "false",   "null",
+        "value",   "time",   "count",   "position", "score",   "chat",
+        "ping",    "pong",
+    };
+    return words;
+  }
+
+  // p に size バイトちょうどになるまで text を書き込む
+  static void Append(uint8_t*& p, int& size, const std::string& text) {
+    const int n = std::min<int>(size, text.size());
+    memcpy(p, text.data(), n);
+    p += n;
+    size -= n;
+  }
+
+  void FillWords(uint8_t* p, int size) {
+    const auto& words = Words();
+    std::uniform_int_distribution<size_t> dist(0, words.size() - 1);
+    while (size > 0) {
+      Append(p, size, words[dist(engine_)]);
+      Append(p, size, " ");
+    }
+  }
+
+  void FillJson(uint8_t* p, int size) {
+    const auto& words = Words();
+    std::uniform_int_distribution<size_t> dist(0, words.size() - 1);
+    std::uniform_int_distribution<int> num(0, 99999);
+    while (size > 0) {
+      std::string text = "{\"id\":" + std::to_string(num(engine_)) +
+                         ",\"type\":\"" + words[dist(engine_)] +
+                         "\",\"user\":\"" + words[dist(engine_)] + "-" +
+                         std::to_string(num(engine_) % 100) +
+                         "\",\"text\":\"" + words[dist(engine_)] + " " +
+                         words[dist(engine_)] + " " + words[dist(engine_)] +
+                         "\",\"value\":" + std::to_string(num(engine_)) +
+                         "}\n";
+      Append(p, size, text);
+    }
   }
 
  private:
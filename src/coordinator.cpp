@@ -0,0 +1,375 @@
+#include "coordinator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "follower.h"
+#include "rpc_client.h"
+
+namespace {
+
+// 連続してこの回数だけ接続に失敗したフォロワーは終了したとみなす
+constexpr int kMaxFailures = 5;
+constexpr auto kPollInterval = std::chrono::seconds(1);
+constexpr auto kCallTimeout = std::chrono::seconds(10);
+// GetStats は HTTP サーバーのスレッドで呼ぶので短めにする
+constexpr auto kStatsTimeout = std::chrono::seconds(5);
+
+std::atomic<bool> g_stop_requested{false};
+
+void RequestStop(int) {
+  g_stop_requested.store(true);
+}
+
+int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// instance の値を整数として取得する。無いか整数でなければ 1
+int GetInt(const boost::json::object& obj, const char* key) {
+  auto p = obj.if_contains(key);
+  if (p == nullptr) {
+    return 1;
+  }
+  if (p->is_int64() || p->is_uint64()) {
+    return p->to_number<int>();
+  }
+  if (p->is_string()) {
+    try {
+      return std::stoi(std::string(p->as_string()));
+    } catch (const std::exception&) {
+    }
+  }
+  return 1;
+}
+
+}  // namespace
+
+std::shared_ptr<Coordinator> Coordinator::Create(
+    const std::vector<std::string>& followers,
+    const std::string& token,
+    const boost::json::value& config,
+    std::string& error) {
+  if (!config.is_object()) {
+    error = "config must be an object";
+    return nullptr;
+  }
+  const auto& obj = config.as_object();
+  auto p = obj.if_contains("instances");
+  if (p == nullptr || !p->is_array() || p->as_array().empty()) {
+    error = "config must have instances";
+    return nullptr;
+  }
+  const auto& instances = p->as_array();
+  int total = 0;
+  for (int i = 0; i < instances.size(); i++) {
+    if (!instances[i].is_object()) {
+      error = "instances[" + std::to_string(i) + "] must be an object";
+      return nullptr;
+    }
+    const auto& inst = instances[i].as_object();
+    total += GetInt(inst, "instance-num") * GetInt(inst, "vcs");
+  }
+  if (total < followers.size()) {
+    error = "the sum of vcs (" + std::to_string(total) +
+            ") is less than the number of followers (" +
+            std::to_string(followers.size()) + ")";
+    return nullptr;
+  }
+
+  std::shared_ptr<Coordinator> coordinator(new Coordinator());
+  coordinator->token_ = token;
+  auto& nodes = coordinator->nodes_;
+  nodes.resize(followers.size());
+  for (int i = 0; i < followers.size(); i++) {
+    nodes[i].url = followers[i];
+  }
+
+  // instance-num × vcs の合計を均等に分けた量ずつ、先頭のフォロワーから順に詰める。
+  // 入りきらないインスタンスは instance-num を分け、
+  // それでも入りきらない 1 インスタンス分は vcs を分ける。
+  // 分けたインスタンスは instance-offset で ${} の番号を引き継ぐ
+  std::vector<int> remaining(nodes.size(), total / nodes.size());
+  for (int k = 0; k < total % nodes.size(); k++) {
+    remaining[k] += 1;
+  }
+  std::vector<boost::json::array> node_instances(nodes.size());
+  int k = 0;
+  auto assign = [&](const boost::json::object& inst, int num, int vcs,
+                    int offset) {
+    boost::json::object piece = inst;
+    piece["instance-num"] = num;
+    piece["vcs"] = vcs;
+    if (offset > 0) {
+      piece["instance-offset"] = offset;
+    }
+    node_instances[k].push_back(std::move(piece));
+    nodes[k].capacity += num * vcs;
+    remaining[k] -= num * vcs;
+  };
+  for (const auto& value : instances) {
+    const auto& inst = value.as_object();
+    int num = GetInt(inst, "instance-num");
+    int vcs = GetInt(inst, "vcs");
+    int index = 0;
+    while (index < num) {
+      bool last = k + 1 == nodes.size();
+      if (!last && remaining[k] <= 0) {
+        k++;
+        continue;
+      }
+      int whole = last || vcs <= 0 ? num - index
+                                   : std::min(num - index, remaining[k] / vcs);
+      if (whole > 0) {
+        assign(inst, whole, vcs, index);
+        index += whole;
+        continue;
+      }
+      // 1 インスタンス分も入らないので vcs を分ける
+      int left = vcs;
+      while (left > 0) {
+        int n = k + 1 == nodes.size() ? left : std::min(left, remaining[k]);
+        if (n > 0) {
+          assign(inst, 1, n, index);
+          left -= n;
+        }
+        if (left > 0) {
+          k++;
+        }
+      }
+      index++;
+    }
+  }
+
+  for (int k = 0; k < nodes.size(); k++) {
+    // フォロワーのマシンに依存するキーはフォロワーのコマンドラインで指定する
+    boost::json::object c = obj;
+    c["instances"] = std::move(node_instances[k]);
+    Follower::RemoveLocalKeys(c);
+    nodes[k].config = std::move(c);
+  }
+
+  // 負荷プロファイルの vcs はフォロワー毎の vcs の合計の比率で振り分ける
+  if (auto lp = obj.if_contains("load-profile"); lp && lp->is_array()) {
+    const auto& phases = lp->as_array();
+    for (int i = 0; i < phases.size(); i++) {
+      auto vcs = phases[i].is_object() ? phases[i].as_object().if_contains("vcs")
+                                       : nullptr;
+      if (vcs == nullptr || !(vcs->is_int64() || vcs->is_uint64())) {
+        continue;
+      }
+      auto split = coordinator->Split(vcs->to_number<int>());
+      for (int k = 0; k < nodes.size(); k++) {
+        nodes[k]
+            .config.as_object()["load-profile"]
+            .as_array()[i]
+            .as_object()["vcs"] = split[k];
+      }
+    }
+  }
+  return coordinator;
+}
+
+bool Coordinator::Start(double delay_sec, std::string& error) {
+  start_at_ms_ = NowMs() + (int64_t)(delay_sec * 1000);
+  std::vector<boost::json::value> params;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& node : nodes_) {
+      params.push_back(boost::json::object{{"config", node.config},
+                                           {"start_at_ms", start_at_ms_}});
+    }
+  }
+  auto results = CallAll("Prepare", params);
+  for (const auto& r : results) {
+    if (!r.ok) {
+      error = r.error;
+      // 準備できたフォロワーも開始させない
+      Stop();
+      return false;
+    }
+  }
+  return true;
+}
+
+int Coordinator::Wait() {
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = RequestStop;
+  sigemptyset(&sa.sa_mask);
+  struct sigaction old_int, old_term;
+  sigaction(SIGINT, &sa, &old_int);
+  sigaction(SIGTERM, &sa, &old_term);
+
+  int result = 0;
+  bool stopping = false;
+  while (true) {
+    if (g_stop_requested.exchange(false)) {
+      // 2 回目は待たずに終了する
+      if (stopping) {
+        result = 1;
+        break;
+      }
+      stopping = true;
+      Stop();
+    }
+
+    auto results = CallAll("GetFollowerStatus", {});
+    bool all_finished = true;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      for (int k = 0; k < nodes_.size(); k++) {
+        auto& node = nodes_[k];
+        if (node.finished) {
+          continue;
+        }
+        if (results[k].ok) {
+          node.failures = 0;
+          auto state = results[k].result.is_object()
+                           ? results[k].result.as_object().if_contains("state")
+                           : nullptr;
+          node.finished = state != nullptr && state->is_string() &&
+                          state->as_string() == "finished";
+        } else if (++node.failures >= kMaxFailures) {
+          std::cerr << "[" << node.url << "] " << results[k].error
+                    << std::endl;
+          node.finished = true;
+          result = 1;
+        }
+        if (!node.finished) {
+          all_finished = false;
+        }
+      }
+    }
+    if (all_finished) {
+      break;
+    }
+    std::this_thread::sleep_for(kPollInterval);
+  }
+
+  sigaction(SIGINT, &old_int, nullptr);
+  sigaction(SIGTERM, &old_term, nullptr);
+  return result;
+}
+
+bool Coordinator::SetLoad(int vcs, std::string& error) {
+  int max_vcs = 0;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& node : nodes_) {
+      max_vcs += node.capacity;
+    }
+  }
+  if (vcs < 0 || vcs > max_vcs) {
+    error = "vcs must be between 0 and the sum of vcs (" +
+            std::to_string(max_vcs) + ")";
+    return false;
+  }
+  std::vector<boost::json::value> params;
+  for (int n : Split(vcs)) {
+    params.push_back(boost::json::object{{"vcs", n}});
+  }
+  bool ok = true;
+  for (const auto& r : CallAll("SetLoad", params)) {
+    if (!r.ok) {
+      error += (error.empty() ? "" : ", ") + r.error;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+void Coordinator::Stop() {
+  CallAll("Stop", {});
+}
+
+std::vector<Coordinator::NodeStats> Coordinator::GetStats() {
+  auto results = CallAll("GetStats", {});
+  std::vector<NodeStats> stats;
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (int k = 0; k < nodes_.size(); k++) {
+    NodeStats st;
+    st.url = nodes_[k].url;
+    st.capacity = nodes_[k].capacity;
+    st.stats = std::move(results[k].result);
+    st.error = std::move(results[k].error);
+    stats.push_back(std::move(st));
+  }
+  return stats;
+}
+
+std::vector<Coordinator::CallResult> Coordinator::CallAll(
+    const std::string& method,
+    const std::vector<boost::json::value>& params) const {
+  std::vector<std::string> urls;
+  std::vector<bool> finished;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& node : nodes_) {
+      urls.push_back(node.url);
+      finished.push_back(node.finished);
+    }
+  }
+  auto timeout = method == "GetStats" ? kStatsTimeout : kCallTimeout;
+  std::vector<CallResult> results(urls.size());
+  std::vector<std::thread> ths;
+  for (int k = 0; k < urls.size(); k++) {
+    if (finished[k]) {
+      results[k] = {false, nullptr, urls[k] + ": finished"};
+      continue;
+    }
+    ths.emplace_back([&, k]() {
+      auto& r = results[k];
+      boost::json::value p =
+          params.empty() ? boost::json::value() : params[k];
+      // 状態を変えるメソッドにはトークンを付ける
+      if (!token_.empty() &&
+          (method == "Prepare" || method == "SetLoad" || method == "Stop")) {
+        if (!p.is_object()) {
+          p = boost::json::object();
+        }
+        p.as_object()["token"] = token_;
+      }
+      r.ok = RpcClient::Call(urls[k], method, p, r.result, r.error, timeout);
+    });
+  }
+  for (auto& th : ths) {
+    th.join();
+  }
+  return results;
+}
+
+std::vector<int> Coordinator::Split(int total) const {
+  // 端数は小数部分が大きいフォロワーから 1 つずつ割り振る
+  std::vector<int> result(nodes_.size());
+  int sum = 0;
+  for (const auto& node : nodes_) {
+    sum += node.capacity;
+  }
+  if (sum == 0) {
+    return result;
+  }
+  int assigned = 0;
+  std::vector<std::pair<double, int>> remainders;
+  for (int k = 0; k < nodes_.size(); k++) {
+    double exact = (double)total * nodes_[k].capacity / sum;
+    result[k] = (int)std::floor(exact);
+    assigned += result[k];
+    remainders.push_back({exact - result[k], k});
+  }
+  std::stable_sort(
+      remainders.begin(), remainders.end(),
+      [](const auto& a, const auto& b) { return a.first > b.first; });
+  for (int i = 0; i < total - assigned && i < remainders.size(); i++) {
+    result[remainders[i].second] += 1;
+  }
+  return result;
+}
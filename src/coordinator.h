@@ -0,0 +1,96 @@
+#ifndef COORDINATOR_H_
+#define COORDINATOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/json.hpp>
+
+struct DistributedConfig {
+  // コーディネーターから設定を受け取って実行する
+  bool follower = false;
+  // フォロワーの URL。指定した場合はコーディネーターとして動く
+  std::vector<std::string> followers;
+  // フォロワーに設定を送ってから開始するまでの秒数
+  double start_delay = 5.0;
+  // コーディネーターとフォロワーで共有するトークン
+  // フォロワーは Prepare/SetLoad/Stop の params.token がこれと一致しなければ拒否する
+  std::string token;
+};
+
+// 複数のマシンで動かしている --follower の zakuro をまとめて操作する
+//
+// --config の instances をフォロワーに振り分けて RPC の Prepare で送り、
+// 全てのフォロワーで同じ時刻に開始させる。
+// 実行中は仮想クライアント数の変更や停止を全てのフォロワーに伝え、
+// 統計は各フォロワーから取得してまとめる。
+class Coordinator {
+ public:
+  // config は --config と同じ形式の設定
+  // 失敗した場合は error にメッセージを入れて nullptr を返す
+  // token は Prepare/SetLoad/Stop の params に付けて送る
+  static std::shared_ptr<Coordinator> Create(
+      const std::vector<std::string>& followers,
+      const std::string& token,
+      const boost::json::value& config,
+      std::string& error);
+
+  // 全てのフォロワーに設定を送り、delay_sec 秒後に開始させる
+  // 失敗した場合は送ったフォロワーを止めて false を返す
+  bool Start(double delay_sec, std::string& error);
+  // 全てのフォロワーが終了するまで待つ
+  // SIGINT や SIGTERM を受け取ったら全てのフォロワーを止める
+  // 全てのフォロワーが正常に終了したら 0 を返す
+  int Wait();
+
+  // 全てのフォロワーを合わせた仮想クライアント数を vcs にする
+  // フォロワー毎の vcs の合計の比率で振り分ける
+  bool SetLoad(int vcs, std::string& error);
+  void Stop();
+
+  struct NodeStats {
+    std::string url;
+    int capacity;
+    // 取得に失敗した場合は error にメッセージが入る
+    boost::json::value stats;
+    std::string error;
+  };
+  // 全てのフォロワーの GetStats の結果
+  std::vector<NodeStats> GetStats();
+  int64_t GetStartAtMs() const { return start_at_ms_; }
+
+ private:
+  Coordinator() = default;
+
+  struct Node {
+    std::string url;
+    // このフォロワーの instances の vcs の合計
+    int capacity = 0;
+    boost::json::value config;
+    bool finished = false;
+    // 連続して接続に失敗した回数
+    int failures = 0;
+  };
+  struct CallResult {
+    bool ok;
+    boost::json::value result;
+    std::string error;
+  };
+  // 全てのフォロワーの method を並列に呼び出す
+  std::vector<CallResult> CallAll(
+      const std::string& method,
+      const std::vector<boost::json::value>& params) const;
+  // total をフォロワーの vcs の合計の比率で振り分ける
+  std::vector<int> Split(int total) const;
+
+  std::vector<Node> nodes_;
+  std::string token_;
+  int64_t start_at_ms_ = 0;
+  mutable std::mutex mutex_;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "data_channel_backpressure.h"
+
+#include <algorithm>
+
+#include "memory_usage.h"
+
+DataChannelSendQueue::DataChannelSendQueue(
+    const DataChannelBackpressureConfig& config,
+    std::string label)
+    : config_(config) {
+  stats_.label = std::move(label);
+}
+
+bool DataChannelSendQueue::Send(const std::string& data,
+                                const SendFunc& send) {
+  if (config_.policy == DataChannelBackpressureConfig::Policy::None) {
+    if (!send(data)) {
+      stats_.send_failed += 1;
+      return false;
+    }
+    stats_.messages += 1;
+    stats_.bytes += data.size();
+    return true;
+  }
+
+  if (!blocked_ && stats_.buffered_amount >= config_.high_watermark) {
+    blocked_ = true;
+    stats_.blocked += 1;
+  }
+  if (!blocked_) {
+    return DoSend(data, send);
+  }
+
+  switch (config_.policy) {
+    case DataChannelBackpressureConfig::Policy::Block:
+      // 保留するメッセージも無制限には溜めない
+      if (pending_bytes_ + (int64_t)data.size() > config_.high_watermark) {
+        stats_.dropped += 1;
+        return false;
+      }
+      pending_.push_back(data);
+      pending_bytes_ += data.size();
+      stats_.delayed += 1;
+      break;
+    case DataChannelBackpressureConfig::Policy::Drop:
+      stats_.dropped += 1;
+      break;
+    case DataChannelBackpressureConfig::Policy::Coalesce:
+      if (pending_.empty()) {
+        pending_.push_back(data);
+        stats_.delayed += 1;
+      } else {
+        pending_.back() = data;
+        stats_.coalesced += 1;
+      }
+      pending_bytes_ = pending_.back().size();
+      break;
+    case DataChannelBackpressureConfig::Policy::None:
+      break;
+  }
+  return false;
+}
+
+void DataChannelSendQueue::OnMessagesSent(uint64_t messages_sent,
+                                          const SendFunc& send) {
+  if (config_.policy == DataChannelBackpressureConfig::Policy::None) {
+    return;
+  }
+  while (confirmed_messages_ < messages_sent && !in_flight_.empty()) {
+    stats_.buffered_amount -= in_flight_.front();
+    in_flight_.pop_front();
+    confirmed_messages_ += 1;
+  }
+
+  if (blocked_ && stats_.buffered_amount <= config_.low_watermark) {
+    blocked_ = false;
+  }
+  while (!blocked_ && !pending_.empty() &&
+         stats_.buffered_amount < config_.high_watermark) {
+    std::string data = std::move(pending_.front());
+    pending_.pop_front();
+    pending_bytes_ -= data.size();
+    DoSend(data, send);
+  }
+}
+
+void DataChannelSendQueue::Reset() {
+  blocked_ = false;
+  in_flight_.clear();
+  confirmed_messages_ = 0;
+  pending_.clear();
+  pending_bytes_ = 0;
+  stats_.buffered_amount = 0;
+}
+
+DataChannelSendStats DataChannelSendQueue::GetStats() const {
+  DataChannelSendStats st = stats_;
+  st.pending = pending_.size();
+  return st;
+}
+
+size_t DataChannelSendQueue::GetMemoryUsage() const {
+  size_t size = sizeof(*this) + StringHeapBytes(stats_.label) +
+                in_flight_.size() * sizeof(int);
+  for (const auto& data : pending_) {
+    size += sizeof(std::string) + StringHeapBytes(data);
+  }
+  return size;
+}
+
+bool DataChannelSendQueue::DoSend(const std::string& data,
+                                  const SendFunc& send) {
+  if (!send(data)) {
+    stats_.send_failed += 1;
+    return false;
+  }
+  stats_.messages += 1;
+  stats_.bytes += data.size();
+  stats_.buffered_amount += data.size();
+  stats_.max_buffered_amount =
+      std::max(stats_.max_buffered_amount, stats_.buffered_amount);
+  in_flight_.push_back(data.size());
+  return true;
+}
@@ -0,0 +1,90 @@
+#ifndef DATA_CHANNEL_BACKPRESSURE_H_
+#define DATA_CHANNEL_BACKPRESSURE_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+
+struct DataChannelBackpressureConfig {
+  enum class Policy {
+    // 何もせずに送信し続ける
+    None,
+    // 閾値を超えたら送信を保留し、下回ったら送信する
+    Block,
+    // 閾値を超えたら破棄する
+    Drop,
+    // 閾値を超えたら最新の 1 メッセージだけを保留する
+    Coalesce,
+  };
+  Policy policy = Policy::None;
+  // 送信バッファの量（推定）がこれを超えたらポリシーを適用し、
+  // low_watermark を下回ったら通常の送信に戻す
+  int64_t high_watermark = 1024 * 1024;
+  int64_t low_watermark = 256 * 1024;
+  // 送信中のメッセージがある間、送信済みメッセージ数を WebRTC の統計情報から
+  // 取得する間隔
+  int poll_interval_ms = 100;
+};
+
+struct DataChannelSendStats {
+  std::string label;
+  uint64_t messages = 0;
+  uint64_t bytes = 0;
+  // 送信バッファに残っていると推定されるバイト数
+  int64_t buffered_amount = 0;
+  int64_t max_buffered_amount = 0;
+  uint64_t dropped = 0;
+  uint64_t delayed = 0;
+  uint64_t coalesced = 0;
+  // SDK に渡したが送信できなかったメッセージ数
+  uint64_t send_failed = 0;
+  // 閾値を超えていた回数
+  uint64_t blocked = 0;
+  size_t pending = 0;
+};
+
+// ラベル毎に送信バッファの量を推定して、ポリシーに従って送信を制御する
+//
+// Sora C++ SDK からは DataChannel の bufferedAmount が取れないので、
+// SDK が受け付けたメッセージのサイズを順番に覚えておき、RTCDataChannelStats の
+// messagesSent の分だけ先頭から取り除いた残りを送信バッファの量とみなす。
+// SDK が受け付けなかったメッセージは messagesSent にも数えられないので覚えない。
+// 全て VirtualClient のスレッドから呼ぶこと。
+class DataChannelSendQueue {
+ public:
+  // SDK が受け付けた場合は true を返す
+  typedef std::function<bool(const std::string&)> SendFunc;
+
+  DataChannelSendQueue(const DataChannelBackpressureConfig& config,
+                       std::string label);
+
+  // 送信できた場合は true を返す
+  // 破棄したり保留したり、send が失敗した場合は false を返す
+  bool Send(const std::string& data, const SendFunc& send);
+  // 統計情報から取得した、これまでに送信済みのメッセージ数を反映する
+  void OnMessagesSent(uint64_t messages_sent, const SendFunc& send);
+  // 切断したら送信バッファも保留中のメッセージも無くなる
+  void Reset();
+  // messagesSent で確認できていないメッセージがあるか
+  // 無い間は統計情報を取得する必要がない
+  bool HasInFlight() const { return !in_flight_.empty(); }
+
+  DataChannelSendStats GetStats() const;
+  // このオブジェクトと、保留中や送信中のメッセージが使っているバイト数
+  size_t GetMemoryUsage() const;
+
+ private:
+  bool DoSend(const std::string& data, const SendFunc& send);
+
+  DataChannelBackpressureConfig config_;
+  DataChannelSendStats stats_;
+  bool blocked_ = false;
+  // 送信済みだが、まだ送信バッファに残っている可能性のあるメッセージのサイズ
+  std::deque<int> in_flight_;
+  uint64_t confirmed_messages_ = 0;
+  std::deque<std::string> pending_;
+  int64_t pending_bytes_ = 0;
+};
+
+#endif
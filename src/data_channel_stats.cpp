@@ -0,0 +1,220 @@
+#include "data_channel_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "memory_usage.h"
+
+void DataChannelHeader::Write(char* buf,
+                              uint64_t time_us,
+                              uint64_t counter,
+                              const std::string& connection_id) {
+  memcpy(buf, "ZAKURO", 6);
+  char* p = buf + 6;
+  for (int i = 0; i < 8; i++) {
+    p[i] = (char)((time_us >> ((7 - i) * 8)) & 0xff);
+  }
+  p += 8;
+  for (int i = 0; i < 8; i++) {
+    p[i] = (char)((counter >> ((7 - i) * 8)) & 0xff);
+  }
+  p += 8;
+  memset(p, 0, 26);
+  memcpy(p, connection_id.c_str(), std::min<size_t>(connection_id.size(), 26));
+}
+
+bool DataChannelHeader::Read(const std::string& data) {
+  if (data.size() < kSize || data.compare(0, 6, "ZAKURO") != 0) {
+    return false;
+  }
+  const uint8_t* p = (const uint8_t*)data.data() + 6;
+  time_us = 0;
+  for (int i = 0; i < 8; i++) {
+    time_us = (time_us << 8) | p[i];
+  }
+  p += 8;
+  counter = 0;
+  for (int i = 0; i < 8; i++) {
+    counter = (counter << 8) | p[i];
+  }
+  p += 8;
+  connection_id.assign((const char*)p, strnlen((const char*)p, 26));
+  return true;
+}
+
+namespace {
+
+// この時間受信していない送信元の統計は捨てる
+constexpr std::chrono::seconds kSenderIdleTimeout(300);
+// 捨てる送信元を探す間隔
+constexpr std::chrono::seconds kPruneInterval(10);
+
+}  // namespace
+
+void DataChannelReceiveStats::Counters::AddLatency(int64_t value) {
+  if (latency_ms == nullptr) {
+    latency_ms.reset(new Histogram(Histogram::LatencyMsBounds()));
+  }
+  latency_ms->Add(value);
+}
+
+void DataChannelReceiveStats::Counters::CopyTo(
+    DataChannelReceiveStatsEntry& e) const {
+  e.messages = messages;
+  e.bytes = bytes;
+  e.lost = lost;
+  e.reordered = reordered;
+  e.duplicated = duplicated;
+  e.late = late;
+  if (latency_ms != nullptr) {
+    e.latency_ms = latency_ms->GetSnapshot();
+  }
+}
+
+void DataChannelReceiveStats::OnMessage(const std::string& label,
+                                        const std::string& data) {
+  DataChannelHeader header;
+  if (!header.Read(data)) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    unknown_messages_ += 1;
+    return;
+  }
+
+  int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+  int64_t latency_ms = (now_us - (int64_t)header.time_us) / 1000;
+
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> guard(mutex_);
+  PruneIdleSenders(now);
+  auto& l = labels_[label];
+  auto& s = l.senders[header.connection_id];
+  if (per_sender_ && s.counters == nullptr) {
+    s.counters.reset(new Counters());
+  }
+  // ラベル毎と、有効なら送信元毎の両方に数える
+  Counters* counters[2] = {&l.counters, s.counters.get()};
+  auto add = [&counters](uint64_t Counters::*field, uint64_t n) {
+    for (auto* c : counters) {
+      if (c != nullptr) {
+        c->*field += n;
+      }
+    }
+  };
+
+  s.last_received_at = now;
+  s.messages += 1;
+  add(&Counters::messages, 1);
+  add(&Counters::bytes, data.size());
+  // 時計がずれていると負になるので、その場合は記録しない
+  if (latency_ms >= 0) {
+    for (auto* c : counters) {
+      if (c != nullptr) {
+        c->AddLatency(latency_ms);
+      }
+    }
+  }
+
+  const uint64_t c = header.counter;
+  if (s.messages == 1) {
+    s.highest = c;
+    s.recent = 1;
+  } else if (c > s.highest) {
+    uint64_t d = c - s.highest;
+    add(&Counters::lost, d - 1);
+    s.recent = d >= 64 ? 1 : (s.recent << d) | 1;
+    s.highest = c;
+  } else {
+    uint64_t d = s.highest - c;
+    if (d >= 64) {
+      // 受信済みかどうか覚えていないので、欠落の数は変えない
+      add(&Counters::late, 1);
+    } else if (s.recent & (1ULL << d)) {
+      add(&Counters::duplicated, 1);
+    } else {
+      // 欠落したと思っていたものが後から届いた
+      s.recent |= 1ULL << d;
+      add(&Counters::reordered, 1);
+      for (auto* counter : counters) {
+        if (counter != nullptr && counter->lost > 0) {
+          counter->lost -= 1;
+        }
+      }
+    }
+  }
+}
+
+void DataChannelReceiveStats::PruneIdleSenders(
+    std::chrono::steady_clock::time_point now) {
+  if (now - last_pruned_at_ < kPruneInterval) {
+    return;
+  }
+  last_pruned_at_ = now;
+  // ラベル毎の統計は送信元を捨てても残す
+  for (auto& p : labels_) {
+    auto& senders = p.second.senders;
+    for (auto it = senders.begin(); it != senders.end();) {
+      if (now - it->second.last_received_at > kSenderIdleTimeout) {
+        it = senders.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+uint64_t DataChannelReceiveStats::GetUnknownMessages() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return unknown_messages_;
+}
+
+std::vector<DataChannelReceiveStatsEntry> DataChannelReceiveStats::Get()
+    const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::vector<DataChannelReceiveStatsEntry> r;
+  for (const auto& p : labels_) {
+    DataChannelReceiveStatsEntry e;
+    e.label = p.first;
+    e.senders = (int)p.second.senders.size();
+    p.second.counters.CopyTo(e);
+    if (per_sender_) {
+      for (const auto& q : p.second.senders) {
+        DataChannelReceiveStatsEntry se;
+        se.label = p.first;
+        se.sender_connection_id = q.first;
+        se.senders = 1;
+        if (q.second.counters != nullptr) {
+          q.second.counters->CopyTo(se);
+        }
+        e.per_sender.push_back(std::move(se));
+      }
+    }
+    r.push_back(std::move(e));
+  }
+  return r;
+}
+
+size_t DataChannelReceiveStats::GetMemoryUsage() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  // map のノードはキーと値の他にポインタ 3 つと色を持つ
+  const size_t node_bytes = 4 * sizeof(void*);
+  size_t size = 0;
+  for (const auto& p : labels_) {
+    size += sizeof(p) + node_bytes + StringHeapBytes(p.first);
+    if (p.second.counters.latency_ms != nullptr) {
+      size += p.second.counters.latency_ms->GetMemoryUsage();
+    }
+    for (const auto& q : p.second.senders) {
+      size += sizeof(q) + node_bytes + StringHeapBytes(q.first);
+      if (q.second.counters != nullptr) {
+        size += sizeof(Counters);
+        if (q.second.counters->latency_ms != nullptr) {
+          size += q.second.counters->latency_ms->GetMemoryUsage();
+        }
+      }
+    }
+  }
+  return size;
+}
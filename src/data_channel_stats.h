@@ -0,0 +1,119 @@
+#ifndef DATA_CHANNEL_STATS_H_
+#define DATA_CHANNEL_STATS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+
+// Zakuro が送信する DataChannel メッセージの先頭に付けるヘッダー
+//
+// 0-5 (6 bytes): ZAKURO
+// 6-13 (8 bytes): 現在時刻（マイクロ秒単位の UNIX Time）
+// 14-21 (8 bytes): 送信元のラベルごとに一意に増えていくカウンター
+// 22-47 (26 bytes): Connection ID
+struct DataChannelHeader {
+  static constexpr size_t kSize = 48;
+
+  uint64_t time_us = 0;
+  uint64_t counter = 0;
+  std::string connection_id;
+
+  // buf に kSize バイトのヘッダーを書き込む
+  static void Write(char* buf,
+                    uint64_t time_us,
+                    uint64_t counter,
+                    const std::string& connection_id);
+  // ZAKURO のヘッダーでなければ false を返す
+  bool Read(const std::string& data);
+};
+
+// 受信した DataChannel メッセージのラベル毎の統計
+// 送信元毎の統計を有効にした場合は、per_sender に送信元毎の統計が入る
+struct DataChannelReceiveStatsEntry {
+  std::string label;
+  // per_sender の要素の場合だけ入る
+  std::string sender_connection_id;
+  // 統計を持っている送信元の数
+  int senders = 0;
+  uint64_t messages = 0;
+  uint64_t bytes = 0;
+  // カウンターが飛んでいた数（後から届いたものは差し引く）
+  uint64_t lost = 0;
+  // カウンターが前後して届いた数
+  uint64_t reordered = 0;
+  // 同じカウンターのメッセージが届いた数
+  uint64_t duplicated = 0;
+  // 直近 64 個より前のカウンターが届いた数
+  // 欠落していたのか重複なのか区別できないので lost は変えない
+  uint64_t late = 0;
+  // 送信時刻から受信までの片道の遅延
+  HistogramSnapshot latency_ms;
+  std::vector<DataChannelReceiveStatsEntry> per_sender;
+};
+
+// 各 VirtualClient が受信した DataChannel メッセージを集計する
+// 受信は Sora C++ SDK のスレッドから、取得は別のスレッドから行われる
+//
+// 欠落や重複を判定するために送信元毎にカウンターの状態を持つが、
+// 全ての仮想クライアントが送信する場合は受信側全体で送信元の数の 2 乗になるので、
+// 遅延のヒストグラムと結果はデフォルトではラベル毎にまとめる。
+// 送信元は再接続する度に増えていくので、しばらく受信していない送信元は捨てる
+class DataChannelReceiveStats {
+ public:
+  // per_sender が true の場合は、送信元毎にも遅延のヒストグラムと統計を持つ
+  explicit DataChannelReceiveStats(bool per_sender = false)
+      : per_sender_(per_sender) {}
+
+  void OnMessage(const std::string& label, const std::string& data);
+
+  // ZAKURO のヘッダーが無かったメッセージの数
+  uint64_t GetUnknownMessages() const;
+  std::vector<DataChannelReceiveStatsEntry> Get() const;
+  // ラベル毎と送信元毎の集計が使っているバイト数
+  size_t GetMemoryUsage() const;
+
+ private:
+  struct Counters {
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    uint64_t lost = 0;
+    uint64_t reordered = 0;
+    uint64_t duplicated = 0;
+    uint64_t late = 0;
+    std::unique_ptr<Histogram> latency_ms;
+
+    void AddLatency(int64_t latency_ms);
+    void CopyTo(DataChannelReceiveStatsEntry& e) const;
+  };
+  struct Sender {
+    std::chrono::steady_clock::time_point last_received_at;
+    uint64_t messages = 0;
+    // これまでに受信した最大のカウンター
+    uint64_t highest = 0;
+    // bit i が立っていれば highest - i を受信済み
+    uint64_t recent = 0;
+    // per_sender_ の場合だけ作る
+    std::unique_ptr<Counters> counters;
+  };
+  struct Label {
+    Counters counters;
+    std::map<std::string, Sender> senders;
+  };
+
+  // mutex_ をロックした状態で呼ぶ
+  void PruneIdleSenders(std::chrono::steady_clock::time_point now);
+
+  const bool per_sender_;
+  mutable std::mutex mutex_;
+  uint64_t unknown_messages_ = 0;
+  std::chrono::steady_clock::time_point last_pruned_at_;
+  std::map<std::string, Label> labels_;
+};
+
+#endif
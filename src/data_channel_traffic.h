@@ -0,0 +1,104 @@
+#ifndef DATA_CHANNEL_TRAFFIC_H_
+#define DATA_CHANNEL_TRAFFIC_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <memory>
+#include <string>
+
+#include "binary_pool.h"
+
+// ラベル毎に目標のレートで DataChannel メッセージを送信するための設定と統計
+//
+// レートは仮想クライアント 1 つあたりの値で、トークンバケットで制御する。
+// rate が指定されていればメッセージ数、bit_rate が指定されていればバイト数が
+// トークンになる。
+struct DataChannelTraffic {
+  enum class SizeDistribution {
+    Fixed,
+    Uniform,
+    LogNormal,
+    Bimodal,
+  };
+
+  std::string label;
+  // 1 秒あたりのメッセージ数
+  double rate = 0;
+  // kbps
+  double bit_rate = 0;
+  SizeDistribution size_distribution = SizeDistribution::Uniform;
+  int size_min = 0;
+  int size_max = 0;
+  // LogNormal の場合の対数の標準偏差
+  // 中央値は size_min と size_max の相乗平均になる
+  double size_sigma = 1.0;
+  // Bimodal の場合に size_max のメッセージを送る割合
+  double bimodal_ratio = 0.1;
+  // 0 より大きい場合、burst_on_ms の間送信して burst_off_ms の間休むのを繰り返す
+  int burst_on_ms = 0;
+  int burst_off_ms = 0;
+  // nullptr の場合は ScenarioPlayerConfig::binary_pool を使う
+  std::shared_ptr<BinaryPool> binary_pool;
+
+  // 統計
+  // 送信中（接続していて、シナリオを止めていない）の仮想クライアント数
+  std::atomic<uint64_t> clients{0};
+  // 実際に送信したメッセージ数とバイト数
+  // 切断中や、バックプレッシャーで破棄したり保留したりしたメッセージは含めない
+  std::atomic<uint64_t> messages{0};
+  std::atomic<uint64_t> bytes{0};
+  // 各仮想クライアントが送信中だった時間の合計（ミリ秒）
+  // 実際のレートはこの時間で割って計算する
+  std::atomic<int64_t> client_time_ms{0};
+  // 最初のクライアントが送信を開始した時刻（steady_clock のミリ秒）
+  std::atomic<int64_t> started_at_ms{0};
+
+  bool IsBurst() const { return burst_on_ms > 0 && burst_off_ms > 0; }
+
+  int NextSize(std::mt19937& engine) const {
+    switch (size_distribution) {
+      case SizeDistribution::Fixed:
+        return size_min;
+      case SizeDistribution::Uniform:
+        return std::uniform_int_distribution<int>(size_min, size_max)(engine);
+      case SizeDistribution::LogNormal: {
+        double median = std::sqrt((double)size_min * size_max);
+        double v = std::lognormal_distribution<double>(std::log(median),
+                                                       size_sigma)(engine);
+        return std::clamp((int)v, size_min, size_max);
+      }
+      case SizeDistribution::Bimodal:
+        return std::bernoulli_distribution(bimodal_ratio)(engine) ? size_max
+                                                                  : size_min;
+    }
+    return size_min;
+  }
+
+  // 1 ミリ秒あたりに増えるトークン数
+  double TokensPerMs() const {
+    return rate > 0 ? rate / 1000 : bit_rate * 1000 / 8 / 1000;
+  }
+  // size バイトのメッセージを送るのに必要なトークン数
+  double Cost(int size) const { return rate > 0 ? 1 : size; }
+};
+
+// クライアント毎のトークンバケットの状態
+struct DataChannelTrafficState {
+  bool started = false;
+  // DataChannelTraffic::clients に数えているか
+  bool active = false;
+  // started の場合に送信している DataChannelTraffic
+  DataChannelTraffic* traffic = nullptr;
+  // DataChannelTraffic::client_time_ms に足した時刻
+  std::chrono::steady_clock::time_point accounted_at;
+  bool on = true;
+  double tokens = 0;
+  int next_size = 0;
+  std::chrono::steady_clock::time_point last_refilled_at;
+  std::chrono::steady_clock::time_point phase_started_at;
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include <third_party/libyuv/include/libyuv.h>
 
 #include "embedded_binary.h"
+#include "frame_watermark.h"
 
 FakeVideoCapturer::FakeVideoCapturer(FakeVideoCapturerConfig config)
     : sora::ScalableVideoTrackSource(config), config_(config) {
@@ -21,6 +22,9 @@ void FakeVideoCapturer::StartCapture() {
   stopped_ = false;
   started_at_ = std::chrono::high_resolution_clock::now();
   thread_.reset(new std::thread([this]() {
+    if (config_.affinity != nullptr) {
+      config_.affinity->Apply(ThreadRole::Capturer);
+    }
     image_.create(config_.width, config_.height, BL_FORMAT_PRGB32);
     frame_ = 0;
     {
@@ -86,6 +90,13 @@ void FakeVideoCapturer::StartCapture() {
         buffer->ScaleFrom(*y4m_buffer_);
       }
 
+      if (config_.watermark) {
+        FrameWatermark wm;
+        wm.capture_time_ms = FrameWatermark::NowMs();
+        wm.frame = (uint16_t)frame_;
+        FrameWatermark::Embed(buffer.get(), wm);
+      }
+
       int64_t timestamp_us =
           std::chrono::duration_cast<std::chrono::microseconds>(now -
                                                                 started_at_)
@@ -14,6 +14,7 @@
 // Blend2D
 #include <blend2d/blend2d.h>
 
+#include "thread_affinity.h"
 #include "xorshift.h"
 #include "y4m_reader.h"
 
@@ -29,9 +30,13 @@ struct FakeVideoCapturerConfig : sora::ScalableVideoTrackSourceConfig {
   };
   Type type = Type::Safari;
   std::string y4m_path;
+  // キャプチャ時刻とフレーム番号を機械で読み取れる形で埋め込むか
+  bool watermark = false;
   std::function<void(BLContext&,
                      std::chrono::high_resolution_clock::time_point)>
       render;
+  // 映像を生成するスレッドを動かす CPU。nullptr の場合は指定しない
+  std::shared_ptr<ThreadAffinity> affinity;
 };
 
 class FakeVideoCapturer : public sora::ScalableVideoTrackSource {
@@ -0,0 +1,197 @@
+#include "follower.h"
+
+#include <csignal>
+#include <utility>
+
+#include <unistd.h>
+
+namespace {
+
+// obj に含まれている LocalKeys を返す。無ければ nullptr
+const std::string* FindLocalKey(const boost::json::object& obj) {
+  for (const auto& key : Follower::LocalKeys()) {
+    if (obj.contains(key)) {
+      return &key;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+Follower::Follower(std::string token, ValidateFunc validate)
+    : token_(std::move(token)), validate_(std::move(validate)) {}
+
+bool Follower::CheckToken(const boost::json::value& params) const {
+  if (token_.empty()) {
+    return true;
+  }
+  auto p = params.is_object() ? params.as_object().if_contains("token")
+                              : nullptr;
+  return p != nullptr && p->is_string() && p->as_string() == token_;
+}
+
+bool Follower::Prepare(const boost::json::value& config,
+                       int64_t start_at_ms,
+                       std::string& error) {
+  if (!config.is_object()) {
+    error = "config must be an object";
+    return false;
+  }
+  const auto& obj = config.as_object();
+  if (auto key = FindLocalKey(obj); key != nullptr) {
+    error = *key + " must be specified on the command line of the follower";
+    return false;
+  }
+  if (auto p = obj.if_contains("instances"); p != nullptr && p->is_array()) {
+    for (const auto& inst : p->as_array()) {
+      if (!inst.is_object()) {
+        continue;
+      }
+      if (auto key = FindLocalKey(inst.as_object()); key != nullptr) {
+        error = *key +
+                " in instances must be specified on the command line of the "
+                "follower";
+        return false;
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (state_ != State::Waiting || stopped_) {
+      error = std::string("already ") + StateToString(state_);
+      return false;
+    }
+  }
+  // 実行を始めてからパースに失敗すると終了してしまうので、先に全て確かめる
+  if (validate_ && !validate_(config, error)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (state_ != State::Waiting || stopped_) {
+    error = std::string("already ") + StateToString(state_);
+    return false;
+  }
+  config_ = config;
+  start_at_ms_ = start_at_ms;
+  state_ = State::Scheduled;
+  cv_.notify_all();
+  return true;
+}
+
+boost::json::value Follower::WaitForStart() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock,
+           [this]() { return stopped_ || state_ == State::Scheduled; });
+  if (!stopped_) {
+    auto start_at = std::chrono::system_clock::time_point(
+        std::chrono::milliseconds(start_at_ms_));
+    cv_.wait_until(lock, start_at, [this]() { return stopped_; });
+  }
+  if (stopped_) {
+    state_ = State::Finished;
+    return nullptr;
+  }
+  state_ = State::Running;
+  return config_;
+}
+
+void Follower::SetFinished() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  state_ = State::Finished;
+}
+
+void Follower::WaitForCollected(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait_for(lock, timeout, [this]() { return collected_; });
+}
+
+void Follower::SetLoadProfile(std::shared_ptr<LoadProfile> load_profile) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  load_profile_ = load_profile;
+}
+
+bool Follower::SetLoad(int vcs, std::string& error) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (state_ != State::Running || load_profile_ == nullptr) {
+    error = std::string("not running: ") + StateToString(state_);
+    return false;
+  }
+  if (!load_profile_->SetTarget(vcs)) {
+    error = "vcs must be between 0 and the sum of vcs (" +
+            std::to_string(load_profile_->GetMaxVcs()) + ")";
+    return false;
+  }
+  return true;
+}
+
+void Follower::Stop() {
+  bool running;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopped_ = true;
+    running = state_ == State::Running;
+    cv_.notify_all();
+  }
+  // 各インスタンスは SIGINT/SIGTERM で終了する
+  if (running) {
+    kill(getpid(), SIGTERM);
+  }
+}
+
+Follower::Status Follower::GetStatus() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (state_ == State::Finished && !collected_) {
+    collected_ = true;
+    cv_.notify_all();
+  }
+  return {state_, start_at_ms_};
+}
+
+const std::vector<std::string>& Follower::LocalKeys() {
+  static const std::vector<std::string> keys = {
+      "http-host",
+      "http-port",
+      "ui",
+      "ui-remote-url",
+      "output-file-connection-id",
+      "workers",
+      "video-codec-capability-cache",
+      "openh264",
+      "fake-video-capture",
+      "fake-audio-capture",
+      "video-device",
+      "client-cert",
+      "client-key",
+  };
+  return keys;
+}
+
+void Follower::RemoveLocalKeys(boost::json::object& config) {
+  for (const auto& key : LocalKeys()) {
+    config.erase(key);
+  }
+  if (auto p = config.if_contains("instances"); p != nullptr && p->is_array()) {
+    for (auto& inst : p->as_array()) {
+      if (inst.is_object()) {
+        for (const auto& key : LocalKeys()) {
+          inst.as_object().erase(key);
+        }
+      }
+    }
+  }
+}
+
+const char* Follower::StateToString(State state) {
+  switch (state) {
+    case State::Waiting:
+      return "waiting";
+    case State::Scheduled:
+      return "scheduled";
+    case State::Running:
+      return "running";
+    case State::Finished:
+      return "finished";
+  }
+  return "unknown";
+}
@@ -0,0 +1,96 @@
+#ifndef FOLLOWER_H_
+#define FOLLOWER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/json.hpp>
+
+#include "load_profile.h"
+
+// --follower で起動した場合に、コーディネーターからの指示を受け付ける
+//
+// HTTP サーバーのスレッドから RPC の Prepare で設定と開始時刻を受け取り、
+// メインスレッドは WaitForStart で開始時刻まで待ってから設定を受け取る。
+// 実行中は RPC の SetLoad で仮想クライアント数を変え、Stop で終了する。
+class Follower {
+ public:
+  enum class State {
+    // Prepare を待っている
+    Waiting,
+    // 設定を受け取って開始時刻を待っている
+    Scheduled,
+    Running,
+    Finished,
+  };
+
+  // 受け取った設定を実行する前に確かめる関数
+  // 不正な場合は error にメッセージを入れて false を返す
+  typedef std::function<bool(const boost::json::value& config,
+                             std::string& error)>
+      ValidateFunc;
+
+  // token が空でない場合は、状態を変える RPC に同じトークンを要求する
+  Follower(std::string token, ValidateFunc validate);
+
+  // RPC の params.token が --follower-token と一致するか
+  bool CheckToken(const boost::json::value& params) const;
+
+  // config は --config と同じ形式の設定
+  // start_at_ms は開始する時刻（UNIX 時間のミリ秒）で、過ぎていればすぐに開始する
+  // 既に受け取っている場合や、設定が不正な場合は
+  // error にメッセージを入れて false を返す
+  bool Prepare(const boost::json::value& config,
+               int64_t start_at_ms,
+               std::string& error);
+  // Prepare で受け取った設定を、開始時刻になってから返す
+  // 開始する前に Stop された場合は nullptr を返す
+  boost::json::value WaitForStart();
+  // 全てのインスタンスが終了した
+  void SetFinished();
+  // 終了したことをコーディネーターが GetStatus で確認するまで待つ
+  // コーディネーターが無い場合に備えて timeout で諦める
+  void WaitForCollected(std::chrono::milliseconds timeout);
+
+  void SetLoadProfile(std::shared_ptr<LoadProfile> load_profile);
+  // 全てのインスタンスを合わせた仮想クライアント数を vcs にする
+  bool SetLoad(int vcs, std::string& error);
+  // 開始前ならすぐに終了し、実行中なら SIGTERM で全てのインスタンスを止める
+  void Stop();
+
+  struct Status {
+    State state;
+    int64_t start_at_ms;
+  };
+  // 終了した後に呼ばれた場合は WaitForCollected を終わらせる
+  Status GetStatus();
+  static const char* StateToString(State state);
+
+  // フォロワーのマシンに依存するキー
+  // ファイルのパスや HTTP サーバーの設定はフォロワー毎にコマンドラインで指定するので、
+  // コーディネーターは送る設定から取り除き、フォロワーは含まれていたら拒否する
+  static const std::vector<std::string>& LocalKeys();
+  // config のトップレベルと各インスタンスから LocalKeys を取り除く
+  static void RemoveLocalKeys(boost::json::object& config);
+
+ private:
+  std::string token_;
+  ValidateFunc validate_;
+  State state_ = State::Waiting;
+  bool stopped_ = false;
+  bool collected_ = false;
+  boost::json::value config_;
+  int64_t start_at_ms_ = 0;
+  std::shared_ptr<LoadProfile> load_profile_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+#endif
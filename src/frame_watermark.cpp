@@ -0,0 +1,118 @@
+#include "frame_watermark.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+constexpr int kGridSize = 8;
+constexpr uint8_t kSync = 0xa5;
+// 1 セルあたりの輝度
+constexpr uint8_t kBlack = 16;
+constexpr uint8_t kWhite = 235;
+
+// 透かしの領域（一辺が映像の短辺の 1/4 の正方形）
+// 縮小されても同じ位置を指すように、画素単位に丸めずに比率のまま扱う
+struct Area {
+  double x;
+  double y;
+  double size;
+  double Cell() const { return size / kGridSize; }
+};
+
+Area GetArea(int width, int height) {
+  Area a;
+  a.size = std::min(width, height) / 4.0;
+  a.x = width - a.size;
+  a.y = height - a.size;
+  return a;
+}
+
+uint64_t Pack(const FrameWatermark& wm) {
+  uint8_t checksum = 0;
+  for (int i = 0; i < 4; i++) {
+    checksum += (uint8_t)(wm.capture_time_ms >> (i * 8));
+  }
+  checksum += (uint8_t)(wm.frame >> 8);
+  checksum += (uint8_t)wm.frame;
+  return ((uint64_t)kSync << 56) | ((uint64_t)wm.capture_time_ms << 24) |
+         ((uint64_t)wm.frame << 8) | checksum;
+}
+
+}  // namespace
+
+uint32_t FrameWatermark::NowMs() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void FrameWatermark::Embed(webrtc::I420Buffer* buffer,
+                           const FrameWatermark& wm) {
+  Area a = GetArea(buffer->width(), buffer->height());
+  if (a.Cell() < 1) {
+    return;
+  }
+  const uint64_t bits = Pack(wm);
+  const int x0 = (int)a.x;
+  const int y0 = (int)a.y;
+  for (int y = y0; y < buffer->height(); y++) {
+    uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+    int cy = std::clamp((int)((y - a.y) / a.Cell()), 0, kGridSize - 1);
+    for (int x = x0; x < buffer->width(); x++) {
+      int cx = std::clamp((int)((x - a.x) / a.Cell()), 0, kGridSize - 1);
+      bool bit = (bits >> (63 - (cy * kGridSize + cx))) & 1;
+      row[x] = bit ? kWhite : kBlack;
+    }
+  }
+  // 色差は無彩色にしておく
+  for (int y = y0 / 2; y < (buffer->height() + 1) / 2; y++) {
+    int w = (buffer->width() + 1) / 2 - x0 / 2;
+    std::fill_n(buffer->MutableDataU() + y * buffer->StrideU() + x0 / 2, w,
+                128);
+    std::fill_n(buffer->MutableDataV() + y * buffer->StrideV() + x0 / 2, w,
+                128);
+  }
+}
+
+std::optional<FrameWatermark> FrameWatermark::Detect(
+    const webrtc::I420BufferInterface& buffer) {
+  Area a = GetArea(buffer.width(), buffer.height());
+  if (a.Cell() < 1) {
+    return std::nullopt;
+  }
+  // 圧縮でセルの境界が崩れるので、各セルの中央の半分だけの平均を見る
+  uint64_t bits = 0;
+  for (int i = 0; i < kGridSize * kGridSize; i++) {
+    double cx = a.x + (i % kGridSize) * a.Cell();
+    double cy = a.y + (i / kGridSize) * a.Cell();
+    int x0 = (int)(cx + a.Cell() / 4);
+    int x1 = std::max(x0 + 1, (int)(cx + a.Cell() * 3 / 4));
+    int y0 = (int)(cy + a.Cell() / 4);
+    int y1 = std::max(y0 + 1, (int)(cy + a.Cell() * 3 / 4));
+    int sum = 0;
+    int count = 0;
+    for (int y = y0; y < y1 && y < buffer.height(); y++) {
+      const uint8_t* row = buffer.DataY() + y * buffer.StrideY();
+      for (int x = x0; x < x1 && x < buffer.width(); x++) {
+        sum += row[x];
+        count += 1;
+      }
+    }
+    bits <<= 1;
+    if (count > 0 && sum / count >= (kBlack + kWhite) / 2) {
+      bits |= 1;
+    }
+  }
+
+  if ((bits >> 56) != kSync) {
+    return std::nullopt;
+  }
+  FrameWatermark wm;
+  wm.capture_time_ms = (uint32_t)(bits >> 24);
+  wm.frame = (uint16_t)(bits >> 8);
+  if (Pack(wm) != bits) {
+    return std::nullopt;
+  }
+  return wm;
+}
@@ -0,0 +1,30 @@
+#ifndef FRAME_WATERMARK_H_
+#define FRAME_WATERMARK_H_
+
+#include <cstdint>
+#include <optional>
+
+// WebRTC
+#include <api/video/i420_buffer.h>
+
+// 映像の右下に埋め込む、機械で読み取るためのキャプチャ時刻とフレーム番号
+//
+// 8x8 のセルを白黒で塗り分けて 64 ビットを表現する。
+// 同期用の 8 ビット、キャプチャ時刻（Unix 時間のミリ秒の下位 32 ビット）、
+// フレーム番号の下位 16 ビット、チェックサム 8 ビットの順に並んでいる。
+// 位置と大きさは映像のサイズに対する比率で決まっているので、
+// サイマルキャストなどで縮小されても読み取れる。
+struct FrameWatermark {
+  uint32_t capture_time_ms = 0;
+  uint16_t frame = 0;
+
+  static uint32_t NowMs();
+
+  // buffer の右下に埋め込む
+  static void Embed(webrtc::I420Buffer* buffer, const FrameWatermark& wm);
+  // 読み取れなかった場合は std::nullopt を返す
+  static std::optional<FrameWatermark> Detect(
+      const webrtc::I420BufferInterface& buffer);
+};
+
+#endif
@@ -49,19 +49,29 @@ class GameAudioManager {
     if (n < 0 || n >= audios_.size()) {
       return;
     }
-    audios_[n]->Play(std::forward<Args>(args)...);
+    for (auto& audio : audios_[n]) {
+      audio->Play(args...);
+    }
   }
   std::function<void(std::vector<int16_t>&)> AddGameAudio(int sample_rate) {
-    auto audio = std::unique_ptr<GameAudio>(new GameAudio(sample_rate));
-    auto f = [audio = audio.get()](std::vector<int16_t>& buf) {
-      audio->Render(buf);
-    };
-    audios_.push_back(std::move(audio));
+    audios_.emplace_back();
+    return AddGameAudioOutput(audios_.size() - 1, sample_rate);
+  }
+  // n 番目の音声を別の ADM でも再生するための出力を追加する
+  // ADM 毎に Render で読み進めるので、出力毎に GameAudio を分けている
+  // ADM は共有されたコンテキストでこのオブジェクトより長く生きることがあるので、
+  // 返す関数が GameAudio を持つ
+  std::function<void(std::vector<int16_t>&)> AddGameAudioOutput(
+      int n,
+      int sample_rate) {
+    auto audio = std::make_shared<GameAudio>(sample_rate);
+    auto f = [audio](std::vector<int16_t>& buf) { audio->Render(buf); };
+    audios_[n].push_back(std::move(audio));
     return f;
   }
 
  private:
-  std::vector<std::unique_ptr<GameAudio>> audios_;
+  std::vector<std::vector<std::shared_ptr<GameAudio>>> audios_;
 };
 
 #endif
@@ -0,0 +1,119 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct HistogramSnapshot {
+  // counts[i] は bounds[i-1] < value <= bounds[i] の個数
+  // counts の最後の要素は bounds の最大値を超えた個数
+  std::vector<int64_t> bounds;
+  std::vector<uint64_t> counts;
+  uint64_t count = 0;
+  int64_t sum = 0;
+  int64_t max = 0;
+
+  double Mean() const { return count == 0 ? 0 : (double)sum / count; }
+
+  // p (0.0 - 1.0) のパーセンタイルを含むバケットの上限を返す
+  // 最後のバケットに入る場合は最大値を返す
+  int64_t Percentile(double p) const {
+    if (count == 0) {
+      return 0;
+    }
+    uint64_t target = std::max<uint64_t>(1, (uint64_t)(count * p + 0.5));
+    uint64_t n = 0;
+    for (size_t i = 0; i < bounds.size(); i++) {
+      n += counts[i];
+      if (n >= target) {
+        return bounds[i];
+      }
+    }
+    return max;
+  }
+
+  void Merge(const HistogramSnapshot& other) {
+    if (bounds.empty()) {
+      *this = other;
+      return;
+    }
+    if (bounds != other.bounds) {
+      return;
+    }
+    for (size_t i = 0; i < counts.size(); i++) {
+      counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+  }
+};
+
+// 固定のバケット境界を持つヒストグラム
+// デコーダーのスレッドなど、複数のスレッドから同時に Add されるので
+// 全てのカウンターを atomic で持っている
+// バケット境界は同じ種類のヒストグラムで共有する
+class Histogram {
+ public:
+  typedef std::shared_ptr<const std::vector<int64_t>> Bounds;
+
+  explicit Histogram(Bounds bounds)
+      : bounds_(std::move(bounds)),
+        counts_(new std::atomic<uint64_t>[bounds_->size() + 1]) {
+    for (size_t i = 0; i < bounds_->size() + 1; i++) {
+      counts_[i] = 0;
+    }
+  }
+
+  // ミリ秒単位の遅延を記録するのに使うバケット境界
+  static const Bounds& LatencyMsBounds() {
+    static const Bounds bounds =
+        std::make_shared<const std::vector<int64_t>>(std::vector<int64_t>{
+            1, 2, 5, 10, 20, 30, 50, 75, 100, 150, 200, 300, 500, 750, 1000,
+            2000, 5000, 10000});
+    return bounds;
+  }
+
+  void Add(int64_t value) {
+    auto it = std::lower_bound(bounds_->begin(), bounds_->end(), value);
+    counts_[it - bounds_->begin()].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    int64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max &&
+           !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  HistogramSnapshot GetSnapshot() const {
+    HistogramSnapshot s;
+    s.bounds = *bounds_;
+    s.counts.resize(bounds_->size() + 1);
+    for (size_t i = 0; i < bounds_->size() + 1; i++) {
+      s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    }
+    s.count = count_.load(std::memory_order_relaxed);
+    s.sum = sum_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    return s;
+  }
+
+  // このオブジェクトとバケットが使っているバイト数
+  // バケット境界は共有しているので含めない
+  size_t GetMemoryUsage() const {
+    return sizeof(*this) +
+           (bounds_->size() + 1) * sizeof(std::atomic<uint64_t>);
+  }
+
+ private:
+  Bounds bounds_;
+  std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+  std::atomic<uint64_t> count_{0};
+  std::atomic<int64_t> sum_{0};
+  std::atomic<int64_t> max_{0};
+};
+
+#endif
@@ -21,10 +21,12 @@ static constexpr int kHttpSessionTimeoutSeconds = 30;
 
 HttpServer::HttpServer(const std::string& host,
                        int port,
-                       std::optional<std::string> ui_remote_url)
+                       std::optional<std::string> ui_remote_url,
+                       std::shared_ptr<ZakuroStats> stats)
     : host_(host),
       port_(port),
       ui_remote_url_(std::move(ui_remote_url)),
+      stats_(std::move(stats)),
       resolver_(ioc_) {}
 
 HttpServer::~HttpServer() {
@@ -98,7 +100,8 @@ void HttpServer::OnAccept(boost::beast::error_code ec,
   if (ec) {
     RTC_LOG(LS_ERROR) << "Accept error: " << ec.message();
   } else {
-    std::make_shared<HttpSession>(std::move(socket), ui_remote_url_)->Run();
+    std::make_shared<HttpSession>(std::move(socket), ui_remote_url_, stats_)
+        ->Run();
   }
 
   if (running_) {
@@ -111,8 +114,11 @@ void HttpServer::OnAccept(boost::beast::error_code ec,
 // ----------------------------
 
 HttpSession::HttpSession(boost::asio::ip::tcp::socket socket,
-                         std::optional<std::string> ui_remote_url)
-    : stream_(std::move(socket)), ui_remote_url_(std::move(ui_remote_url)) {}
+                         std::optional<std::string> ui_remote_url,
+                         std::shared_ptr<ZakuroStats> stats)
+    : stream_(std::move(socket)),
+      ui_remote_url_(std::move(ui_remote_url)),
+      stats_(std::move(stats)) {}
 
 void HttpSession::AsyncHandleRequest(
     boost::beast::http::request<boost::beast::http::string_body> req,
@@ -179,7 +185,7 @@ HttpSession::HandleJsonRpcRequest(
     }
 
     // JSON-RPC ハンドラーで処理
-    JsonRpcHandler handler;
+    JsonRpcHandler handler(stats_);
     auto response = handler.Process(json_request);
 
     // Notification の場合はレスポンスを返さない（空のボディで 204 No Content）
@@ -10,11 +10,14 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 
+class ZakuroStats;
+
 class HttpServer {
  public:
   HttpServer(const std::string& host,
              int port,
-             std::optional<std::string> ui_remote_url);
+             std::optional<std::string> ui_remote_url,
+             std::shared_ptr<ZakuroStats> stats);
   ~HttpServer();
 
   void Start();
@@ -33,6 +36,7 @@ class HttpServer {
   std::unique_ptr<std::thread> thread_;
   std::atomic<bool> running_{false};
   std::optional<std::string> ui_remote_url_;
+  std::shared_ptr<ZakuroStats> stats_;
 
   boost::asio::io_context ioc_;
   boost::asio::ip::tcp::resolver resolver_;
@@ -43,7 +47,8 @@ class HttpServer {
 class HttpSession : public std::enable_shared_from_this<HttpSession> {
  public:
   explicit HttpSession(boost::asio::ip::tcp::socket socket,
-                       std::optional<std::string> ui_remote_url);
+                       std::optional<std::string> ui_remote_url,
+                       std::shared_ptr<ZakuroStats> stats);
 
   void Run();
 
@@ -81,6 +86,7 @@ class HttpSession : public std::enable_shared_from_this<HttpSession> {
   std::shared_ptr<boost::beast::http::response<boost::beast::http::string_body>>
       res_;
   std::optional<std::string> ui_remote_url_;
+  std::shared_ptr<ZakuroStats> stats_;
 };
 
 #endif  // HTTP_SERVER_H_
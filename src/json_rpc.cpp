@@ -1,13 +1,31 @@
 #include "json_rpc.h"
 
+#include <algorithm>
+#include <chrono>
+#include <initializer_list>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <api/video_codecs/video_codec.h>
 #include <rtc_base/logging.h>
 #include <boost/json.hpp>
 #include <boost/version.hpp>
 
+#include "coordinator.h"
+#include "follower.h"
+#include "histogram.h"
+#include "memory_usage.h"
+#include "thread_affinity.h"
+#include "worker.h"
+#include "zakuro_stats.h"
 #include "zakuro_version.h"
 
 namespace json = boost::json;
 
+JsonRpcHandler::JsonRpcHandler(std::shared_ptr<ZakuroStats> stats)
+    : stats_(std::move(stats)) {}
+
 std::optional<json::object> JsonRpcHandler::Process(
     const json::value& request) {
   json::object response;
@@ -65,6 +83,45 @@ std::optional<json::object> JsonRpcHandler::Process(
         return std::nullopt;
       }
       return CreateSuccessResponse(id, HandleVersionMethod());
+    } else if (method == "GetStats") {
+      if (is_notification) {
+        return std::nullopt;
+      }
+      return CreateSuccessResponse(id, HandleGetStatsMethod());
+    } else if (method == "GetThreadPlacement") {
+      if (is_notification) {
+        return std::nullopt;
+      }
+      return CreateSuccessResponse(id, HandleGetThreadPlacementMethod());
+    } else if (method == "GetFollowerStatus") {
+      if (is_notification) {
+        return std::nullopt;
+      }
+      return CreateSuccessResponse(id, HandleGetFollowerStatusMethod());
+    } else if (method == "Prepare" || method == "SetLoad" ||
+               method == "Stop") {
+      // 状態を変えるメソッドは Notification でも実行する
+      json::value params;
+      if (auto p = obj.if_contains("params"); p != nullptr) {
+        params = *p;
+      }
+      if (auto follower = stats_ == nullptr ? nullptr : stats_->GetFollower();
+          follower != nullptr && !follower->CheckToken(params)) {
+        throw JsonRpcError{-32001, "Unauthorized",
+                           "token does not match --follower-token"};
+      }
+      json::value result;
+      if (method == "Prepare") {
+        result = HandlePrepareMethod(params);
+      } else if (method == "SetLoad") {
+        result = HandleSetLoadMethod(params);
+      } else {
+        result = HandleStopMethod();
+      }
+      if (is_notification) {
+        return std::nullopt;
+      }
+      return CreateSuccessResponse(id, result);
     } else {
       if (is_notification) {
         return std::nullopt;
@@ -132,3 +189,591 @@ json::value JsonRpcHandler::HandleVersionMethod() {
 
   return result;
 }
+
+static json::value HistogramToJson(const HistogramSnapshot& h) {
+  json::object obj;
+  obj["count"] = h.count;
+  obj["mean"] = h.Mean();
+  obj["max"] = h.max;
+  obj["p50"] = h.Percentile(0.50);
+  obj["p90"] = h.Percentile(0.90);
+  obj["p99"] = h.Percentile(0.99);
+  obj["bounds"] = json::value_from(h.bounds);
+  obj["counts"] = json::value_from(h.counts);
+  return obj;
+}
+
+namespace {
+
+// 他のプロセスの GetStats の結果を instances などに足していく
+// 負荷プロファイルは経過時間などは最初の結果のものを使い、sum_keys の値だけ足す
+// node が 0 以上の場合は各インスタンスと共有コンテキストの統計に node を付ける
+void AddStats(const json::object& obj,
+              std::initializer_list<const char*> sum_keys,
+              int node,
+              json::array& instances,
+              json::array& shared_video_receive,
+              json::array& network_threads,
+              json::object& load_profile) {
+  auto add_with_node = [node](const json::value& v, json::array& to) {
+    if (node >= 0 && v.is_object()) {
+      json::object o = v.as_object();
+      o["node"] = node;
+      to.push_back(std::move(o));
+    } else {
+      to.push_back(v);
+    }
+  };
+  if (auto p = obj.if_contains("instances"); p && p->is_array()) {
+    for (const auto& instance : p->as_array()) {
+      add_with_node(instance, instances);
+    }
+  }
+  if (auto p = obj.if_contains("shared_video_receive"); p && p->is_array()) {
+    for (const auto& sv : p->as_array()) {
+      add_with_node(sv, shared_video_receive);
+    }
+  }
+  if (auto p = obj.if_contains("network_threads"); p && p->is_array()) {
+    for (const auto& t : p->as_array()) {
+      network_threads.push_back(t);
+    }
+  }
+  if (auto p = obj.if_contains("load_profile"); p && p->is_object()) {
+    if (load_profile.empty()) {
+      load_profile = p->as_object();
+    } else {
+      for (const char* key : sum_keys) {
+        load_profile[key] = load_profile[key].to_number<int64_t>() +
+                            p->at(key).to_number<int64_t>();
+      }
+    }
+  }
+}
+
+// --workers の場合は、各ワーカープロセスが共有メモリに書き込んだ統計をまとめる
+json::value MergeWorkerStats(const WorkerStatsRing& ring) {
+  json::array instances;
+  json::array shared_video_receive;
+  json::array network_threads;
+  json::array workers;
+  json::object load_profile;
+  bool stats_truncated = false;
+  for (int i = 0; i < ring.GetWorkerCount(); i++) {
+    auto st = ring.GetWorkerState(i);
+    json::object worker;
+    worker["index"] = i;
+    worker["pid"] = st.pid;
+    if (st.state == WorkerStatsRing::State::Exited) {
+      worker["state"] = "exited";
+      if (WIFEXITED(st.status)) {
+        worker["exit_code"] = WEXITSTATUS(st.status);
+      } else if (WIFSIGNALED(st.status)) {
+        worker["signal"] = WTERMSIG(st.status);
+      }
+    } else {
+      worker["state"] = "running";
+    }
+
+    std::string data;
+    int64_t age_ms;
+    boost::system::error_code ec;
+    json::value v;
+    if (ring.Read(i, data, &age_ms)) {
+      worker["stats_age_ms"] = age_ms;
+      v = json::parse(data, ec);
+    }
+    // 統計が共有メモリのスロットに入りきらなかった場合は、古い統計のまま
+    auto truncation = ring.GetTruncation(i);
+    worker["stats_truncated"] = truncation.truncated;
+    if (truncation.count > 0) {
+      worker["stats_truncated_count"] = truncation.count;
+      worker["stats_truncated_size"] = truncation.last_size;
+    }
+    stats_truncated = stats_truncated || truncation.truncated;
+    if (!ec && v.is_object()) {
+      const auto& obj = v.as_object();
+      // 負荷プロファイルは全てのワーカーで同じなので、仮想クライアント数だけ足す
+      AddStats(obj, {"active_vcs", "connected_vcs"}, -1, instances,
+               shared_video_receive, network_threads, load_profile);
+      // 接続処理の数の制限とメモリ使用量はワーカー毎に分かれている
+      for (const char* key : {"admission", "memory"}) {
+        if (auto p = obj.if_contains(key); p != nullptr) {
+          worker[key] = *p;
+        }
+      }
+    }
+    workers.push_back(std::move(worker));
+  }
+
+  std::sort(instances.begin(), instances.end(),
+            [](const json::value& a, const json::value& b) {
+              return a.at("id").to_number<int64_t>() <
+                     b.at("id").to_number<int64_t>();
+            });
+  json::object result{{"instances", instances}};
+  if (!shared_video_receive.empty()) {
+    result["shared_video_receive"] = std::move(shared_video_receive);
+  }
+  if (!load_profile.empty()) {
+    result["load_profile"] = std::move(load_profile);
+  }
+  result["network_threads"] = std::move(network_threads);
+  result["workers"] = std::move(workers);
+  result["stats_truncated"] = stats_truncated;
+  return result;
+}
+
+// --followers の場合は、各フォロワーから取得した統計をまとめる
+// インスタンスの id はフォロワー毎に振られるので、node と合わせて識別する
+json::value MergeNodeStats(const std::vector<Coordinator::NodeStats>& stats) {
+  json::array instances;
+  json::array shared_video_receive;
+  json::array network_threads;
+  json::array nodes;
+  json::object load_profile;
+  for (int i = 0; i < stats.size(); i++) {
+    const auto& st = stats[i];
+    json::object node;
+    node["index"] = i;
+    node["url"] = st.url;
+    node["vcs"] = st.capacity;
+    if (st.error.empty() && st.stats.is_object()) {
+      const auto& obj = st.stats.as_object();
+      // 負荷プロファイルはフォロワー毎に vcs を振り分けているので、目標も足す
+      AddStats(obj, {"target_vcs", "active_vcs", "connected_vcs"}, i,
+               instances, shared_video_receive, network_threads,
+               load_profile);
+      for (const char* key : {"follower", "admission", "memory"}) {
+        if (auto p = obj.if_contains(key); p != nullptr) {
+          node[key] = *p;
+        }
+      }
+    } else {
+      node["error"] = st.error;
+    }
+    nodes.push_back(std::move(node));
+  }
+
+  json::object result{{"instances", instances}};
+  if (!shared_video_receive.empty()) {
+    result["shared_video_receive"] = std::move(shared_video_receive);
+  }
+  if (!load_profile.empty()) {
+    result["load_profile"] = std::move(load_profile);
+  }
+  result["network_threads"] = std::move(network_threads);
+  result["nodes"] = std::move(nodes);
+  return result;
+}
+
+size_t TotalBytes(const VirtualClientMemory& m) {
+  return m.client_bytes + m.signaling_config_bytes + m.data_channel_bytes +
+         m.scenario_bytes;
+}
+
+json::object MemoryToJson(const VirtualClientMemory& m) {
+  json::object obj;
+  obj["client_bytes"] = m.client_bytes;
+  obj["signaling_config_bytes"] = m.signaling_config_bytes;
+  obj["data_channel_bytes"] = m.data_channel_bytes;
+  obj["scenario_bytes"] = m.scenario_bytes;
+  obj["total_bytes"] = TotalBytes(m);
+  obj["signalings"] = m.signalings;
+  obj["peer_connections"] = m.peer_connections;
+  obj["audio_tracks"] = m.audio_tracks;
+  obj["video_tracks"] = m.video_tracks;
+  return obj;
+}
+
+void AddMemory(VirtualClientMemory& total, const VirtualClientMemory& m) {
+  total.client_bytes += m.client_bytes;
+  total.signaling_config_bytes += m.signaling_config_bytes;
+  total.data_channel_bytes += m.data_channel_bytes;
+  total.scenario_bytes += m.scenario_bytes;
+  total.signalings += m.signalings;
+  total.peer_connections += m.peer_connections;
+  total.audio_tracks += m.audio_tracks;
+  total.video_tracks += m.video_tracks;
+}
+
+json::object VideoReceiveToJson(const NopVideoDecoderStats& vr) {
+  json::object video_receive;
+  video_receive["frames"] = vr.frames.load();
+  video_receive["frames_with_capture_time"] =
+      vr.frames_with_capture_time.load();
+  video_receive["latency_ms"] = HistogramToJson(vr.latency_ms.GetSnapshot());
+  video_receive["inter_frame_jitter_ms"] =
+      HistogramToJson(vr.inter_frame_jitter_ms.GetSnapshot());
+  video_receive["freeze_duration_ms"] =
+      HistogramToJson(vr.freeze_duration_ms.GetSnapshot());
+
+  json::array streams;
+  for (const auto& stream : vr.GetStreams()) {
+    json::object st;
+    st["ssrc"] = stream->ssrc.load();
+    st["codec"] = webrtc::CodecTypeToPayloadString(stream->codec_type);
+    st["frames"] = stream->frames.load();
+    st["bytes"] = stream->bytes.load();
+    st["keyframes"] = stream->keyframes.load();
+    st["missing_frames"] = stream->missing_frames.load();
+    st["decode_interval_ms"] =
+        HistogramToJson(stream->decode_interval_ms.GetSnapshot());
+    streams.push_back(std::move(st));
+  }
+  video_receive["streams"] = std::move(streams);
+
+  json::object codecs;
+  for (const auto& c : vr.GetCodecs()) {
+    json::object codec;
+    codec["streams"] = c.second.streams;
+    codec["frames"] = c.second.frames;
+    codec["bytes"] = c.second.bytes;
+    codec["keyframes"] = c.second.keyframes;
+    codec["missing_frames"] = c.second.missing_frames;
+    codec["decode_interval_ms"] = HistogramToJson(c.second.decode_interval_ms);
+    codecs[webrtc::CodecTypeToPayloadString(c.first)] = std::move(codec);
+  }
+  video_receive["codecs"] = std::move(codecs);
+
+  return video_receive;
+}
+
+json::array SampledDecodeToJson(const SampledVideoDecoderStats& stats) {
+  json::array sampled;
+  for (const auto& stream : stats.GetStreams()) {
+    json::object st;
+    st["ssrc"] = stream->ssrc.load();
+    st["codec"] = webrtc::CodecTypeToPayloadString(stream->codec_type);
+    st["implementation"] = stream->implementation_name;
+    st["frames"] = stream->frames.load();
+    st["decoded_frames"] = stream->decoded_frames.load();
+    st["decode_errors"] = stream->decode_errors.load();
+    st["decode_time_ms"] =
+        HistogramToJson(stream->decode_time_ms.GetSnapshot());
+    st["width"] = stream->width.load();
+    st["height"] = stream->height.load();
+    st["resolution_changes"] = stream->resolution_changes.load();
+    st["fps"] = stream->fps.load();
+    st["fps_changes"] = stream->fps_changes.load();
+    st["watermark_frames"] = stream->watermark_frames.load();
+    st["glass_to_glass_latency_ms"] =
+        HistogramToJson(stream->glass_to_glass_latency_ms.GetSnapshot());
+    st["dropped_frames"] = stream->dropped_frames.load();
+    st["frozen_frames"] = stream->frozen_frames.load();
+    sampled.push_back(std::move(st));
+  }
+  return sampled;
+}
+
+json::object DataChannelReceiveToJson(const DataChannelReceiveStatsEntry& e) {
+  json::object r;
+  r["label"] = e.label;
+  r["messages"] = e.messages;
+  r["bytes"] = e.bytes;
+  r["lost"] = e.lost;
+  r["reordered"] = e.reordered;
+  r["duplicated"] = e.duplicated;
+  r["late"] = e.late;
+  r["latency_ms"] = HistogramToJson(e.latency_ms);
+  return r;
+}
+
+json::object FollowerStatusToJson(const Follower::Status& status) {
+  json::object obj;
+  obj["state"] = Follower::StateToString(status.state);
+  obj["start_at_ms"] = status.start_at_ms;
+  return obj;
+}
+
+}  // namespace
+
+json::value JsonRpcHandler::HandleGetStatsMethod() {
+  json::array instances;
+  if (stats_ == nullptr) {
+    return json::object{{"instances", instances}};
+  }
+  if (auto ring = stats_->GetWorkerStatsRing(); ring != nullptr) {
+    return MergeWorkerStats(*ring);
+  }
+  if (auto coordinator = stats_->GetCoordinator(); coordinator != nullptr) {
+    return MergeNodeStats(coordinator->GetStats());
+  }
+
+  // 全てのインスタンスで数えたメモリの合計
+  size_t accounted_bytes = 0;
+  int total_vcs = 0;
+  for (const auto& p : stats_->Get()) {
+    const auto& d = p.second;
+    json::object instance;
+    instance["id"] = d.id;
+    instance["name"] = d.name;
+
+    json::array vcs;
+    VirtualClientMemory instance_memory;
+    for (const auto& st : d.stats) {
+      AddMemory(instance_memory, st.memory);
+      json::object vc;
+      vc["channel_id"] = st.channel_id;
+      vc["connection_id"] = st.connection_id;
+      vc["connected_url"] = st.connected_url;
+      vc["websocket_connected"] = st.websocket_connected;
+      vc["datachannel_connected"] = st.datachannel_connected;
+      json::array dc_receive;
+      for (const auto& e : st.data_channel_receive) {
+        json::object r = DataChannelReceiveToJson(e);
+        r["senders"] = e.senders;
+        // --data-channel-stats-per-sender の場合だけ入る
+        if (!e.per_sender.empty()) {
+          json::array per_sender;
+          for (const auto& se : e.per_sender) {
+            json::object sr = DataChannelReceiveToJson(se);
+            sr["sender_connection_id"] = se.sender_connection_id;
+            per_sender.push_back(std::move(sr));
+          }
+          r["per_sender"] = std::move(per_sender);
+        }
+        dc_receive.push_back(std::move(r));
+      }
+      vc["data_channel_receive"] = std::move(dc_receive);
+      vc["data_channel_unknown_messages"] = st.data_channel_unknown_messages;
+      json::array dc_send;
+      for (const auto& e : st.data_channel_send) {
+        json::object r;
+        r["label"] = e.label;
+        r["messages"] = e.messages;
+        r["bytes"] = e.bytes;
+        r["buffered_amount"] = e.buffered_amount;
+        r["max_buffered_amount"] = e.max_buffered_amount;
+        r["blocked"] = e.blocked;
+        r["delayed"] = e.delayed;
+        r["dropped"] = e.dropped;
+        r["coalesced"] = e.coalesced;
+        r["send_failed"] = e.send_failed;
+        r["pending"] = e.pending;
+        dc_send.push_back(std::move(r));
+      }
+      vc["data_channel_send"] = std::move(dc_send);
+      vc["memory"] = MemoryToJson(st.memory);
+      vcs.push_back(std::move(vc));
+    }
+    instance["vcs"] = std::move(vcs);
+    json::object memory = MemoryToJson(instance_memory);
+    memory["shared_config_bytes"] = d.shared_config_bytes;
+    instance["memory"] = std::move(memory);
+    accounted_bytes += TotalBytes(instance_memory) + d.shared_config_bytes;
+    total_vcs += d.stats.size();
+
+    if (d.video_receive_stats != nullptr) {
+      instance["video_receive"] = VideoReceiveToJson(*d.video_receive_stats);
+    }
+
+    if (!d.data_channel_traffics.empty()) {
+      int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count();
+      json::array traffics;
+      for (const auto& t : d.data_channel_traffics) {
+        json::object r;
+        uint64_t clients = t->clients.load();
+        uint64_t messages = t->messages.load();
+        uint64_t bytes = t->bytes.load();
+        int64_t started_at_ms = t->started_at_ms.load();
+        double elapsed =
+            started_at_ms == 0 ? 0 : (now_ms - started_at_ms) / 1000.0;
+        r["label"] = t->label;
+        r["clients"] = clients;
+        r["messages"] = messages;
+        r["bytes"] = bytes;
+        r["elapsed_sec"] = elapsed;
+        // 目標も実績も仮想クライアント 1 つあたりの値
+        // 実績は各仮想クライアントが送信中だった時間で割る
+        r["target_rate"] = t->rate;
+        r["target_bit_rate"] = t->bit_rate;
+        double n = t->client_time_ms.load() / 1000.0;
+        r["rate"] = n == 0 ? 0 : messages / n;
+        r["bit_rate"] = n == 0 ? 0 : bytes * 8 / 1000.0 / n;
+        traffics.push_back(std::move(r));
+      }
+      instance["data_channel_traffic"] = std::move(traffics);
+    }
+
+    if (d.sampled_decode_stats != nullptr) {
+      instance["sampled_decode"] =
+          SampledDecodeToJson(*d.sampled_decode_stats);
+    }
+
+    instances.push_back(std::move(instance));
+  }
+
+  json::object result{{"instances", instances}};
+  if (auto shared_video_stats = stats_->GetSharedVideoStats();
+      !shared_video_stats.empty()) {
+    json::array shared;
+    for (const auto& sv : shared_video_stats) {
+      json::object obj;
+      obj["instances"] = json::value_from(sv.instances);
+      obj["video_receive"] = VideoReceiveToJson(*sv.video_receive_stats);
+      obj["sampled_decode"] = SampledDecodeToJson(*sv.sampled_decode_stats);
+      shared.push_back(std::move(obj));
+    }
+    result["shared_video_receive"] = std::move(shared);
+  }
+  {
+    // libwebrtc の中で確保しているメモリは数えられないので、仮想クライアントを
+    // 作る前からヒープが増えた分を仮想クライアントの数で割った値も返す
+    auto current = ProcessMemory::Get();
+    auto baseline = stats_->GetBaselineMemory();
+    json::object obj;
+    obj["rss_bytes"] = current.rss_bytes;
+    obj["heap_bytes"] = current.heap_bytes;
+    obj["baseline_rss_bytes"] = baseline.rss_bytes;
+    obj["baseline_heap_bytes"] = baseline.heap_bytes;
+    obj["vcs"] = total_vcs;
+    obj["accounted_bytes"] = accounted_bytes;
+    obj["heap_bytes_per_vc"] =
+        total_vcs == 0 || current.heap_bytes < baseline.heap_bytes
+            ? 0
+            : (current.heap_bytes - baseline.heap_bytes) / total_vcs;
+    result["memory"] = std::move(obj);
+  }
+  if (auto lp = stats_->GetLoadProfile(); lp != nullptr) {
+    auto st = lp->GetStats();
+    json::object obj;
+    obj["elapsed_sec"] = st.elapsed_sec;
+    obj["phase"] = st.phase;
+    obj["phases"] = st.phases;
+    obj["target_vcs"] = st.target_vcs;
+    obj["active_vcs"] = st.active_vcs;
+    obj["connected_vcs"] = st.connected_vcs;
+    result["load_profile"] = std::move(obj);
+  }
+  if (auto ac = stats_->GetAdmissionController(); ac != nullptr) {
+    auto st = ac->GetStats();
+    json::object obj;
+    obj["limit"] = st.limit;
+    obj["in_flight"] = st.in_flight;
+    obj["queued"] = st.queued;
+    obj["admitted"] = st.admitted;
+    obj["succeeded"] = st.succeeded;
+    obj["failed"] = st.failed;
+    obj["slow"] = st.slow;
+    obj["backoffs"] = st.backoffs;
+    obj["connect_time_ms"] = HistogramToJson(st.connect_time_ms);
+    result["admission"] = std::move(obj);
+  }
+  json::array network_threads;
+  for (const auto& shard : stats_->GetNetworkShards()) {
+    auto st = shard->GetStats();
+    json::object obj;
+    obj["vcs"] = st.clients;
+    obj["packets_sent"] = st.packets_sent;
+    obj["packets_received"] = st.packets_received;
+    obj["bytes_sent"] = st.bytes_sent;
+    obj["bytes_received"] = st.bytes_received;
+    obj["send_syscalls"] = st.send_syscalls;
+    obj["send_dropped"] = st.send_dropped;
+    obj["cpu_time_ms"] = st.cpu_time_ms;
+    network_threads.push_back(std::move(obj));
+  }
+  result["network_threads"] = std::move(network_threads);
+  if (auto follower = stats_->GetFollower(); follower != nullptr) {
+    result["follower"] = FollowerStatusToJson(follower->GetStatus());
+  }
+  return result;
+}
+
+json::value JsonRpcHandler::HandleGetThreadPlacementMethod() {
+  auto registry = stats_ == nullptr ? nullptr : stats_->GetThreadRegistry();
+  if (registry == nullptr) {
+    registry = std::make_shared<ThreadRegistry>();
+  }
+  json::array threads;
+  for (const auto& p : registry->GetPlacements()) {
+    json::object obj;
+    obj["tid"] = p.tid;
+    obj["name"] = p.name;
+    if (p.instance >= 0) {
+      obj["instance"] = p.instance;
+      obj["role"] = p.role;
+    }
+    obj["allowed_cpus"] = ThreadAffinity::FormatCpuList(p.allowed_cpus);
+    obj["cpu"] = p.cpu;
+    obj["numa_node"] = p.numa_node;
+    threads.push_back(std::move(obj));
+  }
+  return json::object{{"pid", getpid()}, {"threads", std::move(threads)}};
+}
+
+json::value JsonRpcHandler::HandlePrepareMethod(const json::value& params) {
+  auto follower = stats_ == nullptr ? nullptr : stats_->GetFollower();
+  if (follower == nullptr) {
+    throw JsonRpcError{-32601, "Method not found",
+                       "Prepare is only available with --follower"};
+  }
+  const json::value* config = nullptr;
+  const json::value* start_at_ms = nullptr;
+  if (params.is_object()) {
+    config = params.as_object().if_contains("config");
+    start_at_ms = params.as_object().if_contains("start_at_ms");
+  }
+  if (config == nullptr || start_at_ms == nullptr ||
+      !start_at_ms->is_number()) {
+    throw JsonRpcError{-32602, "Invalid params",
+                       "config and start_at_ms are required"};
+  }
+  std::string error;
+  if (!follower->Prepare(*config, start_at_ms->to_number<int64_t>(), error)) {
+    throw JsonRpcError{-32000, "Server error", error};
+  }
+  return FollowerStatusToJson(follower->GetStatus());
+}
+
+json::value JsonRpcHandler::HandleSetLoadMethod(const json::value& params) {
+  auto follower = stats_ == nullptr ? nullptr : stats_->GetFollower();
+  auto coordinator = stats_ == nullptr ? nullptr : stats_->GetCoordinator();
+  if (follower == nullptr && coordinator == nullptr) {
+    throw JsonRpcError{-32601, "Method not found",
+                       "SetLoad is only available with --follower or "
+                       "--followers"};
+  }
+  const json::value* vcs = nullptr;
+  if (params.is_object()) {
+    vcs = params.as_object().if_contains("vcs");
+  }
+  if (vcs == nullptr || !(vcs->is_int64() || vcs->is_uint64())) {
+    throw JsonRpcError{-32602, "Invalid params", "vcs must be an integer"};
+  }
+  int n = vcs->to_number<int>();
+  std::string error;
+  bool ok = coordinator != nullptr ? coordinator->SetLoad(n, error)
+                                   : follower->SetLoad(n, error);
+  if (!ok) {
+    throw JsonRpcError{-32000, "Server error", error};
+  }
+  return json::object{{"vcs", n}};
+}
+
+json::value JsonRpcHandler::HandleStopMethod() {
+  auto follower = stats_ == nullptr ? nullptr : stats_->GetFollower();
+  auto coordinator = stats_ == nullptr ? nullptr : stats_->GetCoordinator();
+  if (coordinator != nullptr) {
+    coordinator->Stop();
+  } else if (follower != nullptr) {
+    follower->Stop();
+  } else {
+    throw JsonRpcError{-32601, "Method not found",
+                       "Stop is only available with --follower or "
+                       "--followers"};
+  }
+  return nullptr;
+}
+
+json::value JsonRpcHandler::HandleGetFollowerStatusMethod() {
+  auto follower = stats_ == nullptr ? nullptr : stats_->GetFollower();
+  if (follower == nullptr) {
+    throw JsonRpcError{-32601, "Method not found",
+                       "GetFollowerStatus is only available with --follower"};
+  }
+  return FollowerStatusToJson(follower->GetStatus());
+}
@@ -1,14 +1,17 @@
 #ifndef JSON_RPC_H_
 #define JSON_RPC_H_
 
+#include <memory>
 #include <optional>
 
 #include <boost/json/value.hpp>
 #include <string>
 
+class ZakuroStats;
+
 class JsonRpcHandler {
  public:
-  JsonRpcHandler() = default;
+  explicit JsonRpcHandler(std::shared_ptr<ZakuroStats> stats);
 
   // JSON-RPC リクエストを処理して、レスポンスを返す
   // Notification (id なし) の場合は std::nullopt を返す
@@ -28,6 +31,15 @@ class JsonRpcHandler {
  private:
   // 各メソッドのハンドラー
   boost::json::value HandleVersionMethod();
+  boost::json::value HandleGetStatsMethod();
+  boost::json::value HandleGetThreadPlacementMethod();
+  // --follower と --followers で使うメソッド
+  boost::json::value HandlePrepareMethod(const boost::json::value& params);
+  boost::json::value HandleSetLoadMethod(const boost::json::value& params);
+  boost::json::value HandleStopMethod();
+  boost::json::value HandleGetFollowerStatusMethod();
+
+  std::shared_ptr<ZakuroStats> stats_;
 
   // カスタムエラー型
   struct JsonRpcError {
@@ -0,0 +1,196 @@
+#include "load_profile.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::shared_ptr<LoadProfile> LoadProfile::Create(
+    const boost::json::value& phases,
+    std::vector<int> capacities,
+    std::string& error) {
+  if (!phases.is_array() || phases.as_array().empty()) {
+    error = "load-profile must be a non-empty array";
+    return nullptr;
+  }
+  int max_vcs = 0;
+  for (int c : capacities) {
+    max_vcs += c;
+  }
+
+  std::shared_ptr<LoadProfile> profile(new LoadProfile());
+  const auto& ar = phases.as_array();
+  for (int i = 0; i < ar.size(); i++) {
+    std::string path = "load-profile[" + std::to_string(i) + "]";
+    if (!ar[i].is_object()) {
+      error = path + " must be an object";
+      return nullptr;
+    }
+    const auto& obj = ar[i].as_object();
+    Phase phase;
+
+    auto it = obj.find("curve");
+    if (it != obj.end()) {
+      if (!it->value().is_string()) {
+        error = path + ".curve must be a string";
+        return nullptr;
+      }
+      std::string curve(it->value().as_string());
+      if (curve == "step") {
+        phase.curve = Phase::Curve::Step;
+      } else if (curve == "linear") {
+        phase.curve = Phase::Curve::Linear;
+      } else if (curve == "exponential") {
+        phase.curve = Phase::Curve::Exponential;
+      } else if (curve == "hold") {
+        phase.curve = Phase::Curve::Hold;
+      } else {
+        error = path + ".curve is unknown: " + curve;
+        return nullptr;
+      }
+    }
+
+    it = obj.find("vcs");
+    if (it != obj.end()) {
+      if (!it->value().is_int64() && !it->value().is_uint64()) {
+        error = path + ".vcs must be an integer";
+        return nullptr;
+      }
+      auto vcs = boost::json::value_to<int64_t>(it->value());
+      if (vcs < 0 || vcs > max_vcs) {
+        error = path + ".vcs must be between 0 and the sum of vcs (" +
+                std::to_string(max_vcs) + ")";
+        return nullptr;
+      }
+      phase.vcs = (int)vcs;
+    } else if (phase.curve != Phase::Curve::Hold) {
+      error = path + ".vcs is required";
+      return nullptr;
+    }
+
+    it = obj.find("duration");
+    if (it != obj.end()) {
+      if (!it->value().is_number()) {
+        error = path + ".duration must be a number";
+        return nullptr;
+      }
+      phase.duration = boost::json::value_to<double>(it->value());
+      if (phase.duration < 0) {
+        error = path + ".duration must not be negative";
+        return nullptr;
+      }
+    }
+    if (phase.duration == 0 && phase.curve != Phase::Curve::Step) {
+      error = path + ".duration is required";
+      return nullptr;
+    }
+    profile->phases_.push_back(phase);
+  }
+
+  profile->counts_.resize(capacities.size());
+  profile->capacities_ = std::move(capacities);
+  profile->max_vcs_ = max_vcs;
+  profile->started_at_ = std::chrono::steady_clock::now();
+  return profile;
+}
+
+int LoadProfile::GetTarget(double elapsed_sec, int* phase) const {
+  int target_override = target_override_.load();
+  if (target_override >= 0) {
+    if (phase != nullptr) {
+      *phase = -1;
+    }
+    return target_override;
+  }
+
+  // 直前のフェーズの最後の目標
+  int prev = 0;
+  for (int i = 0; i < phases_.size(); i++) {
+    const auto& p = phases_[i];
+    int target = p.curve == Phase::Curve::Hold ? prev : p.vcs;
+    if (elapsed_sec >= p.duration) {
+      elapsed_sec -= p.duration;
+      prev = target;
+      continue;
+    }
+
+    if (phase != nullptr) {
+      *phase = i;
+    }
+    double t = elapsed_sec / p.duration;
+    switch (p.curve) {
+      case Phase::Curve::Step:
+      case Phase::Curve::Hold:
+        return target;
+      case Phase::Curve::Linear:
+        return prev + (int)std::round((target - prev) * t);
+      case Phase::Curve::Exponential: {
+        // 0 からでも増やせるように差分 + 1 を底にする
+        int diff = std::abs(target - prev);
+        int d = (int)std::round(std::pow(diff + 1, t)) - 1;
+        return target >= prev ? prev + d : prev - d;
+      }
+    }
+  }
+  if (phase != nullptr) {
+    *phase = phases_.size();
+  }
+  return prev;
+}
+
+bool LoadProfile::SetTarget(int vcs) {
+  if (vcs < 0 || vcs > max_vcs_) {
+    return false;
+  }
+  target_override_.store(vcs);
+  return true;
+}
+
+int LoadProfile::GetInstanceTarget(int total, int instance) const {
+  std::vector<int> alloc(capacities_.size());
+  int remaining = total;
+  while (remaining > 0) {
+    int n = 0;
+    for (int i = 0; i < capacities_.size(); i++) {
+      if (alloc[i] < capacities_[i]) {
+        n += 1;
+      }
+    }
+    if (n == 0) {
+      break;
+    }
+    // 割り切れない分は先頭のインスタンスから 1 つずつ割り振る
+    int add = std::max(1, remaining / n);
+    for (int i = 0; i < capacities_.size() && remaining > 0; i++) {
+      int take = std::min({add, capacities_[i] - alloc[i], remaining});
+      alloc[i] += take;
+      remaining -= take;
+    }
+  }
+  return alloc[instance];
+}
+
+double LoadProfile::GetElapsedSec() const {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       started_at_)
+      .count();
+}
+
+void LoadProfile::SetInstanceCount(int instance, int active, int connected) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  counts_[instance].active = active;
+  counts_[instance].connected = connected;
+}
+
+LoadProfile::Stats LoadProfile::GetStats() const {
+  Stats st;
+  st.elapsed_sec = GetElapsedSec();
+  st.target_vcs = GetTarget(st.elapsed_sec, &st.phase);
+  st.phases = GetPhaseCount();
+  st.active_vcs = 0;
+  st.connected_vcs = 0;
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (const auto& c : counts_) {
+    st.active_vcs += c.active;
+    st.connected_vcs += c.connected;
+  }
+  return st;
+}
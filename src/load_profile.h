@@ -0,0 +1,88 @@
+#ifndef LOAD_PROFILE_H_
+#define LOAD_PROFILE_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/json.hpp>
+
+// 全てのインスタンスを合わせた仮想クライアント数の推移
+//
+// フェーズ毎に目標の vcs と時間、その間の変化のさせ方を指定する。
+// 各インスタンスは自分の担当分の目標を GetInstanceTarget で取得し、
+// 仮想クライアントを接続したり切断したりして目標に合わせる。
+class LoadProfile {
+ public:
+  struct Phase {
+    enum class Curve {
+      // フェーズの開始時に目標の vcs にする
+      Step,
+      // 直前の vcs から目標の vcs まで直線的に変化させる
+      Linear,
+      // 直前の vcs から目標の vcs まで指数関数的に変化させる
+      Exponential,
+      // 直前の vcs のまま維持する
+      Hold,
+    };
+    Curve curve = Curve::Linear;
+    int vcs = 0;
+    double duration = 0;
+  };
+
+  // capacities はインスタンス毎の vcs の最大数
+  // 失敗した場合は error にメッセージを入れて nullptr を返す
+  static std::shared_ptr<LoadProfile> Create(const boost::json::value& phases,
+                                             std::vector<int> capacities,
+                                             std::string& error);
+
+  // 全体の目標の vcs
+  // phase には現在のフェーズのインデックスが入る（全て終わった後はフェーズ数）
+  // SetTarget で目標を固定している場合は -1 が入る
+  int GetTarget(double elapsed_sec, int* phase = nullptr) const;
+  // プロファイルに関係なく全体の目標の vcs を固定する（RPC の SetLoad）
+  // 0 から全てのインスタンスの vcs の合計までの範囲でなければ false を返す
+  bool SetTarget(int vcs);
+  int GetMaxVcs() const { return max_vcs_; }
+  // instance が担当する目標の vcs
+  // 全てのインスタンスに均等に割り振り、上限に達したインスタンスの分は他に回す
+  int GetInstanceTarget(int total, int instance) const;
+  double GetElapsedSec() const;
+  int GetPhaseCount() const { return phases_.size(); }
+
+  // 各インスタンスが実際に接続させている仮想クライアント数を報告する
+  void SetInstanceCount(int instance, int active, int connected);
+
+  struct Stats {
+    double elapsed_sec;
+    int phase;
+    int phases;
+    int target_vcs;
+    int active_vcs;
+    int connected_vcs;
+  };
+  Stats GetStats() const;
+
+ private:
+  LoadProfile() = default;
+
+  std::chrono::steady_clock::time_point started_at_;
+  std::vector<Phase> phases_;
+  std::vector<int> capacities_;
+  int max_vcs_ = 0;
+  // 固定していない場合は -1
+  std::atomic<int> target_override_{-1};
+
+  struct Count {
+    int active = 0;
+    int connected = 0;
+  };
+  std::vector<Count> counts_;
+  mutable std::mutex mutex_;
+};
+
+#endif
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <csignal>
@@ -16,17 +17,38 @@
 
 #include <blend2d/blend2d.h>
 
+#include "coordinator.h"
 #include "fake_audio_key_trigger.h"
 #include "fake_video_capturer.h"
+#include "follower.h"
 #include "http_server.h"
+#include "json_rpc.h"
+#include "memory_usage.h"
 #include "scenario_player.h"
+#include "startup_profile.h"
 #include "util.h"
 #include "virtual_client.h"
 #include "wav_reader.h"
+#include "worker.h"
 #include "zakuro.h"
 #include "zakuro_stats.h"
 
 const size_t kDefaultMaxLogFileSize = 10 * 1024 * 1024;
+// ワーカープロセスが 1 回に書き込める統計の JSON の最大サイズ
+const size_t kDefaultWorkerStatsSlotSize = 16 * 1024 * 1024;
+// フォロワーが終了したことをコーディネーターが確認するまで待つ時間
+const auto kFollowerLingerTime = std::chrono::seconds(5);
+
+// RPC の GetStats と同じ内容の統計を取得する
+boost::json::value GetStatsJson(std::shared_ptr<ZakuroStats> stats) {
+  JsonRpcHandler handler(stats);
+  auto res = handler.Process(boost::json::object{
+      {"jsonrpc", "2.0"}, {"method", "GetStats"}, {"id", 0}});
+  if (!res || !res->contains("result")) {
+    return nullptr;
+  }
+  return res->at("result");
+}
 
 // 雑なエスケープ処理
 // 文字列中に \ や " が含まれてたら全体をエスケープする
@@ -50,11 +72,22 @@ std::string escape_if_needed(std::string str) {
 }
 
 int main(int argc, char* argv[]) {
+  // --startup-profile で表示する起動時間の基準
+  auto startup_start = std::chrono::steady_clock::now();
+
   rlimit lim;
   if (::getrlimit(RLIMIT_NOFILE, &lim) != 0) {
     std::cerr << "getrlimit 失敗" << std::endl;
     return -1;
   }
+  // 仮想クライアント毎にソケットを使うので、できるだけハードリミットまで上げておく
+  if (lim.rlim_cur < lim.rlim_max) {
+    rlimit raised = lim;
+    raised.rlim_cur = lim.rlim_max;
+    if (::setrlimit(RLIMIT_NOFILE, &raised) == 0) {
+      lim = raised;
+    }
+  }
   if (lim.rlim_cur < 1024) {
     std::cerr << "ファイルディスクリプタの数が足りません。"
                  "最低でも 1024 以上にして下さい。"
@@ -79,83 +112,177 @@ int main(int argc, char* argv[]) {
   std::optional<std::string> ui_remote_url;
   std::string connection_id_stats_file;
   double instance_hatch_rate = 1.0;
+  std::string load_profile;
+  AdmissionController::Config admission_config;
+  int context_pool_size = 0;
+  int workers = 0;
+  std::string video_codec_capability_cache;
+  bool startup_profile = false;
+  DistributedConfig distributed_config;
   ZakuroConfig config;
-  Util::ParseArgs(args, config_file, log_level, http_host, http_port, ui,
-                  ui_remote_url, connection_id_stats_file, instance_hatch_rate,
-                  config, false);
+  try {
+    Util::ParseArgs(args, config_file, log_level, http_host, http_port, ui,
+                    ui_remote_url, connection_id_stats_file,
+                    instance_hatch_rate, load_profile, admission_config,
+                    context_pool_size, workers, video_codec_capability_cache,
+                    startup_profile, distributed_config, config, false);
+  } catch (const InvalidArgsError& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  auto config_parse_time = std::chrono::steady_clock::now() - startup_start;
+
+  // --followers が指定されていたらコーディネーターとして動き、
+  // 設定をフォロワーに振り分けて送る。このプロセスではインスタンスを実行しない
+  if (!distributed_config.followers.empty()) {
+    std::string error;
+    auto coordinator = Coordinator::Create(distributed_config.followers,
+                                           distributed_config.token,
+                                           Util::LoadJsoncFile(config_file),
+                                           error);
+    if (coordinator == nullptr) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    std::shared_ptr<ZakuroStats> stats(new ZakuroStats());
+    stats->SetCoordinator(coordinator);
+    std::unique_ptr<HttpServer> http_server;
+    if (http_host && http_port) {
+      http_server.reset(
+          new HttpServer(*http_host, *http_port, std::nullopt, stats));
+      http_server->Start();
+    }
+    if (!coordinator->Start(distributed_config.start_delay, error)) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    std::cout << "followers will start at " << coordinator->GetStartAtMs()
+              << std::endl;
+    return coordinator->Wait();
+  }
+
+  // 設定ファイルの各インスタンスの引数の後ろに、コマンドラインの引数を追加する
+  std::vector<std::string> post_args;
+  // args の --config を取り除きつつ post_args に追加
+  for (auto it = args.begin(); it != args.end(); ++it) {
+    if (*it == "--config") {
+      // --config hoge
+      ++it;
+      continue;
+    }
+    if (it->find("--config=") == 0) {
+      continue;
+    }
+    post_args.push_back(*it);
+  }
+
+  // --follower の場合は先に HTTP サーバーを起動して、
+  // コーディネーターから設定と開始時刻が届くまで待つ
+  std::shared_ptr<ZakuroStats> stats(new ZakuroStats());
+  std::unique_ptr<HttpServer> http_server;
+  std::shared_ptr<Follower> follower;
+  boost::json::value follower_config;
+  if (distributed_config.follower) {
+    if (!http_host || !http_port) {
+      std::cerr << "--follower を指定する場合は --http-host と --http-port "
+                   "も指定してください"
+                << std::endl;
+      return 1;
+    }
+    if (workers > 0) {
+      std::cerr << "--follower と --workers は併用できません" << std::endl;
+      return 1;
+    }
+    // 誰でも設定を送れてしまうので、ループバック以外で待ち受ける場合は
+    // コーディネーターと共有するトークンを必須にする
+    bool loopback = *http_host == "127.0.0.1" || *http_host == "localhost" ||
+                    *http_host == "::1";
+    if (!loopback && distributed_config.token.empty()) {
+      std::cerr << "--follower を 127.0.0.1 以外で待ち受ける場合は "
+                   "--follower-token も指定してください"
+                << std::endl;
+      return 1;
+    }
+    // 受け取った設定は、Prepare に成功を返す前に全てパースして確かめる
+    follower = std::make_shared<Follower>(
+        distributed_config.token,
+        [post_args](const boost::json::value& config, std::string& error) {
+          return Util::ValidateConfig(config, post_args, error);
+        });
+    stats->SetFollower(follower);
+    http_server.reset(
+        new HttpServer(*http_host, *http_port, std::nullopt, stats));
+    http_server->Start();
+    std::cout << "waiting for coordinator on " << *http_host << ":"
+              << *http_port << std::endl;
+    follower_config = follower->WaitForStart();
+    if (follower_config.is_null()) {
+      follower->WaitForCollected(kFollowerLingerTime);
+      return 0;
+    }
+    // 設定を待っていた時間は起動時間に含めない
+    startup_start = std::chrono::steady_clock::now() - config_parse_time;
+  }
+
+  bool has_config_file = false;
+  std::chrono::steady_clock::duration config_load_time{};
+  std::chrono::steady_clock::duration config_expand_time{};
 
-  if (config_file.empty()) {
+  if (config_file.empty() && follower_config.is_null()) {
     // 設定ファイルが無ければそのまま ZakuroConfig を利用する
     configs.push_back(config);
   } else {
     // 設定ファイルがある場合は設定ファイルから引数を構築し直して再度パースする
-    boost::json::value zakuro_value = Util::LoadJsoncFile(config_file);
+    // フォロワーの場合はコーディネーターから受け取った設定を使う
+    has_config_file = true;
+    auto load_start = std::chrono::steady_clock::now();
+    boost::json::value zakuro_value = follower_config.is_null()
+                                          ? Util::LoadJsoncFile(config_file)
+                                          : follower_config;
+    config_load_time = std::chrono::steady_clock::now() - load_start;
+    if (!zakuro_value.is_object()) {
+      std::cerr << "設定がオブジェクトではありません。" << std::endl;
+      return 1;
+    }
     const auto& zakuro_obj = zakuro_value.as_object();
     std::vector<std::string> common_args;
-    common_args.clear();
-
-    if (zakuro_obj.contains("log-level")) {
-      common_args.push_back("--log-level");
-      common_args.push_back(
-          Util::PrimitiveValueToString(zakuro_obj.at("log-level")));
-    }
-    if (zakuro_obj.contains("http-port")) {
-      common_args.push_back("--http-port");
-      common_args.push_back(
-          Util::PrimitiveValueToString(zakuro_obj.at("http-port")));
-    }
-    if (zakuro_obj.contains("http-host")) {
-      common_args.push_back("--http-host");
-      common_args.push_back(
-          Util::PrimitiveValueToString(zakuro_obj.at("http-host")));
-    }
-    if (zakuro_obj.contains("ui")) {
-      if (zakuro_obj.at("ui").as_bool()) {
-        common_args.push_back("--ui");
-      }
-    }
-    if (zakuro_obj.contains("ui-remote-url")) {
-      common_args.push_back("--ui-remote-url");
-      common_args.push_back(
-          Util::PrimitiveValueToString(zakuro_obj.at("ui-remote-url")));
-    }
-    if (zakuro_obj.contains("output-file-connection-id")) {
-      common_args.push_back("--output-file-connection-id");
-      common_args.push_back(Util::PrimitiveValueToString(
-          zakuro_obj.at("output-file-connection-id")));
-    }
-    if (zakuro_obj.contains("instance-hatch-rate")) {
-      common_args.push_back("--instance-hatch-rate");
-      common_args.push_back(
-          Util::PrimitiveValueToString(zakuro_obj.at("instance-hatch-rate")));
-    }
-
-    std::vector<std::string> post_args;
-    // args の --config を取り除きつつ post_args に追加
-    for (auto it = args.begin(); it != args.end(); ++it) {
-      if (*it == "--config") {
-        // --config hoge
-        ++it;
-        continue;
-      }
-      if (it->find("--config=") == 0) {
-        continue;
-      }
-      post_args.push_back(*it);
+    try {
+      common_args = Util::ParseConfigToCommonArgs(zakuro_obj);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
     }
 
-    if (!zakuro_obj.contains("instances")) {
+    auto instances_value = zakuro_obj.if_contains("instances");
+    if (instances_value == nullptr) {
       std::cerr << "instances キーがありません。" << std::endl;
       return 1;
     }
-    const auto& instances_array = zakuro_obj.at("instances").as_array();
+    if (!instances_value->is_array()) {
+      std::cerr << "instances が配列ではありません。" << std::endl;
+      return 1;
+    }
+    const auto& instances_array = instances_value->as_array();
     if (instances_array.size() == 0) {
       std::cerr << "instances の下に設定がありません。" << std::endl;
       return 1;
     }
+    auto expand_start = std::chrono::steady_clock::now();
     for (const auto& instance : instances_array) {
       auto argss = Util::ParseInstanceToArgs(instance);
-      for (auto args : argss) {
+      ZakuroConfig first_config;
+      for (size_t n = 0; n < argss.size(); n++) {
+        // instance-num で増やした 2 個目以降のインスタンスは、
+        // ${} で値が変わったオプションだけを最初のインスタンスの設定に反映する
+        if (n > 0) {
+          config = first_config;
+          if (Util::ApplyInstanceArgs(argss[0], argss[n], post_args, config)) {
+            configs.push_back(config);
+            continue;
+          }
+        }
+
+        auto args = argss[n];
         args.insert(args.begin(), common_args.begin(), common_args.end());
         args.insert(args.end(), post_args.begin(), post_args.end());
 
@@ -167,21 +294,81 @@ int main(int argc, char* argv[]) {
 
         config_file = "";
         config = ZakuroConfig();
-        Util::ParseArgs(args, config_file, log_level, http_host, http_port, ui,
-                        ui_remote_url, connection_id_stats_file,
-                        instance_hatch_rate, config, true);
+        try {
+          Util::ParseArgs(args, config_file, log_level, http_host, http_port,
+                          ui, ui_remote_url, connection_id_stats_file,
+                          instance_hatch_rate, load_profile, admission_config,
+                          context_pool_size, workers,
+                          video_codec_capability_cache, startup_profile,
+                          distributed_config, config, true);
+        } catch (const InvalidArgsError& e) {
+          std::cerr << e.what() << std::endl;
+          return 1;
+        }
+        if (n == 0) {
+          first_config = config;
+        }
         configs.push_back(config);
       }
+      if (argss.size() > 1) {
+        std::cout << "  (instance-num: " << argss.size() << ")" << std::endl;
+      }
+    }
+    config_expand_time = std::chrono::steady_clock::now() - expand_start;
+
+    // 設定ファイルで指定された場合も併用できない
+    if (follower != nullptr && workers > 0) {
+      std::cerr << "--follower と --workers は併用できません" << std::endl;
+      return 1;
     }
   }
 
+  // ユニークな番号を設定
+  for (int i = 0; i < configs.size(); i++) {
+    configs[i].id = i;
+  }
+
+  // --workers が指定されていたらワーカープロセスを fork して、
+  // インスタンスをワーカー毎に振り分ける。
+  // 親プロセスはインスタンスを実行せず、ワーカーの統計をまとめて返す。
+  // fork はスレッドを作る前に行う必要がある
+  std::shared_ptr<WorkerStatsRing> worker_ring;
+  int worker_index = -1;
+  if (workers > 0) {
+    worker_ring =
+        WorkerStatsRing::Create(workers, kDefaultWorkerStatsSlotSize);
+    if (worker_ring == nullptr) {
+      std::cerr << "共有メモリの確保に失敗しました" << std::endl;
+      return 1;
+    }
+    worker_index = Workers::Fork(workers, worker_ring);
+    if (worker_index == -2) {
+      return 1;
+    }
+  }
+  bool is_worker = worker_index >= 0;
+  bool is_worker_parent = workers > 0 && !is_worker;
+  // このプロセスで実行するインスタンスかどうか
+  auto is_local = [workers, worker_index](const ZakuroConfig& config) {
+    return workers == 0 || config.id % workers == worker_index;
+  };
+  if (is_worker) {
+    // HTTP サーバーとファイルへの出力は親プロセスで行う
+    http_host.reset();
+    http_port.reset();
+    connection_id_stats_file.clear();
+  }
+
   webrtc::LogMessage::LogToDebug((webrtc::LoggingSeverity)log_level);
   webrtc::LogMessage::LogTimestamps();
   webrtc::LogMessage::LogThreads();
 
   std::unique_ptr<webrtc::FileRotatingLogSink> log_sink(
-      new webrtc::FileRotatingLogSink("./", "webrtc_logs",
-                                      kDefaultMaxLogFileSize, 10));
+      new webrtc::FileRotatingLogSink(
+          "./",
+          is_worker ? "webrtc_logs_worker" + std::to_string(worker_index)
+                    : "webrtc_logs",
+          kDefaultMaxLogFileSize, 10));
   if (!log_sink->Init()) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << "Failed to open log file";
     log_sink.reset();
@@ -190,21 +377,129 @@ int main(int argc, char* argv[]) {
   webrtc::LogMessage::AddLogToStream(log_sink.get(), webrtc::LS_INFO);
 
   std::shared_ptr<GameKeyCore> key_core(new GameKeyCore());
-  key_core->Init();
+  // キー入力は 1 つのプロセスだけで受け付ける
+  if (!is_worker_parent && worker_index <= 0) {
+    key_core->Init();
+  }
   // 各 config に GameKeyCore の設定を入れていく
   for (auto& config : configs) {
     config.key_core = key_core;
   }
 
   // 各 config に stats を設定
-  std::shared_ptr<ZakuroStats> stats(new ZakuroStats());
   for (auto& config : configs) {
     config.stats = stats;
   }
+  if (is_worker_parent) {
+    stats->SetWorkerStatsRing(worker_ring);
+  }
 
-  // ユニークな番号を設定
-  for (int i = 0; i < configs.size(); i++) {
-    configs[i].id = i;
+  // RPC でスレッドの配置を返せるように、各スレッドの役割を覚えておく
+  auto thread_registry = std::make_shared<ThreadRegistry>();
+  for (auto& config : configs) {
+    config.thread_registry = thread_registry;
+  }
+  stats->SetThreadRegistry(thread_registry);
+
+  // 設定の読み込みにかかった時間を足しておき、
+  // このプロセスで実行する全てのインスタンスの準備が終わったら表示する
+  if (startup_profile) {
+    auto profile = std::make_shared<StartupProfile>(
+        startup_start, is_worker_parent
+                           ? 0
+                           : std::count_if(configs.begin(), configs.end(),
+                                           is_local));
+    profile->Add("config.parse", config_parse_time);
+    if (has_config_file) {
+      profile->Add("config.load", config_load_time);
+      profile->Add("config.expand", config_expand_time);
+    }
+    for (auto& config : configs) {
+      config.startup_profile = profile;
+    }
+    if (is_worker_parent) {
+      profile->Print();
+    }
+  }
+
+  // ネットワークスレッドの数が指定されていなければ、
+  // CPU のコアを全てのインスタンスで分け合う
+  int cores = std::max<int>(1, std::thread::hardware_concurrency());
+  for (auto& config : configs) {
+    if (config.network_threads == 0) {
+      config.network_threads = std::max<int>(1, cores / configs.size());
+    }
+  }
+
+  // フォロワーは SetLoad で仮想クライアント数を変えられるように、
+  // 負荷プロファイルが無ければ全ての仮想クライアントを接続するプロファイルにする
+  if (follower != nullptr && load_profile.empty()) {
+    int vcs = 0;
+    for (const auto& config : configs) {
+      vcs += config.vcs;
+    }
+    load_profile = boost::json::serialize(boost::json::array{
+        boost::json::object{{"curve", "step"}, {"vcs", vcs}}});
+  }
+
+  // 負荷プロファイルは全てのインスタンスで共有する
+  if (!load_profile.empty()) {
+    boost::system::error_code ec;
+    auto phases = boost::json::parse(load_profile, ec);
+    if (ec) {
+      std::cerr << "load-profile が JSON ではありません: " << ec.message()
+                << std::endl;
+      return 1;
+    }
+    std::vector<int> capacities;
+    for (const auto& config : configs) {
+      capacities.push_back(config.vcs);
+    }
+    std::string error;
+    auto profile = LoadProfile::Create(phases, capacities, error);
+    if (profile == nullptr) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    for (auto& config : configs) {
+      config.load_profile = profile;
+    }
+    stats->SetLoadProfile(profile);
+    if (follower != nullptr) {
+      follower->SetLoadProfile(profile);
+    }
+  }
+
+  // 接続処理の数の制限は全てのインスタンスで共有する
+  // ワーカープロセスの場合はワーカー毎に上限を分ける
+  if (is_worker) {
+    admission_config.max_in_flight =
+        (admission_config.max_in_flight + workers - 1) / workers;
+  }
+  if (admission_config.max_in_flight > 0) {
+    auto admission = AdmissionController::Create(admission_config);
+    for (auto& config : configs) {
+      config.admission = admission;
+    }
+    stats->SetAdmissionController(admission);
+  }
+
+  // スレッドを持つ SoraClientContext を設定が同じインスタンス同士で共有する
+  // 全てのインスタンスのスレッドが終わった後に破棄する
+  std::shared_ptr<SoraClientContextPool> context_pool;
+  if (context_pool_size > 0) {
+    context_pool = std::make_shared<SoraClientContextPool>(context_pool_size);
+    for (auto& config : configs) {
+      config.context_pool = context_pool;
+    }
+  }
+
+  // 映像のエンコーダーとデコーダーの確認はプロセスで 1 回だけ行い、
+  // 結果と CUDA や AMF のコンテキストを全てのインスタンスで共有する
+  auto capability_cache =
+      std::make_shared<VideoCodecCapabilityCache>(video_codec_capability_cache);
+  for (auto& config : configs) {
+    config.video_codec_capability_cache = capability_cache;
   }
 
   // --ui-remote-url は --ui と併用必須
@@ -215,8 +510,8 @@ int main(int argc, char* argv[]) {
   }
 
   // HTTP サーバーの起動
-  std::unique_ptr<HttpServer> http_server;
-  if (http_host && http_port) {
+  // フォロワーの場合は既に起動している
+  if (http_server == nullptr && http_host && http_port) {
     // --ui 指定時のみリバプロを有効化
     std::optional<std::string> remote_url;
     if (ui) {
@@ -225,11 +520,12 @@ int main(int argc, char* argv[]) {
       RTC_LOG(LS_INFO) << "UI remote URL set to: " << url;
       remote_url = url;
     }
-    http_server.reset(new HttpServer(*http_host, *http_port, remote_url));
+    http_server.reset(
+        new HttpServer(*http_host, *http_port, remote_url, stats));
     http_server->Start();
     RTC_LOG(LS_INFO) << "HTTP server started on " << *http_host << ":"
                      << *http_port;
-  } else if (http_host || http_port) {
+  } else if (http_host.has_value() != http_port.has_value()) {
     std::cerr << "--http-host と --http-port は両方指定する必要があります"
               << std::endl;
     return 1;
@@ -240,11 +536,17 @@ int main(int argc, char* argv[]) {
   // C++20 にしないと latch が無いので mutex+CV で終了を検知する
   std::mutex stats_mut;
   std::condition_variable stats_cv;
-  int stats_countdown = configs.size();
+  // 親プロセスの場合はワーカープロセスの数
+  int stats_countdown = 0;
+  if (is_worker_parent) {
+    stats_countdown = workers;
+  } else {
+    stats_countdown = std::count_if(configs.begin(), configs.end(), is_local);
+  }
   if (!connection_id_stats_file.empty()) {
     stats_th.reset(new std::thread([stats, &stats_cv, &stats_mut,
-                                    &stats_countdown,
-                                    &connection_id_stats_file]() {
+                                    &stats_countdown, &connection_id_stats_file,
+                                    is_worker_parent]() {
       while (true) {
         std::unique_lock<std::mutex> lock(stats_mut);
         bool countzero = stats_cv.wait_for(
@@ -282,6 +584,17 @@ int main(int argc, char* argv[]) {
                 stat.connection_id);
           }
         }
+        // ワーカープロセスの統計は共有メモリから読んだ JSON から集める
+        if (is_worker_parent) {
+          auto result = GetStatsJson(stats);
+          for (const auto& instance : result.at("instances").as_array()) {
+            for (const auto& vc : instance.at("vcs").as_array()) {
+              d[std::string(vc.at("connected_url").as_string())]
+               [std::string(vc.at("channel_id").as_string())]
+                   .push_back(std::string(vc.at("connection_id").as_string()));
+            }
+          }
+        }
         // 頑張って object に変換する
         boost::json::object obj;
         for (const auto& p : d) {
@@ -300,13 +613,51 @@ int main(int argc, char* argv[]) {
     }));
   }
 
+  // ワーカープロセスは定期的に統計を共有メモリに書き込む
+  std::unique_ptr<std::thread> worker_stats_th;
+  if (is_worker) {
+    worker_stats_th.reset(new std::thread([stats, worker_ring, worker_index,
+                                           &stats_cv, &stats_mut,
+                                           &stats_countdown]() {
+      while (true) {
+        bool countzero;
+        {
+          std::unique_lock<std::mutex> lock(stats_mut);
+          countzero = stats_cv.wait_for(
+              lock, std::chrono::seconds(1),
+              [&stats_countdown]() { return stats_countdown == 0; });
+        }
+        auto data = boost::json::serialize(GetStatsJson(stats));
+        if (!worker_ring->Write(worker_index, data)) {
+          RTC_LOG(LS_WARNING) << "worker stats too large: size="
+                              << data.size();
+        }
+        // 最後の統計を書き込んでから終了する
+        if (countzero) {
+          break;
+        }
+      }
+    }));
+  }
+
+  // 仮想クライアントを作る前のメモリ使用量を覚えておき、
+  // GetStats で仮想クライアント 1 つあたりのメモリを計算する
+  stats->SetBaselineMemory(ProcessMemory::Get());
+
   std::vector<std::unique_ptr<std::thread>> ths;
   for (int i = 0; i < configs.size(); i++) {
     const auto& config = configs[i];
+    if (!is_local(config)) {
+      continue;
+    }
     ths.push_back(std::unique_ptr<std::thread>(
         new std::thread([i, config, &stats_cv, &stats_mut, &stats_countdown,
                          instance_hatch_rate]() {
-          int wait_ms = (int)(1000 * i / instance_hatch_rate);
+          // 負荷プロファイルがある場合は全てのインスタンスをすぐに開始して、
+          // 接続する数はプロファイルに従う
+          int wait_ms = config.load_profile != nullptr
+                            ? 0
+                            : (int)(1000 * i / instance_hatch_rate);
           std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
           Zakuro zakuro(config);
           zakuro.Run();
@@ -316,12 +667,29 @@ int main(int argc, char* argv[]) {
           }
         })));
   }
+  int result = 0;
+  if (is_worker_parent) {
+    result = Workers::Wait(worker_ring, [&stats_cv, &stats_mut,
+                                         &stats_countdown](int worker) {
+      std::lock_guard<std::mutex> guard(stats_mut);
+      if (--stats_countdown == 0) {
+        stats_cv.notify_all();
+      }
+    });
+  }
   for (auto& th : ths) {
     th->join();
   }
+  if (worker_stats_th) {
+    worker_stats_th->join();
+  }
   if (stats_th) {
     stats_th->join();
   }
+  if (follower != nullptr) {
+    follower->SetFinished();
+    follower->WaitForCollected(kFollowerLingerTime);
+  }
 
-  return 0;
+  return result;
 }
@@ -0,0 +1,29 @@
+#include "memory_usage.h"
+
+#include <fstream>
+
+#include <unistd.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+ProcessMemory ProcessMemory::Get() {
+  ProcessMemory m;
+#if defined(__linux__)
+  // /proc/self/statm の 2 番目の項目がページ単位の RSS
+  std::ifstream ifs("/proc/self/statm");
+  size_t size = 0;
+  size_t resident = 0;
+  if (ifs >> size >> resident) {
+    m.rss_bytes = resident * sysconf(_SC_PAGESIZE);
+  }
+#endif
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  // 全てのアリーナの使用中のチャンクと、mmap で確保した大きなチャンクの合計
+  struct mallinfo2 mi = mallinfo2();
+  m.heap_bytes = mi.uordblks + mi.hblkhd;
+#endif
+  return m;
+}
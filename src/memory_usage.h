@@ -0,0 +1,24 @@
+#ifndef MEMORY_USAGE_H_
+#define MEMORY_USAGE_H_
+
+#include <cstddef>
+#include <string>
+
+// プロセス全体のメモリ使用量
+struct ProcessMemory {
+  // 物理メモリに載っている量。取得できない環境では 0
+  size_t rss_bytes = 0;
+  // malloc で確保して使用中の量。glibc 以外では 0
+  size_t heap_bytes = 0;
+
+  static ProcessMemory Get();
+};
+
+// 文字列がヒープに確保しているバイト数
+// 短い文字列はオブジェクトの中に入るので 0 になる
+inline size_t StringHeapBytes(const std::string& s) {
+  static const size_t inline_capacity = std::string().capacity();
+  return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+#endif
@@ -0,0 +1,307 @@
+#include "network_shard.h"
+
+#include <cerrno>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+// WebRTC
+#include <api/task_queue/pending_task_safety_flag.h>
+#include <p2p/base/basic_packet_socket_factory.h>
+#include <rtc_base/async_socket.h>
+#include <rtc_base/physical_socket_server.h>
+#include <rtc_base/socket_address.h>
+#include <rtc_base/thread.h>
+
+#include "udp_batch.h"
+
+namespace {
+
+// 送受信したパケットを数えるソケット
+class CountingSocket : public webrtc::AsyncSocketAdapter {
+ public:
+  // count_syscalls が true の場合は、1 回の送信を 1 回のシステムコールとして数える
+  CountingSocket(webrtc::Socket* socket,
+                 std::shared_ptr<NetworkShard::Counters> counters,
+                 bool count_syscalls)
+      : webrtc::AsyncSocketAdapter(socket),
+        counters_(counters),
+        count_syscalls_(count_syscalls) {}
+
+  using webrtc::AsyncSocketAdapter::RecvFrom;
+
+  int Send(const void* pv, size_t cb) override {
+    return CountSent(webrtc::AsyncSocketAdapter::Send(pv, cb));
+  }
+  int SendTo(const void* pv,
+             size_t cb,
+             const webrtc::SocketAddress& addr) override {
+    return CountSent(webrtc::AsyncSocketAdapter::SendTo(pv, cb, addr));
+  }
+  int Recv(void* pv, size_t cb, int64_t* timestamp) override {
+    return CountReceived(webrtc::AsyncSocketAdapter::Recv(pv, cb, timestamp));
+  }
+  int RecvFrom(void* pv,
+               size_t cb,
+               webrtc::SocketAddress* paddr,
+               int64_t* timestamp) override {
+    return CountReceived(
+        webrtc::AsyncSocketAdapter::RecvFrom(pv, cb, paddr, timestamp));
+  }
+
+ private:
+  int CountSent(int r) {
+    if (count_syscalls_) {
+      counters_->send_syscalls.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (r > 0) {
+      counters_->packets_sent.fetch_add(1, std::memory_order_relaxed);
+      counters_->bytes_sent.fetch_add(r, std::memory_order_relaxed);
+    }
+    return r;
+  }
+  int CountReceived(int r) {
+    if (r > 0) {
+      counters_->packets_received.fetch_add(1, std::memory_order_relaxed);
+      counters_->bytes_received.fetch_add(r, std::memory_order_relaxed);
+    }
+    return r;
+  }
+
+  std::shared_ptr<NetworkShard::Counters> counters_;
+  bool count_syscalls_;
+};
+
+#if defined(__linux__)
+// UDP のパケットをまとめて送受信するソケット
+//
+// 送信は同じタスクの中で送ったパケットを溜めておき、タスクが終わった後に
+// sendmmsg (+ GSO) でまとめて送る。UDP なので送れなかったパケットは捨てる。
+// 受信は読み込みイベントが来たら recvmmsg (+ GRO) で読めるだけ読み、
+// 読んだパケットがなくなるまで読み込みイベントを通知する。
+// 読み込みイベントの再開は PhysicalSocket と同じく EnableEvents で行い、
+// ソケットからは recvmmsg でしか読まない。
+class BatchingUdpSocket : public webrtc::SocketDispatcher {
+ public:
+  BatchingUdpSocket(webrtc::PhysicalSocketServer* ss,
+                    std::shared_ptr<NetworkShard::Counters> counters)
+      : webrtc::SocketDispatcher(ss), counters_(counters) {}
+  ~BatchingUdpSocket() override { Flush(); }
+
+  bool Create(int family, int type) override {
+    if (!webrtc::SocketDispatcher::Create(family, type)) {
+      return false;
+    }
+    sender_.reset(new UdpBatchSender(GetDescriptor()));
+    receiver_.reset(new UdpBatchReceiver(GetDescriptor()));
+    sender_->EnableGso();
+    receiver_->EnableGro();
+    return true;
+  }
+
+  using webrtc::SocketDispatcher::RecvFrom;
+
+  int SendTo(const void* pv,
+             size_t cb,
+             const webrtc::SocketAddress& addr) override {
+    sockaddr_storage saddr;
+    size_t len = addr.ToSockAddrStorage(&saddr);
+    if (len == 0) {
+      return webrtc::SocketDispatcher::SendTo(pv, cb, addr);
+    }
+    sender_->Add(pv, cb, (const sockaddr*)&saddr, len);
+    if (sender_->GetPendingCount() >= UdpBatchSender::kMaxBatch) {
+      Flush();
+    } else if (sender_->GetPendingCount() == 1) {
+      webrtc::Thread::Current()->PostTask(
+          webrtc::SafeTask(safety_.flag(), [this]() { Flush(); }));
+    }
+    return cb;
+  }
+
+  int RecvFrom(void* pv,
+               size_t cb,
+               webrtc::SocketAddress* paddr,
+               int64_t* timestamp) override {
+    sockaddr_storage saddr;
+    socklen_t len;
+    int r = receiver_->Pop(pv, cb, &saddr, &len);
+    if (r < 0 && receiver_->Receive() > 0) {
+      r = receiver_->Pop(pv, cb, &saddr, &len);
+    }
+    if (r < 0) {
+      SetError(EWOULDBLOCK);
+      return -1;
+    }
+    if (paddr != nullptr) {
+      webrtc::SocketAddressFromSockAddrStorage(saddr, paddr);
+    }
+    if (timestamp != nullptr) {
+      *timestamp = -1;
+    }
+    return r;
+  }
+
+  int Close() override {
+    Flush();
+    return webrtc::SocketDispatcher::Close();
+  }
+
+  void OnEvent(uint32_t ff, int err) override {
+    if (ff & webrtc::DE_READ) {
+      auto alive = safety_.flag();
+      DisableEvents(webrtc::DE_READ);
+      ReadQueued();
+      if (!alive->alive()) {
+        return;
+      }
+      ff &= ~webrtc::DE_READ;
+    }
+    if (ff != 0) {
+      webrtc::SocketDispatcher::OnEvent(ff, err);
+    }
+  }
+
+ private:
+  // 受信したパケットを上位に渡す
+  // 返る前に必ず読み込みイベントを再開するか、続きを読むタスクを積む
+  void ReadQueued() {
+    // 受信し続けている間に同じスレッドの他のソケットが待たされないように、
+    // recvmmsg を呼ぶ回数を制限する
+    constexpr int kMaxReceives = 4;
+    auto alive = safety_.flag();
+    for (int i = 0; i < kMaxReceives; i++) {
+      if (receiver_->IsEmpty() && receiver_->Receive() == 0) {
+        // カーネルの受信キューが空になったので、次のパケットを待つ
+        EnableEvents(webrtc::DE_READ);
+        return;
+      }
+      while (!receiver_->IsEmpty()) {
+        size_t queued = receiver_->GetQueuedCount();
+        SignalReadEvent(this);
+        if (!alive->alive()) {
+          return;
+        }
+        // 読まれなかった場合は、残りを次の読み込みイベントで渡す
+        if (receiver_->GetQueuedCount() == queued) {
+          EnableEvents(webrtc::DE_READ);
+          return;
+        }
+      }
+    }
+    // まだ受信できるかもしれないので、他のタスクを挟んでから続きを読む
+    // 読み込みイベントは止めたままにしておく
+    webrtc::Thread::Current()->PostTask(
+        webrtc::SafeTask(safety_.flag(), [this]() { ReadQueued(); }));
+  }
+
+  void Flush() {
+    if (sender_ == nullptr || sender_->GetPendingCount() == 0) {
+      return;
+    }
+    auto r = sender_->Flush();
+    counters_->send_syscalls.fetch_add(r.syscalls, std::memory_order_relaxed);
+    counters_->send_dropped.fetch_add(r.dropped, std::memory_order_relaxed);
+  }
+
+  std::unique_ptr<UdpBatchSender> sender_;
+  std::unique_ptr<UdpBatchReceiver> receiver_;
+  std::shared_ptr<NetworkShard::Counters> counters_;
+  webrtc::ScopedTaskSafety safety_;
+};
+#endif
+
+// ネットワークスレッドのソケットを CountingSocket で包む
+// udp_batching が true の場合は UDP のソケットを BatchingUdpSocket で包む
+class CountingSocketFactory : public webrtc::SocketFactory {
+ public:
+  CountingSocketFactory(webrtc::SocketFactory* factory,
+                        std::shared_ptr<NetworkShard::Counters> counters,
+                        bool udp_batching)
+      : factory_(factory), counters_(counters), udp_batching_(udp_batching) {}
+
+  webrtc::Socket* CreateSocket(int family, int type) override {
+#if defined(__linux__)
+    if (udp_batching_ && type == SOCK_DGRAM) {
+      // ネットワークスレッドのソケットサーバーは PhysicalSocketServer なので、
+      // そこに BatchingUdpSocket を登録する
+      auto socket = std::make_unique<BatchingUdpSocket>(
+          static_cast<webrtc::PhysicalSocketServer*>(factory_), counters_);
+      if (!socket->Create(family, type)) {
+        return nullptr;
+      }
+      return new CountingSocket(socket.release(), counters_, false);
+    }
+#endif
+    webrtc::Socket* socket = factory_->CreateSocket(family, type);
+    if (socket == nullptr) {
+      return nullptr;
+    }
+    return new CountingSocket(socket, counters_, true);
+  }
+
+ private:
+  webrtc::SocketFactory* factory_;
+  std::shared_ptr<NetworkShard::Counters> counters_;
+  bool udp_batching_;
+};
+
+}  // namespace
+
+std::unique_ptr<webrtc::SocketFactory> NetworkShard::CreateSocketFactory(
+    webrtc::SocketServer* socket_server,
+    std::shared_ptr<Counters> counters,
+    bool udp_batching) {
+  return std::make_unique<CountingSocketFactory>(socket_server, counters,
+                                                 udp_batching);
+}
+
+std::shared_ptr<NetworkShard> NetworkShard::Create(
+    std::shared_ptr<sora::SoraClientContext> context,
+    std::shared_ptr<sora::SoraClientContext> threads_context,
+    bool udp_batching) {
+  if (context == nullptr || threads_context == nullptr) {
+    return nullptr;
+  }
+  std::shared_ptr<NetworkShard> shard(new NetworkShard());
+  shard->threads_context_ = threads_context;
+  shard->context_ = context;
+  shard->counters_ = std::make_shared<Counters>();
+  auto network_thread = context->network_thread();
+  shard->socket_factory_ = CreateSocketFactory(
+      network_thread->socketserver(), shard->counters_, udp_batching);
+  shard->packet_socket_factory_.reset(
+      new webrtc::BasicPacketSocketFactory(shard->socket_factory_.get()));
+#if defined(__linux__)
+  // CPU 時間は他のスレッドから取得できるように、スレッドの clockid を取っておく
+  shard->cpu_clock_ =
+      network_thread->BlockingCall([]() -> std::optional<clockid_t> {
+        clockid_t id;
+        if (pthread_getcpuclockid(pthread_self(), &id) != 0) {
+          return std::nullopt;
+        }
+        return id;
+      });
+#endif
+  return shard;
+}
+
+NetworkShard::Stats NetworkShard::GetStats() const {
+  Stats st;
+  st.clients = clients_.load();
+  st.packets_sent = counters_->packets_sent.load();
+  st.packets_received = counters_->packets_received.load();
+  st.bytes_sent = counters_->bytes_sent.load();
+  st.bytes_received = counters_->bytes_received.load();
+  st.send_syscalls = counters_->send_syscalls.load();
+  st.send_dropped = counters_->send_dropped.load();
+  st.cpu_time_ms = -1;
+#if defined(__linux__)
+  timespec ts;
+  if (cpu_clock_ && clock_gettime(*cpu_clock_, &ts) == 0) {
+    st.cpu_time_ms = ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+  }
+#endif
+  return st;
+}
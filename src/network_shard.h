@@ -0,0 +1,112 @@
+#ifndef NETWORK_SHARD_H_
+#define NETWORK_SHARD_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+// WebRTC
+#include <api/packet_socket_factory.h>
+#include <rtc_base/socket_factory.h>
+#include <rtc_base/thread.h>
+
+// Sora C++ SDK
+#include <sora/sora_client_context.h>
+
+// ネットワークスレッド 1 つと、そのスレッドで使うソケットファクトリ
+//
+// SoraClientContext 1 つにつきネットワークスレッドは 1 つなので、全ての
+// 仮想クライアントの RTP/RTCP/SCTP のパケットがそのスレッドで処理される。
+// 仮想クライアントを複数の NetworkShard に振り分けて処理を分散させ、
+// パケット数とスレッドの CPU 時間で偏りを確認できるようにする。
+//
+// PeerConnectionFactory はネットワークスレッドを 1 つしか持てないので
+// NetworkShard 毎に作るが、ワーカーとシグナリングのスレッドは最初の
+// NetworkShard のもの (threads_context) を共有する。
+class NetworkShard {
+ public:
+  // context の PeerConnectionFactory は threads_context のワーカーと
+  // シグナリングのスレッドで作っておくこと。最初の NetworkShard では
+  // context と threads_context は同じになる。
+  // udp_batching が true の場合は UDP のパケットをまとめて送受信する（Linux のみ）
+  // 失敗した場合は nullptr を返す
+  static std::shared_ptr<NetworkShard> Create(
+      std::shared_ptr<sora::SoraClientContext> context,
+      std::shared_ptr<sora::SoraClientContext> threads_context,
+      bool udp_batching);
+
+  struct Counters;
+  // socket_server のソケットを包んで送受信したパケットを counters に数える
+  // ソケットファクトリを作る
+  // socket_server は PhysicalSocketServer で、そのスレッドから使うこと
+  static std::unique_ptr<webrtc::SocketFactory> CreateSocketFactory(
+      webrtc::SocketServer* socket_server,
+      std::shared_ptr<Counters> counters,
+      bool udp_batching);
+
+  const std::shared_ptr<sora::SoraClientContext>& context() const {
+    return context_;
+  }
+  // PeerConnectionFactory が使っているスレッド
+  // context()->signaling_thread() ではなくこちらを使うこと
+  webrtc::Thread* signaling_thread() const {
+    return threads_context_->signaling_thread();
+  }
+  webrtc::Thread* worker_thread() const {
+    return threads_context_->worker_thread();
+  }
+  // ネットワークスレッドから使うこと
+  webrtc::PacketSocketFactory* socket_factory() const {
+    return packet_socket_factory_.get();
+  }
+
+  // この NetworkShard に割り当てた仮想クライアントの数を増やす
+  void AddClients(int n) { clients_ += n; }
+
+  // ソケットから随時更新される
+  struct Counters {
+    std::atomic<uint64_t> packets_sent{0};
+    std::atomic<uint64_t> packets_received{0};
+    std::atomic<uint64_t> bytes_sent{0};
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<uint64_t> send_syscalls{0};
+    std::atomic<uint64_t> send_dropped{0};
+  };
+
+  struct Stats {
+    int clients;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    // 送信に使ったシステムコールの回数
+    uint64_t send_syscalls;
+    // まとめて送信した時に送れずに捨てたパケット数
+    uint64_t send_dropped;
+    // ネットワークスレッドの CPU 時間。取得できない環境では -1
+    double cpu_time_ms;
+  };
+  Stats GetStats() const;
+
+ private:
+  NetworkShard() = default;
+
+  // context_ の PeerConnectionFactory がスレッドを使っているので、
+  // context_ より後に破棄する
+  std::shared_ptr<sora::SoraClientContext> threads_context_;
+  std::shared_ptr<sora::SoraClientContext> context_;
+  std::shared_ptr<Counters> counters_;
+  std::unique_ptr<webrtc::SocketFactory> socket_factory_;
+  std::unique_ptr<webrtc::PacketSocketFactory> packet_socket_factory_;
+  std::atomic<int> clients_{0};
+#if defined(__linux__)
+  std::optional<clockid_t> cpu_clock_;
+#endif
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include "nop_video_decoder.h"
 
+#include <algorithm>
+#include <cmath>
+
 // WebRTC
 #include <api/video/i420_buffer.h>
 #include <media/base/media_constants.h>
@@ -8,8 +11,81 @@
 #include <modules/video_coding/codecs/vp8/include/vp8.h>
 #include <modules/video_coding/codecs/vp9/include/vp9.h>
 #include <modules/video_coding/include/video_error_codes.h>
+#include <system_wrappers/include/clock.h>
+#include <system_wrappers/include/ntp_time.h>
+
+std::shared_ptr<NopVideoDecoderStreamStats> NopVideoDecoderStats::AddStream(
+    webrtc::VideoCodecType codec_type) {
+  auto stream = std::make_shared<NopVideoDecoderStreamStats>();
+  stream->codec_type = codec_type;
+  std::lock_guard<std::mutex> guard(mutex_);
+  streams_.push_back(stream);
+  return stream;
+}
+
+static void AddToCodecStats(const NopVideoDecoderStreamStats& stream,
+                            NopVideoDecoderCodecStats& codec) {
+  codec.streams += 1;
+  codec.frames += stream.frames.load();
+  codec.bytes += stream.bytes.load();
+  codec.keyframes += stream.keyframes.load();
+  codec.missing_frames += stream.missing_frames.load();
+  codec.decode_interval_ms.Merge(stream.decode_interval_ms.GetSnapshot());
+}
+
+void NopVideoDecoderStats::RemoveStream(
+    const std::shared_ptr<NopVideoDecoderStreamStats>& stream) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = std::find(streams_.begin(), streams_.end(), stream);
+  if (it == streams_.end()) {
+    return;
+  }
+  AddToCodecStats(*stream, finished_[stream->codec_type]);
+  streams_.erase(it);
+}
+
+std::vector<std::shared_ptr<NopVideoDecoderStreamStats>>
+NopVideoDecoderStats::GetStreams() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return streams_;
+}
+
+std::map<webrtc::VideoCodecType, NopVideoDecoderCodecStats>
+NopVideoDecoderStats::GetCodecs() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto codecs = finished_;
+  for (const auto& stream : streams_) {
+    AddToCodecStats(*stream, codecs[stream->codec_type]);
+  }
+  return codecs;
+}
+
+// 全てのデコーダーで共有する、デコード結果の代わりに渡す小さなフレーム
+// 誰も書き換えないので、フレーム毎に確保せずに使い回す
+static webrtc::scoped_refptr<webrtc::VideoFrameBuffer> GetPlaceholderBuffer() {
+  static const webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer = []() {
+    auto i420_buffer = webrtc::I420Buffer::Create(320, 240);
+    webrtc::I420Buffer::SetBlack(i420_buffer.get());
+    return webrtc::scoped_refptr<webrtc::VideoFrameBuffer>(i420_buffer);
+  }();
+  return buffer;
+}
+
+NopVideoDecoder::NopVideoDecoder(std::shared_ptr<NopVideoDecoderStats> stats)
+    : stats_(std::move(stats)) {}
+
+NopVideoDecoder::~NopVideoDecoder() {
+  Release();
+}
 
 bool NopVideoDecoder::Configure(const Settings& settings) {
+  if (stats_ != nullptr) {
+    if (stream_stats_ != nullptr) {
+      stats_->RemoveStream(stream_stats_);
+    }
+    stream_stats_ = stats_->AddStream(settings.codec_type());
+  }
+  last_decode_ms_ = std::nullopt;
   return true;
 }
 
@@ -20,13 +96,18 @@ int32_t NopVideoDecoder::Decode(const webrtc::EncodedImage& input_image,
     return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
   }
 
-  // 適当に小さいフレームをデコーダに渡す
-  webrtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
-      webrtc::I420Buffer::Create(320, 240);
+  if (stats_ != nullptr) {
+    UpdateStats(input_image);
+  }
 
+  if (stream_stats_ != nullptr) {
+    UpdateStreamStats(input_image, missing_frames);
+  }
+
+  // 適当に小さいフレームをデコーダに渡す
   webrtc::VideoFrame decoded_image =
       webrtc::VideoFrame::Builder()
-          .set_video_frame_buffer(i420_buffer)
+          .set_video_frame_buffer(GetPlaceholderBuffer())
           .set_timestamp_rtp(input_image.RtpTimestamp())
           .build();
   callback_->Decoded(decoded_image, std::nullopt, std::nullopt);
@@ -34,6 +115,91 @@ int32_t NopVideoDecoder::Decode(const webrtc::EncodedImage& input_image,
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
+void NopVideoDecoder::UpdateStats(const webrtc::EncodedImage& input_image) {
+  webrtc::Clock* clock = webrtc::Clock::GetRealTimeClock();
+  const int64_t now_ms = clock->TimeInMilliseconds();
+
+  // フレームを構成するパケットの中で最後に受信した時刻を到着時刻とする
+  int64_t arrival_ms = 0;
+  std::optional<int64_t> capture_ntp_ms;
+  for (const auto& packet_info : input_image.PacketInfos()) {
+    arrival_ms = std::max(arrival_ms, packet_info.receive_time().ms());
+    const auto& act = packet_info.absolute_capture_time();
+    if (act) {
+      int64_t ms = webrtc::UQ32x32ToInt64Ms(act->absolute_capture_timestamp);
+      // 途中のサーバーがクロックオフセットを推定している場合は受信側の時計に合わせる
+      if (act->estimated_capture_clock_offset) {
+        ms += webrtc::Q32x32ToInt64Ms(*act->estimated_capture_clock_offset);
+      }
+      capture_ntp_ms = ms;
+    }
+  }
+  if (arrival_ms == 0) {
+    arrival_ms = now_ms;
+  }
+
+  stats_->frames.fetch_add(1, std::memory_order_relaxed);
+
+  // 送信側のキャプチャ時刻から受信までの遅延
+  // 送信側と受信側の時計が同期していることを前提にしている
+  if (capture_ntp_ms) {
+    const int64_t arrival_ntp_ms =
+        clock->CurrentNtpInMilliseconds() - (now_ms - arrival_ms);
+    stats_->latency_ms.Add(
+        std::max<int64_t>(0, arrival_ntp_ms - *capture_ntp_ms));
+    stats_->frames_with_capture_time.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const uint32_t rtp_timestamp = input_image.RtpTimestamp();
+  if (last_arrival_ms_) {
+    const int64_t arrival_interval_ms = arrival_ms - *last_arrival_ms_;
+    // RTP タイムスタンプは 90kHz
+    const int64_t rtp_interval_ms =
+        (int32_t)(rtp_timestamp - last_rtp_timestamp_) / 90;
+    stats_->inter_frame_jitter_ms.Add(
+        std::abs(arrival_interval_ms - rtp_interval_ms));
+
+    // フリーズの判定は libwebrtc の VideoQualityObserver と同じ基準にする
+    const double freeze_threshold_ms =
+        std::max(3 * avg_frame_interval_ms_, avg_frame_interval_ms_ + 150);
+    if (avg_frame_interval_ms_ > 0 &&
+        arrival_interval_ms >= freeze_threshold_ms) {
+      stats_->freeze_duration_ms.Add(arrival_interval_ms);
+    } else if (avg_frame_interval_ms_ == 0) {
+      avg_frame_interval_ms_ = arrival_interval_ms;
+    } else {
+      avg_frame_interval_ms_ +=
+          (arrival_interval_ms - avg_frame_interval_ms_) / 16;
+    }
+  }
+  last_arrival_ms_ = arrival_ms;
+  last_rtp_timestamp_ = rtp_timestamp;
+}
+
+void NopVideoDecoder::UpdateStreamStats(const webrtc::EncodedImage& input_image,
+                                        bool missing_frames) {
+  auto& st = *stream_stats_;
+  if (!input_image.PacketInfos().empty()) {
+    st.ssrc.store(input_image.PacketInfos().begin()->ssrc(),
+                  std::memory_order_relaxed);
+  }
+  st.frames.fetch_add(1, std::memory_order_relaxed);
+  st.bytes.fetch_add(input_image.size(), std::memory_order_relaxed);
+  if (input_image.FrameType() == webrtc::VideoFrameType::kVideoFrameKey) {
+    st.keyframes.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (missing_frames) {
+    st.missing_frames.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const int64_t now_ms =
+      webrtc::Clock::GetRealTimeClock()->TimeInMilliseconds();
+  if (last_decode_ms_) {
+    st.decode_interval_ms.Add(now_ms - *last_decode_ms_);
+  }
+  last_decode_ms_ = now_ms;
+}
+
 int32_t NopVideoDecoder::RegisterDecodeCompleteCallback(
     webrtc::DecodedImageCallback* callback) {
   callback_ = callback;
@@ -41,6 +207,10 @@ int32_t NopVideoDecoder::RegisterDecodeCompleteCallback(
 }
 
 int32_t NopVideoDecoder::Release() {
+  if (stream_stats_ != nullptr) {
+    stats_->RemoveStream(stream_stats_);
+    stream_stats_ = nullptr;
+  }
   return WEBRTC_VIDEO_CODEC_OK;
 }
 const char* NopVideoDecoder::ImplementationName() const {
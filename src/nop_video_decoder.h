@@ -1,13 +1,78 @@
 #ifndef NOP_VIDEO_DECODER_H_
 #define NOP_VIDEO_DECODER_H_
 
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
 // WebRTC
 #include <api/video_codecs/video_codec.h>
 #include <api/video_codecs/video_decoder.h>
 #include <api/video_codecs/video_decoder_factory.h>
 
+#include "histogram.h"
+
+// NopVideoDecoder が扱っている 1 ストリーム分の受信統計
+struct NopVideoDecoderStreamStats {
+  webrtc::VideoCodecType codec_type = webrtc::kVideoCodecGeneric;
+  std::atomic<uint32_t> ssrc{0};
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> keyframes{0};
+  // missing_frames フラグが立っていた Decode 呼び出しの回数
+  std::atomic<uint64_t> missing_frames{0};
+  // Decode が呼ばれる間隔
+  Histogram decode_interval_ms{Histogram::LatencyMsBounds()};
+};
+
+// ストリームの受信統計をコーデック毎にまとめたもの
+struct NopVideoDecoderCodecStats {
+  uint64_t streams = 0;
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t keyframes = 0;
+  uint64_t missing_frames = 0;
+  HistogramSnapshot decode_interval_ms;
+};
+
+// NopVideoDecoder が集計するインスタンス単位の受信統計
+// 各ストリームのデコーダーから同時に更新される
+class NopVideoDecoderStats {
+ public:
+  // 送信側のキャプチャ時刻 (abs-capture-time) から受信時刻までの遅延
+  Histogram latency_ms{Histogram::LatencyMsBounds()};
+  // RTP タイムスタンプの間隔と到着間隔のずれ
+  Histogram inter_frame_jitter_ms{Histogram::LatencyMsBounds()};
+  // フリーズしていた時間
+  Histogram freeze_duration_ms{Histogram::LatencyMsBounds()};
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> frames_with_capture_time{0};
+
+  std::shared_ptr<NopVideoDecoderStreamStats> AddStream(
+      webrtc::VideoCodecType codec_type);
+  // 終了したストリームの統計はコーデック毎の統計に合算して破棄する
+  void RemoveStream(const std::shared_ptr<NopVideoDecoderStreamStats>& stream);
+
+  std::vector<std::shared_ptr<NopVideoDecoderStreamStats>> GetStreams() const;
+  // 終了したストリームも含めたコーデック毎の統計
+  std::map<webrtc::VideoCodecType, NopVideoDecoderCodecStats> GetCodecs()
+      const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<std::shared_ptr<NopVideoDecoderStreamStats>> streams_;
+  std::map<webrtc::VideoCodecType, NopVideoDecoderCodecStats> finished_;
+};
+
 class NopVideoDecoder : public webrtc::VideoDecoder {
  public:
+  NopVideoDecoder(std::shared_ptr<NopVideoDecoderStats> stats = nullptr);
+  ~NopVideoDecoder() override;
+
   bool Configure(const Settings& settings) override;
   int32_t Decode(const webrtc::EncodedImage& input_image,
                  bool missing_frames,
@@ -20,7 +85,20 @@ class NopVideoDecoder : public webrtc::VideoDecoder {
   const char* ImplementationName() const override;
 
  private:
+  void UpdateStats(const webrtc::EncodedImage& input_image);
+  void UpdateStreamStats(const webrtc::EncodedImage& input_image,
+                         bool missing_frames);
+
   webrtc::DecodedImageCallback* callback_ = nullptr;
+  std::shared_ptr<NopVideoDecoderStats> stats_;
+  std::shared_ptr<NopVideoDecoderStreamStats> stream_stats_;
+  std::optional<int64_t> last_decode_ms_;
+
+  // 前回のフレームの情報
+  std::optional<int64_t> last_arrival_ms_;
+  uint32_t last_rtp_timestamp_ = 0;
+  // フリーズ判定に使うフレーム間隔の平均
+  double avg_frame_interval_ms_ = 0;
 };
 
 class NopVideoDecoderFactory : public webrtc::VideoDecoderFactory {
@@ -0,0 +1,152 @@
+#include "rpc_client.h"
+
+// Boost
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+namespace {
+
+bool ParseUrl(const std::string& url,
+              std::string& host,
+              std::string& port,
+              std::string& target) {
+  if (url.rfind("http://", 0) != 0) {
+    return false;
+  }
+  std::string rest = url.substr(7);
+  auto path_pos = rest.find('/');
+  target = path_pos == std::string::npos ? "/rpc" : rest.substr(path_pos);
+  if (target == "/") {
+    target = "/rpc";
+  }
+  std::string authority = rest.substr(0, path_pos);
+  // [::1]:8080 のような IPv6 のアドレス
+  size_t host_end = 0;
+  if (!authority.empty() && authority[0] == '[') {
+    host_end = authority.find(']');
+    if (host_end == std::string::npos) {
+      return false;
+    }
+    host = authority.substr(1, host_end - 1);
+    host_end += 1;
+  } else {
+    host_end = authority.find(':');
+    host = authority.substr(0, host_end);
+  }
+  if (host_end < authority.size() && authority[host_end] == ':') {
+    port = authority.substr(host_end + 1);
+  } else {
+    port = "80";
+  }
+  return !host.empty() && !port.empty();
+}
+
+}  // namespace
+
+bool RpcClient::Call(const std::string& url,
+                     const std::string& method,
+                     const boost::json::value& params,
+                     boost::json::value& result,
+                     std::string& error,
+                     std::chrono::milliseconds timeout) {
+  namespace http = boost::beast::http;
+
+  std::string host, port, target;
+  if (!ParseUrl(url, host, port, target)) {
+    error = "invalid url: " + url;
+    return false;
+  }
+
+  boost::json::object body{{"jsonrpc", "2.0"}, {"method", method}, {"id", 1}};
+  if (!params.is_null()) {
+    body["params"] = params;
+  }
+
+  // ioc は最後に破棄する必要があるので最初に作る
+  boost::asio::io_context ioc;
+  boost::asio::ip::tcp::resolver resolver(ioc);
+  boost::beast::tcp_stream stream(ioc);
+  http::request<http::string_body> req{http::verb::post, target, 11};
+  req.set(http::field::host, host);
+  req.set(http::field::user_agent, "Zakuro/1.0");
+  req.set(http::field::content_type, "application/json");
+  req.body() = boost::json::serialize(body);
+  req.prepare_payload();
+  boost::beast::flat_buffer buffer;
+  http::response<http::string_body> res;
+
+  bool done = false;
+  boost::beast::error_code ec;
+  std::string what = "resolve";
+  resolver.async_resolve(
+      host, port,
+      [&](boost::beast::error_code e,
+          boost::asio::ip::tcp::resolver::results_type results) {
+        if (e) {
+          ec = e;
+          done = true;
+          return;
+        }
+        what = "connect";
+        stream.async_connect(
+            results, [&](boost::beast::error_code e,
+                         const boost::asio::ip::tcp::endpoint&) {
+              if (e) {
+                ec = e;
+                done = true;
+                return;
+              }
+              what = "write";
+              http::async_write(
+                  stream, req, [&](boost::beast::error_code e, std::size_t) {
+                    if (e) {
+                      ec = e;
+                      done = true;
+                      return;
+                    }
+                    what = "read";
+                    http::async_read(stream, buffer, res,
+                                     [&](boost::beast::error_code e,
+                                         std::size_t) {
+                                       ec = e;
+                                       done = true;
+                                     });
+                  });
+            });
+      });
+  // 名前解決も含めて全体でタイムアウトさせる
+  ioc.run_for(timeout);
+  if (!done) {
+    error = url + ": " + what + " timed out";
+    return false;
+  }
+  if (ec) {
+    error = url + ": " + what + " failed: " + ec.message();
+    return false;
+  }
+  if (res.result() != http::status::ok) {
+    error = url + ": HTTP " + std::to_string(res.result_int());
+    return false;
+  }
+
+  boost::system::error_code parse_ec;
+  auto v = boost::json::parse(res.body(), parse_ec);
+  if (parse_ec || !v.is_object()) {
+    error = url + ": invalid response";
+    return false;
+  }
+  const auto& obj = v.as_object();
+  if (auto p = obj.if_contains("error"); p != nullptr) {
+    error = url + ": " + method + " failed: " + boost::json::serialize(*p);
+    return false;
+  }
+  auto p = obj.if_contains("result");
+  if (p == nullptr) {
+    error = url + ": result is missing";
+    return false;
+  }
+  result = *p;
+  return true;
+}
@@ -0,0 +1,28 @@
+#ifndef RPC_CLIENT_H_
+#define RPC_CLIENT_H_
+
+#include <chrono>
+#include <string>
+
+// Boost
+#include <boost/json.hpp>
+
+// 他の zakuro の JSON-RPC を呼び出す
+//
+// 1 回の呼び出し毎に接続し、レスポンスを受け取るまでブロックする。
+// コーディネーターからフォロワーを操作するためのものなので http:// のみ対応する。
+class RpcClient {
+ public:
+  // url は http://host:port の形式。パスを省略した場合は /rpc に送る
+  // 成功した場合は result にレスポンスの result を入れて true を返す
+  // 失敗した場合やエラーレスポンスの場合は error にメッセージを入れて false を返す
+  static bool Call(
+      const std::string& url,
+      const std::string& method,
+      const boost::json::value& params,
+      boost::json::value& result,
+      std::string& error,
+      std::chrono::milliseconds timeout = std::chrono::seconds(10));
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "sampled_video_decoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+// WebRTC
+#include <modules/video_coding/include/video_error_codes.h>
+#include <rtc_base/logging.h>
+#include <system_wrappers/include/clock.h>
+
+#include "frame_watermark.h"
+
+std::shared_ptr<SampledVideoDecoderStreamStats>
+SampledVideoDecoderStats::AddStream(webrtc::VideoCodecType codec_type,
+                                    std::string implementation_name) {
+  auto stream = std::make_shared<SampledVideoDecoderStreamStats>();
+  stream->codec_type = codec_type;
+  stream->implementation_name = std::move(implementation_name);
+  std::lock_guard<std::mutex> guard(mutex_);
+  streams_.push_back(stream);
+  return stream;
+}
+
+void SampledVideoDecoderStats::RemoveStream(
+    const std::shared_ptr<SampledVideoDecoderStreamStats>& stream) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  streams_.erase(std::remove(streams_.begin(), streams_.end(), stream),
+                 streams_.end());
+}
+
+std::vector<std::shared_ptr<SampledVideoDecoderStreamStats>>
+SampledVideoDecoderStats::GetStreams() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return streams_;
+}
+
+SampledVideoDecoder::SampledVideoDecoder(
+    std::unique_ptr<webrtc::VideoDecoder> decoder,
+    std::shared_ptr<SampledVideoDecoderStats> stats,
+    bool detect_watermark)
+    : decoder_(std::move(decoder)),
+      stats_(std::move(stats)),
+      detect_watermark_(detect_watermark) {}
+
+SampledVideoDecoder::~SampledVideoDecoder() {
+  Release();
+}
+
+bool SampledVideoDecoder::Configure(const Settings& settings) {
+  if (stream_stats_ != nullptr) {
+    stats_->RemoveStream(stream_stats_);
+  }
+  stream_stats_ =
+      stats_->AddStream(settings.codec_type(), decoder_->ImplementationName());
+  fps_window_start_ms_ = 0;
+  fps_window_frames_ = 0;
+  last_watermark_frame_ = std::nullopt;
+  return decoder_->Configure(settings);
+}
+
+int32_t SampledVideoDecoder::Decode(const webrtc::EncodedImage& input_image,
+                                    bool missing_frames,
+                                    int64_t render_time_ms) {
+  webrtc::Clock* clock = webrtc::Clock::GetRealTimeClock();
+  const int64_t start_us = clock->TimeInMicroseconds();
+  int32_t result =
+      decoder_->Decode(input_image, missing_frames, render_time_ms);
+  const int64_t end_us = clock->TimeInMicroseconds();
+
+  if (stream_stats_ != nullptr) {
+    auto& st = *stream_stats_;
+    if (!input_image.PacketInfos().empty()) {
+      st.ssrc.store(input_image.PacketInfos().begin()->ssrc(),
+                    std::memory_order_relaxed);
+    }
+    st.frames.fetch_add(1, std::memory_order_relaxed);
+    st.decode_time_ms.Add((end_us - start_us) / 1000);
+    if (result != WEBRTC_VIDEO_CODEC_OK) {
+      st.decode_errors.fetch_add(1, std::memory_order_relaxed);
+      RTC_LOG(LS_WARNING) << "Failed to decode: implementation="
+                          << decoder_->ImplementationName()
+                          << " ssrc=" << st.ssrc.load()
+                          << " result=" << result;
+    }
+  }
+  return result;
+}
+
+int32_t SampledVideoDecoder::RegisterDecodeCompleteCallback(
+    webrtc::DecodedImageCallback* callback) {
+  callback_ = callback;
+  return decoder_->RegisterDecodeCompleteCallback(this);
+}
+
+int32_t SampledVideoDecoder::Release() {
+  if (stream_stats_ != nullptr) {
+    stats_->RemoveStream(stream_stats_);
+    stream_stats_ = nullptr;
+  }
+  return decoder_->Release();
+}
+
+webrtc::VideoDecoder::DecoderInfo SampledVideoDecoder::GetDecoderInfo() const {
+  return decoder_->GetDecoderInfo();
+}
+
+const char* SampledVideoDecoder::ImplementationName() const {
+  return decoder_->ImplementationName();
+}
+
+int32_t SampledVideoDecoder::Decoded(webrtc::VideoFrame& decoded_image) {
+  Decoded(decoded_image, std::nullopt, std::nullopt);
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void SampledVideoDecoder::Decoded(webrtc::VideoFrame& decoded_image,
+                                  std::optional<int32_t> decode_time_ms,
+                                  std::optional<uint8_t> qp) {
+  if (stream_stats_ != nullptr) {
+    auto& st = *stream_stats_;
+    st.decoded_frames.fetch_add(1, std::memory_order_relaxed);
+
+    const int width = decoded_image.width();
+    const int height = decoded_image.height();
+    if (st.width.load() != width || st.height.load() != height) {
+      if (st.width.load() != 0) {
+        st.resolution_changes.fetch_add(1, std::memory_order_relaxed);
+      }
+      st.width = width;
+      st.height = height;
+    }
+
+    // 1 秒毎にデコードできたフレーム数を fps とする
+    const int64_t now_ms =
+        webrtc::Clock::GetRealTimeClock()->TimeInMilliseconds();
+    if (fps_window_start_ms_ == 0) {
+      fps_window_start_ms_ = now_ms;
+    }
+    fps_window_frames_ += 1;
+    if (now_ms - fps_window_start_ms_ >= 1000) {
+      const int fps =
+          (int)(fps_window_frames_ * 1000 / (now_ms - fps_window_start_ms_));
+      // 多少のゆらぎは変化とみなさない
+      if (st.fps.load() != 0 && std::abs(fps - st.fps.load()) > 1) {
+        st.fps_changes.fetch_add(1, std::memory_order_relaxed);
+      }
+      st.fps = fps;
+      fps_window_start_ms_ = now_ms;
+      fps_window_frames_ = 0;
+    }
+
+    if (detect_watermark_) {
+      DetectWatermark(decoded_image);
+    }
+  }
+
+  if (callback_ != nullptr) {
+    callback_->Decoded(decoded_image, decode_time_ms, qp);
+  }
+}
+
+void SampledVideoDecoder::DetectWatermark(const webrtc::VideoFrame& frame) {
+  auto buffer = frame.video_frame_buffer()->ToI420();
+  if (buffer == nullptr) {
+    return;
+  }
+  auto wm = FrameWatermark::Detect(*buffer);
+  if (!wm) {
+    return;
+  }
+
+  auto& st = *stream_stats_;
+  st.watermark_frames.fetch_add(1, std::memory_order_relaxed);
+  // 時刻は下位 32 ビットしか無いので差分だけを見る
+  int32_t latency_ms = (int32_t)(FrameWatermark::NowMs() - wm->capture_time_ms);
+  if (latency_ms >= 0) {
+    st.glass_to_glass_latency_ms.Add(latency_ms);
+  }
+  if (last_watermark_frame_) {
+    uint16_t diff = wm->frame - *last_watermark_frame_;
+    if (diff == 0) {
+      st.frozen_frames.fetch_add(1, std::memory_order_relaxed);
+    } else if (diff < 0x8000) {
+      st.dropped_frames.fetch_add(diff - 1, std::memory_order_relaxed);
+    }
+  }
+  last_watermark_frame_ = wm->frame;
+}
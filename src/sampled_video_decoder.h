@@ -0,0 +1,106 @@
+#ifndef SAMPLED_VIDEO_DECODER_H_
+#define SAMPLED_VIDEO_DECODER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// WebRTC
+#include <api/video_codecs/video_codec.h>
+#include <api/video_codecs/video_decoder.h>
+
+#include "histogram.h"
+
+// 実際にデコードしているストリームの統計
+struct SampledVideoDecoderStreamStats {
+  webrtc::VideoCodecType codec_type = webrtc::kVideoCodecGeneric;
+  std::string implementation_name;
+  std::atomic<uint32_t> ssrc{0};
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> decoded_frames{0};
+  std::atomic<uint64_t> decode_errors{0};
+  // Decode の呼び出しにかかった時間
+  Histogram decode_time_ms{Histogram::LatencyMsBounds()};
+  std::atomic<int> width{0};
+  std::atomic<int> height{0};
+  std::atomic<uint64_t> resolution_changes{0};
+  // 直近 1 秒間にデコードできたフレーム数
+  std::atomic<int> fps{0};
+  std::atomic<uint64_t> fps_changes{0};
+  // フレームに埋め込まれた透かしから計算した統計
+  std::atomic<uint64_t> watermark_frames{0};
+  Histogram glass_to_glass_latency_ms{Histogram::LatencyMsBounds()};
+  // フレーム番号が飛んだ数
+  std::atomic<uint64_t> dropped_frames{0};
+  // 前と同じフレーム番号のフレームをデコードした数
+  std::atomic<uint64_t> frozen_frames{0};
+};
+
+// 実際にデコードしているストリームの一覧
+// 各ストリームのデコーダーから同時に更新される
+class SampledVideoDecoderStats {
+ public:
+  std::shared_ptr<SampledVideoDecoderStreamStats> AddStream(
+      webrtc::VideoCodecType codec_type,
+      std::string implementation_name);
+  void RemoveStream(
+      const std::shared_ptr<SampledVideoDecoderStreamStats>& stream);
+  std::vector<std::shared_ptr<SampledVideoDecoderStreamStats>> GetStreams()
+      const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<std::shared_ptr<SampledVideoDecoderStreamStats>> streams_;
+};
+
+// 本物のデコーダーを使ってデコードし、その結果を統計に記録するデコーダー
+// 受信ストリームの一部だけをこのデコーダーにして、映像が正しく
+// デコードできるかどうかを確認するのに使う
+class SampledVideoDecoder : public webrtc::VideoDecoder,
+                            public webrtc::DecodedImageCallback {
+ public:
+  // detect_watermark が false の場合は、デコードしたフレームから透かしを
+  // 読み取らない（I420 への変換も行わない）
+  SampledVideoDecoder(std::unique_ptr<webrtc::VideoDecoder> decoder,
+                      std::shared_ptr<SampledVideoDecoderStats> stats,
+                      bool detect_watermark);
+  ~SampledVideoDecoder() override;
+
+  // webrtc::VideoDecoder
+  bool Configure(const Settings& settings) override;
+  int32_t Decode(const webrtc::EncodedImage& input_image,
+                 bool missing_frames,
+                 int64_t render_time_ms) override;
+  int32_t RegisterDecodeCompleteCallback(
+      webrtc::DecodedImageCallback* callback) override;
+  int32_t Release() override;
+  DecoderInfo GetDecoderInfo() const override;
+  const char* ImplementationName() const override;
+
+  // webrtc::DecodedImageCallback
+  int32_t Decoded(webrtc::VideoFrame& decoded_image) override;
+  void Decoded(webrtc::VideoFrame& decoded_image,
+               std::optional<int32_t> decode_time_ms,
+               std::optional<uint8_t> qp) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoDecoder> decoder_;
+  std::shared_ptr<SampledVideoDecoderStats> stats_;
+  std::shared_ptr<SampledVideoDecoderStreamStats> stream_stats_;
+  webrtc::DecodedImageCallback* callback_ = nullptr;
+  bool detect_watermark_;
+
+  // fps の計測用
+  int64_t fps_window_start_ms_ = 0;
+  int fps_window_frames_ = 0;
+  // 最後に読み取った透かしのフレーム番号
+  std::optional<uint16_t> last_watermark_frame_;
+
+  void DetectWatermark(const webrtc::VideoFrame& frame);
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "scenario_parser.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+#include "data_channel_stats.h"
+
+namespace {
+
+// 展開した後の op の数の上限
+const int kMaxOps = 100000;
+// play のネストの上限
+const int kMaxDepth = 8;
+// zakuro.cpp の MESSAGE_SIZE_MAX と同じ
+const int kMessageSizeMax = 256 * 1000;
+// シナリオの最後まで来た後に繰り返す待機の時間
+const int kIdleTimeMs = 10000;
+
+class ScenarioParser {
+ public:
+  ScenarioParser(const boost::json::object& scenarios)
+      : scenarios_(scenarios) {}
+
+  bool Parse(const std::string& name,
+             ScenarioData& data,
+             int& loop_op_index,
+             int depth) {
+    if (depth > kMaxDepth) {
+      return Fail(name, "play is nested too deeply");
+    }
+    auto it = scenarios_.find(name);
+    if (it == scenarios_.end()) {
+      return Fail(name, "scenario not found");
+    }
+    if (!it->value().is_array()) {
+      return Fail(name, "scenario must be an array");
+    }
+    loop_op_index = -1;
+    if (!ParseOps(name, it->value().as_array(), data, depth, true,
+                  loop_op_index)) {
+      return false;
+    }
+    if (loop_op_index < 0) {
+      loop_op_index = data.ops.size();
+      data.Sleep(kIdleTimeMs, kIdleTimeMs);
+    }
+    return true;
+  }
+
+  std::string error;
+
+ private:
+  bool Fail(const std::string& path, const std::string& message) {
+    error = "scenarios." + path + ": " + message;
+    return false;
+  }
+
+  bool GetInt(const std::string& path,
+              const boost::json::object& obj,
+              const char* key,
+              int min_value,
+              int& value) {
+    auto it = obj.find(key);
+    if (it == obj.end()) {
+      return true;
+    }
+    if (!it->value().is_int64() && !it->value().is_uint64()) {
+      return Fail(path, std::string(key) + " must be an integer");
+    }
+    auto v = boost::json::value_to<int64_t>(it->value());
+    if (v < min_value || v > INT32_MAX) {
+      return Fail(path, std::string(key) + " is out of range");
+    }
+    value = (int)v;
+    return true;
+  }
+
+  bool GetDouble(const std::string& path,
+                 const boost::json::object& obj,
+                 const char* key,
+                 double min_value,
+                 std::optional<double>& value) {
+    auto it = obj.find(key);
+    if (it == obj.end()) {
+      return true;
+    }
+    if (!it->value().is_number()) {
+      return Fail(path, std::string(key) + " must be a number");
+    }
+    double v = boost::json::value_to<double>(it->value());
+    if (v < min_value) {
+      return Fail(path, std::string(key) + " is out of range");
+    }
+    value = v;
+    return true;
+  }
+
+  bool ParseOps(const std::string& path,
+                const boost::json::array& ops,
+                ScenarioData& data,
+                int depth,
+                bool allow_infinite_loop,
+                int& loop_op_index) {
+    for (int i = 0; i < ops.size(); i++) {
+      std::string p = path + "[" + std::to_string(i) + "]";
+      if (!ops[i].is_object()) {
+        return Fail(p, "op must be an object");
+      }
+      bool is_last = i == ops.size() - 1;
+      if (!ParseOp(p, ops[i].as_object(), data, depth,
+                   allow_infinite_loop && is_last, loop_op_index)) {
+        return false;
+      }
+      if (data.ops.size() > kMaxOps) {
+        return Fail(p, "too many ops after expanding loops");
+      }
+    }
+    return true;
+  }
+
+  bool ParseOp(const std::string& path,
+               const boost::json::object& obj,
+               ScenarioData& data,
+               int depth,
+               bool allow_infinite_loop,
+               int& loop_op_index) {
+    auto it = obj.find("op");
+    if (it == obj.end() || !it->value().is_string()) {
+      return Fail(path, "op is required");
+    }
+    std::string op(it->value().as_string());
+
+    if (op == "sleep") {
+      int time = 0;
+      if (!GetInt(path, obj, "time", 0, time)) {
+        return false;
+      }
+      int min_time = time;
+      if (!GetInt(path, obj, "min", 0, min_time)) {
+        return false;
+      }
+      int max_time = std::max(time, min_time);
+      if (!GetInt(path, obj, "max", 0, max_time)) {
+        return false;
+      }
+      if (min_time > max_time) {
+        return Fail(path, "min must be less than or equal to max");
+      }
+      data.Sleep(min_time, max_time);
+    } else if (op == "sleep-exponential") {
+      int mean = 0;
+      int min_time = 0;
+      if (!GetInt(path, obj, "mean", 1, mean) ||
+          !GetInt(path, obj, "min", 0, min_time)) {
+        return false;
+      }
+      if (mean == 0) {
+        return Fail(path, "mean is required");
+      }
+      data.SleepExponential(mean, min_time);
+    } else if (op == "mute-audio" || op == "unmute-audio") {
+      data.SetAudioEnabled(op == "unmute-audio");
+    } else if (op == "mute-video" || op == "unmute-video") {
+      data.SetVideoEnabled(op == "unmute-video");
+    } else if (op == "set-video-encoding") {
+      VideoEncodingParameters params;
+      int max_bitrate = 0;
+      if (!GetInt(path, obj, "max-bitrate", 1, max_bitrate) ||
+          !GetDouble(path, obj, "max-framerate", 1,
+                     params.max_framerate) ||
+          !GetDouble(path, obj, "scale-resolution-down-by", 1,
+                     params.scale_resolution_down_by)) {
+        return false;
+      }
+      if (max_bitrate > 0) {
+        params.max_bitrate_kbps = max_bitrate;
+      }
+      if (!params.max_bitrate_kbps && !params.max_framerate &&
+          !params.scale_resolution_down_by) {
+        return Fail(path, "set-video-encoding requires at least one value");
+      }
+      data.SetVideoEncoding(params);
+    } else if (op == "send-data-channel") {
+      auto label = obj.find("label");
+      if (label == obj.end() || !label->value().is_string()) {
+        return Fail(path, "label is required");
+      }
+      int size_min = DataChannelHeader::kSize;
+      int size_max = 0;
+      int count = 1;
+      int interval = 0;
+      if (!GetInt(path, obj, "size-min", DataChannelHeader::kSize, size_min) ||
+          !GetInt(path, obj, "size-max", DataChannelHeader::kSize, size_max) ||
+          !GetInt(path, obj, "count", 1, count) ||
+          !GetInt(path, obj, "interval", 0, interval)) {
+        return false;
+      }
+      size_max = std::max(size_min, size_max);
+      if (size_max > kMessageSizeMax) {
+        return Fail(path, "size-max is out of range");
+      }
+      // バーストは送信と待機の繰り返しに展開する
+      std::string l(label->value().as_string());
+      for (int i = 0; i < count; i++) {
+        if (i != 0 && interval > 0) {
+          data.Sleep(interval, interval);
+        }
+        data.SendDataChannelMessage(l, size_min, size_max);
+        if (data.ops.size() > kMaxOps) {
+          return Fail(path, "too many ops after expanding count");
+        }
+      }
+    } else if (op == "disconnect") {
+      data.Disconnect();
+    } else if (op == "reconnect") {
+      data.Reconnect();
+    } else if (op == "exit") {
+      data.Exit();
+    } else if (op == "play") {
+      auto name = obj.find("scenario");
+      if (name == obj.end() || !name->value().is_string()) {
+        return Fail(path, "scenario is required");
+      }
+      std::string n(name->value().as_string());
+      ScenarioData sd;
+      int sub_loop_op_index;
+      if (!Parse(n, sd, sub_loop_op_index, depth + 1)) {
+        return false;
+      }
+      // 組み込みのサブシナリオ（scenario-dcs-<label> など）と名前が重ならないようにする
+      data.PlaySubScenario("user-scenario-" + n, sd, sub_loop_op_index);
+    } else if (op == "loop") {
+      auto ops = obj.find("ops");
+      if (ops == obj.end() || !ops->value().is_array() ||
+          ops->value().as_array().empty()) {
+        return Fail(path, "ops is required");
+      }
+      int count = 0;
+      if (!GetInt(path, obj, "count", 1, count)) {
+        return false;
+      }
+      if (count == 0) {
+        // count が無い場合は最後の op としてだけ使えて、ずっと繰り返す
+        if (!allow_infinite_loop) {
+          return Fail(path, "loop without count must be the last op");
+        }
+        int start = data.ops.size();
+        int unused = -1;
+        if (!ParseOps(path, ops->value().as_array(), data, depth, false,
+                      unused)) {
+          return false;
+        }
+        // 待機が無いと同じクライアントの op が止まらずに実行され続ける
+        bool has_sleep = false;
+        for (int i = start; i < data.ops.size(); i++) {
+          int type = data.ops[i].which();
+          if (type == ScenarioData::OP_SLEEP ||
+              type == ScenarioData::OP_SLEEP_EXPONENTIAL) {
+            has_sleep = true;
+          }
+        }
+        if (!has_sleep) {
+          return Fail(path, "loop without count must contain sleep");
+        }
+        loop_op_index = start;
+      } else {
+        // 回数が決まっている場合は展開する
+        int unused = -1;
+        for (int i = 0; i < count; i++) {
+          if (!ParseOps(path, ops->value().as_array(), data, depth, false,
+                        unused)) {
+            return false;
+          }
+        }
+      }
+    } else {
+      return Fail(path, "unknown op " + op);
+    }
+    return true;
+  }
+
+  const boost::json::object& scenarios_;
+};
+
+}  // namespace
+
+bool ParseScenario(const boost::json::value& scenarios,
+                   const std::string& name,
+                   ScenarioData& data,
+                   int& loop_op_index,
+                   std::string& error) {
+  if (!scenarios.is_object()) {
+    error = "scenarios must be an object";
+    return false;
+  }
+  ScenarioParser parser(scenarios.as_object());
+  if (!parser.Parse(name, data, loop_op_index, 0)) {
+    error = parser.error;
+    return false;
+  }
+  return true;
+}
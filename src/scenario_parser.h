@@ -0,0 +1,22 @@
+#ifndef SCENARIO_PARSER_H_
+#define SCENARIO_PARSER_H_
+
+#include <string>
+
+// Boost
+#include <boost/json.hpp>
+
+#include "scenario_player.h"
+
+// 設定ファイルの scenarios に書かれた name のシナリオを data の末尾に追加する
+//
+// 最後の op が count の無い loop ならその先頭を、そうでなければ末尾に追加した
+// 待機を繰り返すので、その位置を loop_op_index に入れる。
+// 失敗した場合は error にメッセージを入れて false を返す。
+bool ParseScenario(const boost::json::value& scenarios,
+                   const std::string& name,
+                   ScenarioData& data,
+                   int& loop_op_index,
+                   std::string& error);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef SCENARIO_PLAYER_H_
 #define SCENARIO_PLAYER_H_
 
+#include <algorithm>
 #include <chrono>
 #include <map>
 #include <memory>
@@ -12,7 +13,9 @@
 #include <boost/variant.hpp>
 
 #include "binary_pool.h"
+#include "data_channel_traffic.h"
 #include "game/game_audio.h"
+#include "timer_wheel.h"
 #include "virtual_client.h"
 #include "voice_number_reader.h"
 
@@ -32,10 +35,37 @@ struct ScenarioData {
     std::string label;
     int min_size;
     int max_size;
+    // nullptr の場合は ScenarioPlayerConfig::binary_pool を使う
+    std::shared_ptr<BinaryPool> binary_pool;
   };
   struct OpDisconnect {};
   struct OpReconnect {};
   struct OpExit {};
+  // 平均 mean_time_ms の指数分布に従う時間だけ待つ
+  struct OpSleepExponential {
+    int mean_time_ms;
+    int min_time_ms;
+  };
+  struct OpSetAudioEnabled {
+    bool enabled;
+  };
+  // トークンバケットに従って DataChannel メッセージを送信し、
+  // 次のトークンが溜まるまで待つ
+  // 状態はクライアント毎に 1 つしか持たないので、1 つのシナリオに 1 つだけ入れる
+  struct OpSendDataChannelTraffic {
+    std::shared_ptr<DataChannelTraffic> traffic;
+  };
+  struct OpSetVideoEnabled {
+    bool enabled;
+  };
+  struct OpSetVideoEncoding {
+    VideoEncodingParameters params;
+  };
+  // 音声の RTP を送信するかどうかを切り替える
+  // OpSetAudioEnabled と違い、無効にしている間は無音のパケットも送らない
+  struct OpSetAudioActive {
+    bool active;
+  };
   enum Type {
     OP_SLEEP,
     OP_PLAY_SUB_SCENARIO,
@@ -44,6 +74,12 @@ struct ScenarioData {
     OP_DISCONNECT,
     OP_RECONNECT,
     OP_EXIT,
+    OP_SLEEP_EXPONENTIAL,
+    OP_SET_AUDIO_ENABLED,
+    OP_SEND_DATA_CHANNEL_TRAFFIC,
+    OP_SET_VIDEO_ENABLED,
+    OP_SET_VIDEO_ENCODING,
+    OP_SET_AUDIO_ACTIVE,
   };
 
   typedef boost::variant<OpSleep,
@@ -52,7 +88,13 @@ struct ScenarioData {
                          OpSendDataChannelMessage,
                          OpDisconnect,
                          OpReconnect,
-                         OpExit>
+                         OpExit,
+                         OpSleepExponential,
+                         OpSetAudioEnabled,
+                         OpSendDataChannelTraffic,
+                         OpSetVideoEnabled,
+                         OpSetVideoEncoding,
+                         OpSetAudioActive>
       operation_t;
   std::vector<operation_t> ops;
 
@@ -67,13 +109,174 @@ struct ScenarioData {
         loop_op_index});
   }
   void PlayVoiceNumberClient() { ops.push_back(OpPlayVoiceNumberClient()); }
-  void SendDataChannelMessage(std::string label, int min_size, int max_size) {
-    ops.push_back(
-        OpSendDataChannelMessage{std::move(label), min_size, max_size});
+  void SendDataChannelMessage(
+      std::string label,
+      int min_size,
+      int max_size,
+      std::shared_ptr<BinaryPool> binary_pool = nullptr) {
+    ops.push_back(OpSendDataChannelMessage{std::move(label), min_size, max_size,
+                                           std::move(binary_pool)});
   }
   void Disconnect() { ops.push_back(OpDisconnect()); }
   void Reconnect() { ops.push_back(OpReconnect()); }
   void Exit() { ops.push_back(OpExit()); }
+  void SleepExponential(int mean_time_ms, int min_time_ms) {
+    ops.push_back(OpSleepExponential{mean_time_ms, min_time_ms});
+  }
+  void SetAudioEnabled(bool enabled) {
+    ops.push_back(OpSetAudioEnabled{enabled});
+  }
+  void SendDataChannelTraffic(std::shared_ptr<DataChannelTraffic> traffic) {
+    ops.push_back(OpSendDataChannelTraffic{std::move(traffic)});
+  }
+  void SetVideoEnabled(bool enabled) {
+    ops.push_back(OpSetVideoEnabled{enabled});
+  }
+  void SetVideoEncoding(const VideoEncodingParameters& params) {
+    ops.push_back(OpSetVideoEncoding{params});
+  }
+  void SetAudioActive(bool active) { ops.push_back(OpSetAudioActive{active}); }
+};
+
+// ScenarioData を全てのクライアントで共有するためにコンパイルしたもの
+// ラベルとサブシナリオ名は整数の ID に置き換えて、op を固定長の配列にする
+// 一度作ったら変更しないので、クライアント毎に持つのは op の位置だけで済む
+struct CompiledScenario {
+  // シナリオ全体（サブシナリオも含む）で共有する名前の表
+  struct Symbols {
+    std::vector<std::string> labels;
+    std::vector<std::string> sub_scenarios;
+  };
+  struct Op {
+    ScenarioData::Type type;
+    // op 毎に意味が変わる
+    //   OP_SLEEP: a=min_time_ms, b=max_time_ms
+    //   OP_PLAY_SUB_SCENARIO: a=サブシナリオ ID, index=subs のインデックス
+    //   OP_SEND_DATA_CHANNEL_MESSAGE: a=min_size, b=max_size, label=ラベル ID,
+    //                                 index=binary_pools のインデックス
+    //   OP_SLEEP_EXPONENTIAL: a=mean_time_ms, b=min_time_ms
+    //   OP_SET_AUDIO_ENABLED, OP_SET_VIDEO_ENABLED: a=enabled
+    //   OP_SEND_DATA_CHANNEL_TRAFFIC: label=ラベル ID,
+    //                                 index=traffics のインデックス
+    //   OP_SET_VIDEO_ENCODING: index=video_encodings のインデックス
+    int a = 0;
+    int b = 0;
+    int label = -1;
+    int index = -1;
+  };
+  struct SubScenario {
+    std::shared_ptr<const CompiledScenario> scenario;
+    int loop_op_index;
+  };
+
+  std::vector<Op> ops;
+  std::vector<SubScenario> subs;
+  // nullptr の場合は ScenarioPlayerConfig::binary_pool を使う
+  std::vector<std::shared_ptr<BinaryPool>> binary_pools;
+  std::vector<std::shared_ptr<DataChannelTraffic>> traffics;
+  std::vector<VideoEncodingParameters> video_encodings;
+  std::shared_ptr<const Symbols> symbols;
+
+  static std::shared_ptr<const CompiledScenario> Compile(
+      const ScenarioData& data) {
+    auto symbols = std::make_shared<Symbols>();
+    std::map<const ScenarioData*, std::shared_ptr<const CompiledScenario>>
+        cache;
+    return Compile(data, symbols, cache);
+  }
+
+ private:
+  static int Intern(std::vector<std::string>& table, const std::string& name) {
+    auto it = std::find(table.begin(), table.end(), name);
+    if (it != table.end()) {
+      return (int)(it - table.begin());
+    }
+    table.push_back(name);
+    return (int)table.size() - 1;
+  }
+
+  static std::shared_ptr<const CompiledScenario> Compile(
+      const ScenarioData& data,
+      const std::shared_ptr<Symbols>& symbols,
+      std::map<const ScenarioData*, std::shared_ptr<const CompiledScenario>>&
+          cache) {
+    auto it = cache.find(&data);
+    if (it != cache.end()) {
+      return it->second;
+    }
+
+    auto cs = std::make_shared<CompiledScenario>();
+    cs->symbols = symbols;
+    cs->ops.reserve(data.ops.size());
+    for (const auto& opv : data.ops) {
+      Op op;
+      op.type = (ScenarioData::Type)opv.which();
+      switch (op.type) {
+        case ScenarioData::OP_SLEEP: {
+          auto& o = boost::get<ScenarioData::OpSleep>(opv);
+          op.a = o.min_time_ms;
+          op.b = o.max_time_ms;
+          break;
+        }
+        case ScenarioData::OP_PLAY_SUB_SCENARIO: {
+          auto& o = boost::get<ScenarioData::OpPlaySubScenario>(opv);
+          op.a = Intern(symbols->sub_scenarios, o.name);
+          op.index = (int)cs->subs.size();
+          cs->subs.push_back(
+              {Compile(*o.data, symbols, cache), o.loop_op_index});
+          break;
+        }
+        case ScenarioData::OP_SEND_DATA_CHANNEL_MESSAGE: {
+          auto& o = boost::get<ScenarioData::OpSendDataChannelMessage>(opv);
+          op.a = o.min_size;
+          op.b = o.max_size;
+          op.label = Intern(symbols->labels, o.label);
+          op.index = (int)cs->binary_pools.size();
+          cs->binary_pools.push_back(o.binary_pool);
+          break;
+        }
+        case ScenarioData::OP_SLEEP_EXPONENTIAL: {
+          auto& o = boost::get<ScenarioData::OpSleepExponential>(opv);
+          op.a = o.mean_time_ms;
+          op.b = o.min_time_ms;
+          break;
+        }
+        case ScenarioData::OP_SET_AUDIO_ENABLED: {
+          auto& o = boost::get<ScenarioData::OpSetAudioEnabled>(opv);
+          op.a = o.enabled ? 1 : 0;
+          break;
+        }
+        case ScenarioData::OP_SEND_DATA_CHANNEL_TRAFFIC: {
+          auto& o = boost::get<ScenarioData::OpSendDataChannelTraffic>(opv);
+          op.label = Intern(symbols->labels, o.traffic->label);
+          op.index = (int)cs->traffics.size();
+          cs->traffics.push_back(o.traffic);
+          break;
+        }
+        case ScenarioData::OP_SET_VIDEO_ENABLED: {
+          auto& o = boost::get<ScenarioData::OpSetVideoEnabled>(opv);
+          op.a = o.enabled ? 1 : 0;
+          break;
+        }
+        case ScenarioData::OP_SET_VIDEO_ENCODING: {
+          auto& o = boost::get<ScenarioData::OpSetVideoEncoding>(opv);
+          op.index = (int)cs->video_encodings.size();
+          cs->video_encodings.push_back(o.params);
+          break;
+        }
+        case ScenarioData::OP_SET_AUDIO_ACTIVE: {
+          auto& o = boost::get<ScenarioData::OpSetAudioActive>(opv);
+          op.a = o.active ? 1 : 0;
+          break;
+        }
+        default:
+          break;
+      }
+      cs->ops.push_back(op);
+    }
+    cache[&data] = cs;
+    return cs;
+  }
 };
 
 struct ScenarioPlayerConfig {
@@ -81,88 +284,167 @@ struct ScenarioPlayerConfig {
   GameAudioManager* gam;
   const std::vector<std::shared_ptr<VirtualClient>>* vcs;
   std::shared_ptr<BinaryPool> binary_pool;
+  // サブシナリオも含めて全てのクライアントで共有する
+  // nullptr の場合は ScenarioPlayer が作る
+  std::shared_ptr<TimerWheel> timer_wheel;
 };
 
 class ScenarioPlayer {
  public:
   ScenarioPlayer(const ScenarioPlayerConfig& config)
-      : config_(config), engine_(std::random_device()()) {
-    for (int i = 0; i < config_.vcs->size(); i++) {
-      client_infos_.push_back(ClientInfo(*config_.ioc));
+      : config_(config), client_infos_(config_.vcs->size()) {
+    if (config_.timer_wheel == nullptr) {
+      config_.timer_wheel = std::make_shared<TimerWheel>(*config_.ioc);
     }
   }
 
-  void Play(int client_id, ScenarioData data, int loop_op_index) {
+  // delay だけ待ってから scenario を先頭から再生する
+  void Play(int client_id,
+            std::shared_ptr<const CompiledScenario> scenario,
+            int loop_op_index,
+            std::chrono::milliseconds delay = std::chrono::milliseconds(0)) {
     if (client_id < 0 || client_id >= client_infos_.size() ||
-        data.ops.empty() || loop_op_index < 0 ||
-        loop_op_index >= data.ops.size()) {
+        scenario == nullptr || scenario->ops.empty() || loop_op_index < 0 ||
+        loop_op_index >= scenario->ops.size()) {
       return;
     }
 
-    client_infos_[client_id].data = std::move(data);
-    client_infos_[client_id].op_index = 0;
-    client_infos_[client_id].loop_op_index = loop_op_index;
-    client_infos_[client_id].timer.cancel();
-    client_infos_[client_id].paused = false;
-    client_infos_[client_id].exit = false;
-    DoNext(client_id);
+    // サブシナリオやバックグラウンドのシナリオは一部のクライアントしか再生しないので、
+    // 状態は再生する時に作る
+    auto& p = client_infos_[client_id];
+    if (p == nullptr) {
+      p.reset(new ClientInfo());
+      p->entry.callback = [this, client_id]() { OnTimer(client_id); };
+    }
+    auto& info = *p;
+    info.scenario = std::move(scenario);
+    info.op_index = 0;
+    info.loop_op_index = loop_op_index;
+    config_.timer_wheel->Cancel(&info.entry);
+    info.sleeping = false;
+    info.paused = false;
+    info.exit = false;
+    config_.timer_wheel->Schedule(&info.entry, delay);
+  }
+  // client_id のシナリオを止める（サブシナリオも止める）
+  void Stop(int client_id) {
+    if (client_id < 0 || client_id >= client_infos_.size() ||
+        client_infos_[client_id] == nullptr) {
+      return;
+    }
+    auto& info = *client_infos_[client_id];
+    config_.timer_wheel->Cancel(&info.entry);
+    info.scenario = nullptr;
+    info.sleeping = false;
+    if (info.traffic != nullptr) {
+      DeactivateTraffic(*info.traffic, std::chrono::steady_clock::now());
+      info.traffic->started = false;
+    }
+    for (auto& player : sub_scenario_) {
+      if (player != nullptr) {
+        player->Stop(client_id);
+      }
+    }
   }
   void PauseAll() {
     for (auto& info : client_infos_) {
-      info.timer.cancel();
-      info.paused = true;
+      if (info == nullptr) {
+        continue;
+      }
+      config_.timer_wheel->Cancel(&info->entry);
+      info->sleeping = false;
+      info->paused = true;
     }
   }
   void ResumeAll() {
     for (int i = 0; i < client_infos_.size(); i++) {
-      client_infos_[i].paused = false;
+      // まだ Play していないか、Stop した
+      if (client_infos_[i] == nullptr) {
+        continue;
+      }
+      client_infos_[i]->paused = false;
+      if (client_infos_[i]->scenario == nullptr) {
+        continue;
+      }
       DoNext(i);
     }
   }
 
+  // client_id のためにこのプレイヤーとサブシナリオのプレイヤーが持っている
+  // 状態のバイト数
+  // シナリオ自体は全てのクライアントで共有しているので含めない
+  size_t GetMemoryUsage(int client_id) const {
+    if (client_id < 0 || client_id >= client_infos_.size() ||
+        client_infos_[client_id] == nullptr) {
+      return 0;
+    }
+    const auto& info = *client_infos_[client_id];
+    size_t size = sizeof(ClientInfo);
+    if (info.traffic != nullptr) {
+      size += sizeof(DataChannelTrafficState);
+    }
+    for (const auto& player : sub_scenario_) {
+      if (player != nullptr) {
+        size += player->GetMemoryUsage(client_id);
+      }
+    }
+    return size;
+  }
+
  private:
   void Next(int client_id) {
-    auto& info = client_infos_[client_id];
+    auto& info = *client_infos_[client_id];
     if (info.paused) {
       return;
     }
 
     info.op_index += 1;
-    if (info.op_index == info.data.ops.size()) {
+    if (info.op_index == info.scenario->ops.size()) {
       info.op_index = info.loop_op_index;
     }
     DoNext(client_id);
   }
   void DoNext(int client_id) {
-    boost::asio::post(*config_.ioc,
-                      std::bind(&ScenarioPlayer::OnNext, this, client_id));
+    config_.timer_wheel->Schedule(&client_infos_[client_id]->entry,
+                                  std::chrono::milliseconds(0));
+  }
+  // 現在の op を実行中のまま delay だけ待って、次の op に進む
+  void SleepAndNext(int client_id, std::chrono::milliseconds delay) {
+    auto& info = *client_infos_[client_id];
+    info.sleeping = true;
+    config_.timer_wheel->Schedule(&info.entry, delay);
+  }
+  void OnTimer(int client_id) {
+    auto& info = *client_infos_[client_id];
+    if (info.sleeping) {
+      info.sleeping = false;
+      Next(client_id);
+    } else {
+      OnNext(client_id);
+    }
   }
 
   void OnNext(int client_id) {
-    auto& info = client_infos_[client_id];
+    auto& info = *client_infos_[client_id];
 
-    auto& opv = info.data.ops[info.op_index];
-    switch (opv.which()) {
+    const auto& scenario = *info.scenario;
+    const auto& op = scenario.ops[info.op_index];
+    switch (op.type) {
       case ScenarioData::OP_SLEEP: {
-        auto& op = boost::get<ScenarioData::OpSleep>(opv);
-        auto ms =
-            engine_() % (op.max_time_ms - op.min_time_ms + 1) + op.min_time_ms;
-        info.timer.expires_after(std::chrono::milliseconds(ms));
-        info.timer.async_wait(
-            [this, client_id](const boost::system::error_code& ec) {
-              if (ec == boost::asio::error::operation_aborted) {
-                return;
-              }
-              Next(client_id);
-            });
+        auto ms = Engine() % (op.b - op.a + 1) + op.a;
+        SleepAndNext(client_id, std::chrono::milliseconds(ms));
         return;
       }
       case ScenarioData::OP_PLAY_SUB_SCENARIO: {
-        auto& op = boost::get<ScenarioData::OpPlaySubScenario>(opv);
-        if (sub_scenario_[op.name] == nullptr) {
-          sub_scenario_[op.name] = std::make_shared<ScenarioPlayer>(config_);
+        if (op.a >= sub_scenario_.size()) {
+          sub_scenario_.resize(op.a + 1);
+        }
+        auto& player = sub_scenario_[op.a];
+        if (player == nullptr) {
+          player = std::make_shared<ScenarioPlayer>(config_);
         }
-        sub_scenario_[op.name]->Play(client_id, *op.data, op.loop_op_index);
+        const auto& sub = scenario.subs[op.index];
+        player->Play(client_id, sub.scenario, sub.loop_op_index);
         break;
       }
       case ScenarioData::OP_PLAY_VOICE_NUMBER_CLIENT: {
@@ -171,41 +453,9 @@ class ScenarioPlayer {
         break;
       }
       case ScenarioData::OP_SEND_DATA_CHANNEL_MESSAGE: {
-        auto& op = boost::get<ScenarioData::OpSendDataChannelMessage>(opv);
-        std::string data =
-            config_.binary_pool->Get(op.min_size - 48, op.max_size - 48);
-
-        // 0-5 (6 bytes): ZAKURO
-        // 6-13 (8 bytes): 現在時刻（マイクロ秒単位の UNIX Time）
-        // 14-21 (8 bytes): ラベルごとに一意に増えていくカウンター
-        // 22-47 (26 bytes): Connection ID
-        char buf[48] = "ZAKURO";
-        char* p = buf + 6;
-
-        uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
-                            std::chrono::system_clock::now().time_since_epoch())
-                            .count();
-        for (int i = 0; i < 8; i++) {
-          p[i] = (char)((time >> ((7 - i) * 8)) & 0xff);
-        }
-        p += 8;
-
-        auto& counter = dc_counter_[op.label];
-        for (int i = 0; i < 8; i++) {
-          p[i] = (char)((counter >> ((7 - i) * 8)) & 0xff);
-        }
-        p += 8;
-
-        auto conn_id = (*config_.vcs)[client_id]->GetStats().connection_id;
-        memcpy(p, conn_id.c_str(), std::min<int>(conn_id.size(), 26));
-
-        data.insert(data.begin(), buf, buf + sizeof(buf));
-
-        RTC_LOG(LS_INFO) << "Send DataChannel unixtime(us)=" << time
-                         << " counter=" << counter
-                         << " connection_id=" << conn_id;
-        (*config_.vcs)[client_id]->SendMessage(op.label, data);
-        counter += 1;
+        SendDataChannelMessage(client_id, scenario.symbols->labels[op.label],
+                               op.label, op.a, op.b,
+                               scenario.binary_pools[op.index].get());
         break;
       }
       case ScenarioData::OP_DISCONNECT: {
@@ -220,10 +470,10 @@ class ScenarioPlayer {
         (*config_.vcs)[client_id]->Close([this,
                                           client_id](std::string message) {
           RTC_LOG(LS_INFO) << "Client " << client_id << " exited: " << message;
-          client_infos_[client_id].exit = true;
+          client_infos_[client_id]->exit = true;
           bool all_exited =
               std::all_of(client_infos_.begin(), client_infos_.end(),
-                          [](auto& info) { return info.exit; });
+                          [](auto& info) { return info && info->exit; });
           if (all_exited) {
             config_.ioc->stop();
           }
@@ -231,29 +481,210 @@ class ScenarioPlayer {
 
         break;
       }
+      case ScenarioData::OP_SLEEP_EXPONENTIAL: {
+        auto ms = std::max<int>(
+            op.b,
+            (int)std::exponential_distribution<double>(1.0 / op.a)(Engine()));
+        SleepAndNext(client_id, std::chrono::milliseconds(ms));
+        return;
+      }
+      case ScenarioData::OP_SET_AUDIO_ENABLED: {
+        (*config_.vcs)[client_id]->SetAudioEnabled(op.a != 0);
+        break;
+      }
+      case ScenarioData::OP_SEND_DATA_CHANNEL_TRAFFIC: {
+        auto wait = SendDataChannelTraffic(
+            client_id, *scenario.traffics[op.index],
+            scenario.symbols->labels[op.label], op.label);
+        SleepAndNext(client_id, wait);
+        return;
+      }
+      case ScenarioData::OP_SET_VIDEO_ENABLED: {
+        (*config_.vcs)[client_id]->SetVideoEnabled(op.a != 0);
+        break;
+      }
+      case ScenarioData::OP_SET_VIDEO_ENCODING: {
+        (*config_.vcs)[client_id]->SetVideoEncoding(
+            scenario.video_encodings[op.index]);
+        break;
+      }
+      case ScenarioData::OP_SET_AUDIO_ACTIVE: {
+        (*config_.vcs)[client_id]->SetAudioActive(op.a != 0);
+        break;
+      }
     }
 
     Next(client_id);
   }
 
+  // SendDataChannel に渡した場合は true を返す
+  bool SendDataChannelMessage(int client_id,
+                              const std::string& label,
+                              int label_id,
+                              int min_size,
+                              int max_size,
+                              BinaryPool* binary_pool) {
+    if (binary_pool == nullptr) {
+      binary_pool = config_.binary_pool.get();
+    }
+    auto& vc = (*config_.vcs)[client_id];
+
+    // ヘッダーとペイロードをスレッド毎のバッファに直接書き込む
+    // SendMessage の中でコピーされるので、全てのクライアントで使い回せる
+    // 最大サイズに達した後はメモリ確保しない
+    thread_local std::string data;
+    binary_pool->Fill(data, DataChannelHeader::kSize,
+                      min_size - DataChannelHeader::kSize,
+                      max_size - DataChannelHeader::kSize);
+    uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+    uint64_t counter = vc->NextDataChannelCounter(label_id);
+    const std::string& conn_id = vc->GetConnectionID();
+    DataChannelHeader::Write(data.data(), time, counter, conn_id);
+
+    RTC_LOG(LS_INFO) << "Send DataChannel unixtime(us)=" << time
+                     << " counter=" << counter << " connection_id=" << conn_id;
+    return vc->SendMessage(label, data);
+  }
+
+  // 溜まっているトークンの分だけメッセージを送信して、次に送信できるまでの時間を返す
+  std::chrono::milliseconds SendDataChannelTraffic(int client_id,
+                                                   DataChannelTraffic& t,
+                                                   const std::string& label,
+                                                   int label_id) {
+    // 1 回で送る最大のメッセージ数
+    const int max_messages = 100;
+
+    auto& traffic = client_infos_[client_id]->traffic;
+    if (traffic == nullptr) {
+      traffic.reset(new DataChannelTrafficState());
+    }
+    auto& st = *traffic;
+    auto now = std::chrono::steady_clock::now();
+    if (!st.started) {
+      st.started = true;
+      st.on = true;
+      st.tokens = 0;
+      st.next_size = t.NextSize(Engine());
+      st.last_refilled_at = now;
+      st.phase_started_at = now;
+      st.traffic = &t;
+      int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           now.time_since_epoch())
+                           .count();
+      int64_t expected = 0;
+      t.started_at_ms.compare_exchange_strong(expected, now_ms);
+    }
+
+    // 接続していない間は送信中として数えず、トークンも溜めない
+    if ((*config_.vcs)[client_id]->GetConnectionID().empty()) {
+      DeactivateTraffic(st, now);
+      st.tokens = 0;
+      st.last_refilled_at = now;
+      return std::chrono::milliseconds(100);
+    }
+    if (!st.active) {
+      st.active = true;
+      st.accounted_at = now;
+      t.clients += 1;
+    }
+    AccountTrafficTime(st, now);
+
+    // バースト送信の場合、オンとオフを切り替える
+    if (t.IsBurst()) {
+      while (true) {
+        auto d = std::chrono::milliseconds(st.on ? t.burst_on_ms
+                                                 : t.burst_off_ms);
+        if (now - st.phase_started_at < d) {
+          break;
+        }
+        st.phase_started_at += d;
+        st.on = !st.on;
+        if (st.on) {
+          // オフの間はトークンを溜めない
+          st.tokens = 0;
+          st.last_refilled_at = st.phase_started_at;
+        }
+      }
+      if (!st.on) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            st.phase_started_at + std::chrono::milliseconds(t.burst_off_ms) -
+            now);
+      }
+    }
+
+    // タイマーの遅れで送信できなかった分は取り戻すが、溜めるのは 1 秒分まで
+    double elapsed_ms =
+        std::chrono::duration<double, std::milli>(now - st.last_refilled_at)
+            .count();
+    st.last_refilled_at = now;
+    st.tokens = std::min(st.tokens + elapsed_ms * t.TokensPerMs(),
+                         std::max(t.TokensPerMs() * 1000,
+                                  t.Cost(t.size_max)));
+
+    for (int i = 0; i < max_messages && st.tokens >= t.Cost(st.next_size);
+         i++) {
+      // 送れなかった分を後から取り戻すことはしない
+      if (SendDataChannelMessage(client_id, label, label_id, st.next_size,
+                                 st.next_size, t.binary_pool.get())) {
+        t.messages += 1;
+        t.bytes += st.next_size;
+      }
+      st.tokens -= t.Cost(st.next_size);
+      st.next_size = t.NextSize(Engine());
+    }
+
+    double wait_ms = (t.Cost(st.next_size) - st.tokens) / t.TokensPerMs();
+    return std::chrono::milliseconds(std::max(1, (int)std::ceil(wait_ms)));
+  }
+
+  // 前回から送信中だった時間を client_time_ms に足す
+  static void AccountTrafficTime(DataChannelTrafficState& st,
+                                 std::chrono::steady_clock::time_point now) {
+    auto d = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - st.accounted_at);
+    st.traffic->client_time_ms += d.count();
+    st.accounted_at += d;
+  }
+  // 送信中として数えるのをやめる
+  static void DeactivateTraffic(DataChannelTrafficState& st,
+                                std::chrono::steady_clock::time_point now) {
+    if (!st.active) {
+      return;
+    }
+    AccountTrafficTime(st, now);
+    st.active = false;
+    st.traffic->clients -= 1;
+  }
+
  private:
+  // 乱数の状態はプレイヤー毎には持たず、スレッド毎に 1 つを共有する
+  static std::mt19937& Engine() {
+    thread_local std::mt19937 engine(std::random_device{}());
+    return engine;
+  }
+
   ScenarioPlayerConfig config_;
-  std::mt19937 engine_;
 
   struct ClientInfo {
-    ClientInfo(boost::asio::io_context& ioc) : timer(ioc) {}
-
-    ScenarioData data;
-    int op_index;
-    int loop_op_index;
-    boost::asio::steady_timer timer;
-    bool paused;
-    bool exit;
+    std::shared_ptr<const CompiledScenario> scenario;
+    int op_index = 0;
+    int loop_op_index = 0;
+    TimerWheel::Entry entry;
+    // entry が Sleep の終わりを待っているか
+    bool sleeping = false;
+    bool paused = false;
+    bool exit = false;
+    // OpSendDataChannelTraffic を再生するクライアントだけが持つ
+    std::unique_ptr<DataChannelTrafficState> traffic;
   };
-  std::vector<ClientInfo> client_infos_;
+  // Play するまで nullptr
+  // TimerWheel::Entry のアドレスが変わらないようにポインタで持つ
+  std::vector<std::unique_ptr<ClientInfo>> client_infos_;
   VoiceNumberReader voice_reader_;
-  std::map<std::string, std::shared_ptr<ScenarioPlayer>> sub_scenario_;
-  std::map<std::string, uint64_t> dc_counter_;
+  // サブシナリオ ID 毎のプレイヤー
+  std::vector<std::shared_ptr<ScenarioPlayer>> sub_scenario_;
 };
 
 #endif
@@ -0,0 +1,38 @@
+#include "sora_client_context_pool.h"
+
+SoraClientContextPool::SoraClientContextPool(int size) : size_(size) {}
+
+SoraClientContextPool::Entry SoraClientContextPool::Get(
+    const std::string& key,
+    std::shared_ptr<NopVideoDecoderStats> video_receive_stats,
+    std::shared_ptr<SampledVideoDecoderStats> sampled_decode_stats,
+    const std::function<std::shared_ptr<NetworkShard>()>& create) {
+  // コンテキストの作成には時間がかかるけど、同じ設定で重複して作らないように
+  // ロックしたまま作る
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    return it->second;
+  }
+  Entry entry;
+  for (int i = 0; i < size_; i++) {
+    auto shard = create();
+    if (shard == nullptr) {
+      return {};
+    }
+    entry.shards.push_back(shard);
+  }
+  entry.video_receive_stats = video_receive_stats;
+  entry.sampled_decode_stats = sampled_decode_stats;
+  entries_[key] = entry;
+  return entry;
+}
+
+int SoraClientContextPool::GetContextCount() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  int n = 0;
+  for (const auto& p : entries_) {
+    n += p.second.shards.size();
+  }
+  return n;
+}
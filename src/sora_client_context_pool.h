@@ -0,0 +1,51 @@
+#ifndef SORA_CLIENT_CONTEXT_POOL_H_
+#define SORA_CLIENT_CONTEXT_POOL_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "network_shard.h"
+#include "nop_video_decoder.h"
+#include "sampled_video_decoder.h"
+
+// 設定が同じインスタンス同士で SoraClientContext を共有する
+//
+// SoraClientContext はネットワーク、ワーカー、シグナリングのスレッドと
+// PeerConnectionFactory を持つので、インスタンス毎に作るとインスタンス数に
+// 比例してスレッドが増える。
+// 設定毎に size 個のコンテキストを作り、仮想クライアントをそれらに振り分ける。
+class SoraClientContextPool {
+ public:
+  explicit SoraClientContextPool(int size);
+
+  struct Entry {
+    std::vector<std::shared_ptr<NetworkShard>> shards;
+    // このコンテキストの組で作ったデコーダーが書き込む統計
+    // 共有している全てのインスタンスの受信が入る
+    std::shared_ptr<NopVideoDecoderStats> video_receive_stats;
+    std::shared_ptr<SampledVideoDecoderStats> sampled_decode_stats;
+  };
+
+  // key が同じなら同じコンテキストの組を返す
+  // まだ無ければ create で size 個作り、create が作るデコーダーの統計として
+  // video_receive_stats と sampled_decode_stats を持たせる
+  // 失敗した場合は shards が空になる
+  Entry Get(const std::string& key,
+            std::shared_ptr<NopVideoDecoderStats> video_receive_stats,
+            std::shared_ptr<SampledVideoDecoderStats> sampled_decode_stats,
+            const std::function<std::shared_ptr<NetworkShard>()>& create);
+
+  // 作ったコンテキストの総数
+  int GetContextCount() const;
+
+ private:
+  int size_;
+  std::map<std::string, Entry> entries_;
+  mutable std::mutex mutex_;
+};
+
+#endif
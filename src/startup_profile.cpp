@@ -0,0 +1,91 @@
+#include "startup_profile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+namespace {
+
+double ToMs(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+}  // namespace
+
+StartupProfile::StartupProfile(std::chrono::steady_clock::time_point start,
+                               int instances)
+    : start_(start), instances_(instances), remaining_(instances) {}
+
+void StartupProfile::Add(const std::string& phase,
+                         std::chrono::steady_clock::duration d) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = std::find_if(phases_.begin(), phases_.end(),
+                         [&phase](const Phase& p) { return p.name == phase; });
+  if (it == phases_.end()) {
+    phases_.push_back(Phase{phase});
+    it = phases_.end() - 1;
+  }
+  it->count += 1;
+  it->total += d;
+  it->max = std::max(it->max, d);
+}
+
+StartupProfile::Scope::Scope(std::shared_ptr<StartupProfile> profile,
+                             std::string phase)
+    : profile_(std::move(profile)),
+      phase_(std::move(phase)),
+      start_(std::chrono::steady_clock::now()) {}
+
+StartupProfile::Scope::~Scope() {
+  if (profile_ != nullptr) {
+    profile_->Add(phase_, std::chrono::steady_clock::now() - start_);
+  }
+}
+
+StartupProfile::Instance::Instance(std::shared_ptr<StartupProfile> profile)
+    : profile_(std::move(profile)),
+      start_(std::chrono::steady_clock::now()) {}
+
+StartupProfile::Instance::~Instance() {
+  Ready();
+}
+
+void StartupProfile::Instance::Ready() {
+  if (profile_ == nullptr) {
+    return;
+  }
+  profile_->Add("instance", std::chrono::steady_clock::now() - start_);
+  profile_->SetInstanceReady();
+  profile_ = nullptr;
+}
+
+void StartupProfile::SetInstanceReady() {
+  bool done;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    remaining_ -= 1;
+    done = remaining_ == 0;
+  }
+  if (done) {
+    Print();
+  }
+}
+
+void StartupProfile::Print() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  char buf[256];
+  std::snprintf(buf, sizeof(buf),
+                "startup profile: %d instances ready in %.1f ms\n", instances_,
+                ToMs(std::chrono::steady_clock::now() - start_));
+  std::string s = buf;
+  std::snprintf(buf, sizeof(buf), "  %-20s %8s %12s %12s %12s\n", "phase",
+                "count", "total(ms)", "avg(ms)", "max(ms)");
+  s += buf;
+  for (const auto& p : phases_) {
+    std::snprintf(buf, sizeof(buf), "  %-20s %8d %12.1f %12.2f %12.2f\n",
+                  p.name.c_str(), p.count, ToMs(p.total),
+                  ToMs(p.total) / p.count, ToMs(p.max));
+    s += buf;
+  }
+  std::cout << s << std::flush;
+}
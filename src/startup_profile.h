@@ -0,0 +1,71 @@
+#ifndef STARTUP_PROFILE_H_
+#define STARTUP_PROFILE_H_
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// --startup-profile で起動にかかった時間を段階毎に集計して表示する
+//
+// 設定の読み込みはメインスレッドで、コンテキストの作成や
+// エンコーダーとデコーダーの確認は各インスタンスのスレッドで計る。
+// 全てのインスタンスの準備が終わったら結果を表示する。
+class StartupProfile {
+ public:
+  // start はプロセスを起動した時刻
+  // instances は準備が終わるのを待つインスタンスの数
+  StartupProfile(std::chrono::steady_clock::time_point start, int instances);
+
+  // 複数のスレッドから呼べる
+  void Add(const std::string& phase, std::chrono::steady_clock::duration d);
+
+  // スコープを抜けるまでの時間を phase に足す
+  // profile が nullptr の場合は何もしない
+  class Scope {
+   public:
+    Scope(std::shared_ptr<StartupProfile> profile, std::string phase);
+    ~Scope();
+
+   private:
+    std::shared_ptr<StartupProfile> profile_;
+    std::string phase_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  // インスタンスの準備にかかった時間を instance に足して、
+  // 全てのインスタンスの準備が終わったら結果を表示する
+  // 準備の途中で失敗して Ready を呼ばずに破棄された場合も終わったものとして数える
+  class Instance {
+   public:
+    explicit Instance(std::shared_ptr<StartupProfile> profile);
+    ~Instance();
+    void Ready();
+
+   private:
+    std::shared_ptr<StartupProfile> profile_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  // インスタンスが無い場合に、設定の読み込みだけの結果を表示する
+  void Print();
+
+ private:
+  void SetInstanceReady();
+
+  struct Phase {
+    std::string name;
+    int count = 0;
+    std::chrono::steady_clock::duration total{};
+    std::chrono::steady_clock::duration max{};
+  };
+  std::chrono::steady_clock::time_point start_;
+  int instances_;
+  int remaining_;
+  // 最初に追加された順に表示する
+  std::vector<Phase> phases_;
+  std::mutex mutex_;
+};
+
+#endif
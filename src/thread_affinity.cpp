@@ -0,0 +1,395 @@
+#include "thread_affinity.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+#if defined(__linux__)
+// libnuma に依存しないように定義しておく
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#endif
+
+namespace {
+
+// NUMA ノード番号の上限
+constexpr int kMaxNumaNodes = 1024;
+// CPU 番号の上限
+constexpr int kMaxCpus = 1024;
+
+std::string Trim(const std::string& s) {
+  auto begin = s.find_first_not_of(" \t\n");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  auto end = s.find_last_not_of(" \t\n");
+  return s.substr(begin, end - begin + 1);
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+std::vector<int> GetNumaNodeCpus(int node) {
+  std::vector<int> cpus;
+  std::string list = Trim(ReadFile("/sys/devices/system/node/node" +
+                                   std::to_string(node) + "/cpulist"));
+  ThreadAffinity::ParseCpuList(list, cpus);
+  return cpus;
+}
+
+#if defined(__linux__)
+// 呼び出したスレッドに結び付けた登録を、スレッドの終了時に解除する
+struct Registration {
+  std::shared_ptr<ThreadRegistry> registry;
+  int tid = 0;
+  ~Registration() {
+    if (registry != nullptr) {
+      registry->Unregister(tid);
+    }
+  }
+};
+
+std::vector<int> GetAllowedCpus(int tid) {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(tid, sizeof(set), &set) != 0) {
+    return cpus;
+  }
+  for (int i = 0; i < CPU_SETSIZE; i++) {
+    if (CPU_ISSET(i, &set)) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+// /proc/self/task/<tid>/stat の processor（39 番目の項目）
+int GetLastCpu(int tid) {
+  std::string stat =
+      ReadFile("/proc/self/task/" + std::to_string(tid) + "/stat");
+  // 2 番目の項目のスレッド名に空白や括弧が含まれることがあるので、最後の ) から数える
+  auto pos = stat.rfind(')');
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  std::istringstream iss(stat.substr(pos + 1));
+  std::string field;
+  for (int i = 3; i <= 39; i++) {
+    if (!(iss >> field)) {
+      return -1;
+    }
+  }
+  return std::atoi(field.c_str());
+}
+#endif
+
+}  // namespace
+
+void ThreadRegistry::Register(int tid, int instance, ThreadRole role) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_[tid] = {instance, role};
+}
+
+void ThreadRegistry::Unregister(int tid) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_.erase(tid);
+}
+
+std::vector<ThreadRegistry::Placement> ThreadRegistry::GetPlacements() const {
+  std::vector<Placement> placements;
+#if defined(__linux__)
+  // CPU から NUMA ノードを引けるようにしておく
+  std::map<int, int> cpu_to_node;
+  for (int node = 0; node < kMaxNumaNodes; node++) {
+    auto cpus = GetNumaNodeCpus(node);
+    if (cpus.empty()) {
+      if (access(("/sys/devices/system/node/node" + std::to_string(node))
+                     .c_str(),
+                 F_OK) != 0) {
+        break;
+      }
+      continue;
+    }
+    for (int cpu : cpus) {
+      cpu_to_node[cpu] = node;
+    }
+  }
+
+  std::map<int, Entry> entries;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    entries = entries_;
+  }
+
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    return placements;
+  }
+  while (dirent* ent = readdir(dir)) {
+    if (ent->d_name[0] < '0' || ent->d_name[0] > '9') {
+      continue;
+    }
+    Placement p;
+    p.tid = std::atoi(ent->d_name);
+    p.name = Trim(ReadFile("/proc/self/task/" + std::string(ent->d_name) +
+                           "/comm"));
+    p.instance = -1;
+    if (auto it = entries.find(p.tid); it != entries.end()) {
+      p.instance = it->second.instance;
+      p.role = ThreadAffinity::RoleToString(it->second.role);
+    }
+    p.allowed_cpus = GetAllowedCpus(p.tid);
+    p.cpu = GetLastCpu(p.tid);
+    auto it = cpu_to_node.find(p.cpu);
+    p.numa_node = it == cpu_to_node.end() ? -1 : it->second;
+    placements.push_back(std::move(p));
+  }
+  closedir(dir);
+  std::sort(placements.begin(), placements.end(),
+            [](const Placement& a, const Placement& b) {
+              return a.tid < b.tid;
+            });
+#endif
+  return placements;
+}
+
+std::shared_ptr<ThreadAffinity> ThreadAffinity::Create(
+    const std::string& spec,
+    int numa_node,
+    int instance,
+    std::shared_ptr<ThreadRegistry> registry,
+    std::string& error) {
+  std::shared_ptr<ThreadAffinity> affinity(new ThreadAffinity());
+  affinity->instance_ = instance;
+  affinity->registry_ = registry;
+  if (!ParseSpec(spec, affinity->cpus_, affinity->default_cpus_, error)) {
+    return nullptr;
+  }
+
+  int cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+  auto check = [cpu_count, &error](const std::vector<int>& cpus) {
+    for (int cpu : cpus) {
+      if (cpu >= cpu_count) {
+        error = "cpu " + std::to_string(cpu) + " does not exist (" +
+                std::to_string(cpu_count) + " cpus)";
+        return false;
+      }
+    }
+    return true;
+  };
+  if (!check(affinity->default_cpus_)) {
+    return nullptr;
+  }
+  for (const auto& p : affinity->cpus_) {
+    if (!check(p.second)) {
+      return nullptr;
+    }
+  }
+
+  if (numa_node >= 0) {
+    auto cpus = GetNumaNodeCpus(numa_node);
+    if (cpus.empty()) {
+      error = "numa node " + std::to_string(numa_node) + " does not exist";
+      return nullptr;
+    }
+    affinity->numa_node_ = numa_node;
+    if (affinity->default_cpus_.empty()) {
+      affinity->default_cpus_ = std::move(cpus);
+    }
+  }
+  return affinity;
+}
+
+std::string ThreadAffinity::Validate(const std::string& spec) {
+  std::map<ThreadRole, std::vector<int>> cpus;
+  std::vector<int> default_cpus;
+  std::string error;
+  ParseSpec(spec, cpus, default_cpus, error);
+  return error;
+}
+
+void ThreadAffinity::Apply(ThreadRole role) {
+#if defined(__linux__)
+  int tid = syscall(SYS_gettid);
+  const auto& cpus = GetCpus(role);
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+      CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      RTC_LOG(LS_WARNING) << "sched_setaffinity failed: role="
+                          << RoleToString(role)
+                          << " error=" << std::strerror(errno);
+    }
+  }
+  if (numa_node_ >= 0) {
+    unsigned long mask[kMaxNumaNodes / (8 * sizeof(unsigned long))] = {};
+    mask[numa_node_ / (8 * sizeof(unsigned long))] |=
+        1UL << (numa_node_ % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                sizeof(mask) * 8) != 0) {
+      RTC_LOG(LS_WARNING) << "set_mempolicy failed: role="
+                          << RoleToString(role)
+                          << " error=" << std::strerror(errno);
+    }
+  }
+  if (registry_ != nullptr) {
+    registry_->Register(tid, instance_, role);
+    thread_local Registration registration;
+    registration.registry = registry_;
+    registration.tid = tid;
+  }
+#endif
+}
+
+const char* ThreadAffinity::RoleToString(ThreadRole role) {
+  switch (role) {
+    case ThreadRole::Instance:
+      return "instance";
+    case ThreadRole::Network:
+      return "network";
+    case ThreadRole::Worker:
+      return "worker";
+    case ThreadRole::Signaling:
+      return "signaling";
+    case ThreadRole::Capturer:
+      return "capturer";
+    case ThreadRole::Audio:
+      return "audio";
+  }
+  return "unknown";
+}
+
+bool ThreadAffinity::ParseCpuList(const std::string& str,
+                                  std::vector<int>& cpus) {
+  cpus.clear();
+  std::istringstream iss(str);
+  std::string range;
+  while (std::getline(iss, range, ',')) {
+    range = Trim(range);
+    if (range.empty() ||
+        range.find_first_not_of("0123456789-") != std::string::npos) {
+      return false;
+    }
+    auto dash = range.find('-');
+    std::string first = range.substr(0, dash);
+    std::string last =
+        dash == std::string::npos ? first : range.substr(dash + 1);
+    if (first.empty() || last.empty() ||
+        last.find('-') != std::string::npos || first.size() > 5 ||
+        last.size() > 5) {
+      return false;
+    }
+    int begin = std::stoi(first);
+    int end = std::stoi(last);
+    if (begin > end || end >= kMaxCpus) {
+      return false;
+    }
+    for (int cpu = begin; cpu <= end; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return !cpus.empty();
+}
+
+std::string ThreadAffinity::FormatCpuList(const std::vector<int>& cpus) {
+  std::string s;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      j += 1;
+    }
+    if (!s.empty()) {
+      s += ",";
+    }
+    s += std::to_string(cpus[i]);
+    if (j > i) {
+      s += "-" + std::to_string(cpus[j]);
+    }
+    i = j + 1;
+  }
+  return s;
+}
+
+bool ThreadAffinity::ParseSpec(const std::string& spec,
+                               std::map<ThreadRole, std::vector<int>>& cpus,
+                               std::vector<int>& default_cpus,
+                               std::string& error) {
+  if (Trim(spec).empty()) {
+    return true;
+  }
+  // 役割を指定していなければ全てのスレッドの CPU
+  if (spec.find('=') == std::string::npos) {
+    if (!ParseCpuList(spec, default_cpus)) {
+      error = "invalid cpu list: " + spec;
+      return false;
+    }
+    return true;
+  }
+
+  std::istringstream iss(spec);
+  std::string item;
+  while (std::getline(iss, item, ';')) {
+    if (Trim(item).empty()) {
+      continue;
+    }
+    auto eq = item.find('=');
+    if (eq == std::string::npos) {
+      error = "expected ROLE=CPUS: " + item;
+      return false;
+    }
+    std::string name = Trim(item.substr(0, eq));
+    std::vector<int> list;
+    if (!ParseCpuList(item.substr(eq + 1), list)) {
+      error = "invalid cpu list: " + item;
+      return false;
+    }
+    if (name == "*") {
+      default_cpus = std::move(list);
+      continue;
+    }
+    bool found = false;
+    for (auto role : {ThreadRole::Instance, ThreadRole::Network,
+                      ThreadRole::Worker, ThreadRole::Signaling,
+                      ThreadRole::Capturer, ThreadRole::Audio}) {
+      if (name == RoleToString(role)) {
+        cpus[role] = list;
+        found = true;
+      }
+    }
+    if (!found) {
+      error = "unknown thread role: " + name +
+              " (instance, network, worker, signaling, capturer, audio or *)";
+      return false;
+    }
+  }
+  return true;
+}
+
+const std::vector<int>& ThreadAffinity::GetCpus(ThreadRole role) const {
+  auto it = cpus_.find(role);
+  return it != cpus_.end() ? it->second : default_cpus_;
+}
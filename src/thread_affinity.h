@@ -0,0 +1,100 @@
+#ifndef THREAD_AFFINITY_H_
+#define THREAD_AFFINITY_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// スレッドの役割
+enum class ThreadRole {
+  // Zakuro::Run を実行するインスタンスのスレッド
+  Instance,
+  Network,
+  Worker,
+  Signaling,
+  // 擬似映像を生成するスレッド
+  Capturer,
+  // 擬似音声を生成するスレッド
+  Audio,
+};
+
+// どのスレッドがどのインスタンスのどの役割かを覚えておき、
+// 実際に動いている CPU と合わせて RPC で返す
+class ThreadRegistry {
+ public:
+  void Register(int tid, int instance, ThreadRole role);
+  void Unregister(int tid);
+
+  struct Placement {
+    int tid;
+    std::string name;
+    // 登録されていないスレッドは instance が -1 で role が空になる
+    int instance;
+    std::string role;
+    // 動かせる CPU と、最後に動いていた CPU とその NUMA ノード
+    std::vector<int> allowed_cpus;
+    int cpu;
+    int numa_node;
+  };
+  // このプロセスの全てのスレッドの配置
+  // Linux 以外では空を返す
+  std::vector<Placement> GetPlacements() const;
+
+ private:
+  struct Entry {
+    int instance;
+    ThreadRole role;
+  };
+  std::map<int, Entry> entries_;
+  mutable std::mutex mutex_;
+};
+
+// インスタンスのスレッドを動かす CPU とメモリを確保する NUMA ノード
+//
+// --cpu-affinity は "0-3,8" のように全てのスレッドの CPU を指定するか、
+// "network=0-3;worker=4-5;*=6-15" のように役割毎に指定する。
+// --numa-node を指定すると、CPU を指定していない役割のスレッドを
+// その NUMA ノードの CPU で動かし、メモリもそのノードから優先して確保する。
+//
+// スレッドを作ったスレッドの設定は新しいスレッドに引き継がれるので、
+// インスタンスのスレッドに設定すれば WebRTC のスレッドも同じ CPU で動く。
+class ThreadAffinity {
+ public:
+  // 失敗した場合は error にメッセージを入れて nullptr を返す
+  static std::shared_ptr<ThreadAffinity> Create(
+      const std::string& spec,
+      int numa_node,
+      int instance,
+      std::shared_ptr<ThreadRegistry> registry,
+      std::string& error);
+  // spec の書式を確認して、正しくない場合はメッセージを返す
+  static std::string Validate(const std::string& spec);
+
+  // 呼び出したスレッドを role の CPU で動かし、レジストリに登録する
+  // 登録はスレッドが終了する時に解除する
+  void Apply(ThreadRole role);
+
+  static const char* RoleToString(ThreadRole role);
+  // "0-3,8" の形式
+  static bool ParseCpuList(const std::string& str, std::vector<int>& cpus);
+  static std::string FormatCpuList(const std::vector<int>& cpus);
+
+ private:
+  ThreadAffinity() = default;
+  static bool ParseSpec(const std::string& spec,
+                        std::map<ThreadRole, std::vector<int>>& cpus,
+                        std::vector<int>& default_cpus,
+                        std::string& error);
+  const std::vector<int>& GetCpus(ThreadRole role) const;
+
+  int instance_ = 0;
+  int numa_node_ = -1;
+  std::map<ThreadRole, std::vector<int>> cpus_;
+  // 役割毎に指定していないスレッドの CPU
+  std::vector<int> default_cpus_;
+  std::shared_ptr<ThreadRegistry> registry_;
+};
+
+#endif
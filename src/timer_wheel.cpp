@@ -0,0 +1,187 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+// Boost
+#include <boost/asio/post.hpp>
+
+TimerWheel::Entry::~Entry() {
+  // リストの番兵はタイマーホイールにスケジュールされないので、外すだけ
+  if (wheel_ != nullptr) {
+    wheel_->Cancel(this);
+  } else {
+    Unlink();
+  }
+}
+
+void TimerWheel::Entry::Unlink() {
+  if (next_ == nullptr) {
+    return;
+  }
+  prev_->next_ = next_;
+  next_->prev_ = prev_;
+  prev_ = nullptr;
+  next_ = nullptr;
+}
+
+void TimerWheel::List::Splice(List& other) {
+  if (other.Empty()) {
+    return;
+  }
+  Entry* first = other.head.next_;
+  Entry* last = other.head.prev_;
+  first->prev_ = head.prev_;
+  last->next_ = &head;
+  head.prev_->next_ = first;
+  head.prev_ = last;
+  other.head.prev_ = &other.head;
+  other.head.next_ = &other.head;
+}
+
+TimerWheel::TimerWheel(boost::asio::io_context& ioc)
+    : ioc_(ioc),
+      timer_(ioc),
+      started_at_(std::chrono::steady_clock::now()) {}
+
+void TimerWheel::Schedule(Entry* entry, std::chrono::milliseconds delay) {
+  Cancel(entry);
+  entry->wheel_ = this;
+  if (delay.count() <= 0) {
+    ready_.PushBack(entry);
+    if (!ready_posted_) {
+      ready_posted_ = true;
+      boost::asio::post(ioc_, [this]() { RunReady(); });
+    }
+    return;
+  }
+
+  // 何も待っていない間は時間を進めていないので、ここで追いつかせる
+  const uint64_t now = NowTick();
+  if (count_ == 0) {
+    current_tick_ = now;
+  }
+  entry->expire_tick_ = std::max(current_tick_, now) + delay.count();
+  Insert(entry);
+  count_ += 1;
+  Arm();
+}
+
+void TimerWheel::Cancel(Entry* entry) {
+  if (!entry->IsScheduled()) {
+    return;
+  }
+  // ready キューに入っているエントリは count_ に含めていない
+  if (entry->expire_tick_ != 0) {
+    count_ -= 1;
+  }
+  entry->Unlink();
+  entry->expire_tick_ = 0;
+}
+
+uint64_t TimerWheel::NowTick() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - started_at_)
+      .count();
+}
+
+void TimerWheel::Insert(Entry* entry) {
+  const uint64_t diff =
+      std::max<uint64_t>(1, entry->expire_tick_ - current_tick_);
+  for (int level = 0; level < kLevels; level++) {
+    if (diff < (1ULL << (kSlotBits * (level + 1))) || level == kLevels - 1) {
+      // 最上段より遠い場合は最上段の 1 周先に入れておき、
+      // カスケードする時に残りの時間で入れ直す
+      uint64_t tick = std::min<uint64_t>(
+          entry->expire_tick_,
+          current_tick_ + (1ULL << (kSlotBits * kLevels)) - 1);
+      int slot = (tick >> (kSlotBits * level)) & kSlotMask;
+      wheels_[level][slot].PushBack(entry);
+      return;
+    }
+  }
+}
+
+void TimerWheel::Cascade(int level) {
+  int slot = (current_tick_ >> (kSlotBits * level)) & kSlotMask;
+  List list;
+  list.Splice(wheels_[level][slot]);
+  while (!list.Empty()) {
+    Entry* e = list.head.next_;
+    e->Unlink();
+    Insert(e);
+  }
+}
+
+void TimerWheel::Advance(uint64_t now) {
+  while (current_tick_ < now && count_ > 0) {
+    current_tick_ += 1;
+    // 下の段が 1 周したら上の段のスロットを下の段に振り分ける
+    for (int level = 1; level < kLevels; level++) {
+      if ((current_tick_ & ((1ULL << (kSlotBits * level)) - 1)) != 0) {
+        break;
+      }
+      Cascade(level);
+    }
+    auto& slot = wheels_[0][current_tick_ & kSlotMask];
+    while (!slot.Empty()) {
+      Entry* e = slot.head.next_;
+      e->Unlink();
+      count_ -= 1;
+      if (e->expire_tick_ > current_tick_) {
+        // 最上段より遠かったエントリ
+        Insert(e);
+        count_ += 1;
+        continue;
+      }
+      e->expire_tick_ = 0;
+      ready_.PushBack(e);
+    }
+  }
+  if (count_ == 0) {
+    current_tick_ = now;
+  }
+}
+
+void TimerWheel::RunReady() {
+  ready_posted_ = false;
+  // コールバックの中で ready キューに追加されたエントリは次回に回す
+  List list;
+  list.Splice(ready_);
+  while (!list.Empty()) {
+    Entry* e = list.head.next_;
+    e->Unlink();
+    e->callback();
+  }
+}
+
+void TimerWheel::Arm() {
+  if (count_ == 0) {
+    return;
+  }
+  // 最下段で次にエントリがあるスロットまで待つ
+  // 最下段に無ければ、最下段が 1 周してカスケードする時まで待つ
+  uint64_t next = (current_tick_ | kSlotMask) + 1;
+  for (uint64_t t = current_tick_ + 1; t < next; t++) {
+    if (!wheels_[0][t & kSlotMask].Empty()) {
+      next = t;
+      break;
+    }
+  }
+  if (armed_tick_ != 0 && armed_tick_ <= next) {
+    return;
+  }
+  armed_tick_ = next;
+  timer_.expires_at(started_at_ + std::chrono::milliseconds(next));
+  timer_.async_wait(
+      [this](const boost::system::error_code& ec) { OnTimer(ec); });
+}
+
+void TimerWheel::OnTimer(const boost::system::error_code& ec) {
+  if (ec == boost::asio::error::operation_aborted) {
+    return;
+  }
+  armed_tick_ = 0;
+  Advance(NowTick());
+  RunReady();
+  Arm();
+}
@@ -0,0 +1,101 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+// Boost
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+// 多数のクライアントのタイマーを 1 つの Asio タイマーで駆動する階層型タイマーホイール
+//
+// 1 ミリ秒を 1 tick として、64 スロットのホイールを 4 段持っている。
+// エントリは呼び出し側が持つ侵入型リストなので、スケジュールしても
+// メモリ確保は発生しない。
+// 遅延 0 でスケジュールしたエントリは ready キューに入り、
+// 次に io_context が処理する時にまとめて呼び出される。
+// 全て io_context のスレッドから呼ぶこと。
+class TimerWheel {
+ public:
+  class Entry {
+   public:
+    Entry() = default;
+    Entry(const Entry&) = delete;
+    Entry& operator=(const Entry&) = delete;
+    // スケジュールされたまま破棄した場合はキャンセルする
+    ~Entry();
+
+    // 期限が来た時に呼ばれる関数
+    // スケジュールする度に設定するとメモリ確保が発生するので、最初に 1 回だけ設定する
+    std::function<void()> callback;
+
+    bool IsScheduled() const { return next_ != nullptr; }
+
+   private:
+    friend class TimerWheel;
+    void Unlink();
+
+    // 最後にスケジュールしたタイマーホイール
+    TimerWheel* wheel_ = nullptr;
+    Entry* prev_ = nullptr;
+    Entry* next_ = nullptr;
+    uint64_t expire_tick_ = 0;
+  };
+
+  explicit TimerWheel(boost::asio::io_context& ioc);
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // 既にスケジュールされている場合は一旦キャンセルしてからスケジュールし直す
+  void Schedule(Entry* entry, std::chrono::milliseconds delay);
+  void Cancel(Entry* entry);
+
+ private:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 6;
+  static constexpr int kSlots = 1 << kSlotBits;
+  static constexpr uint64_t kSlotMask = kSlots - 1;
+
+  // 循環リストの番兵
+  struct List {
+    List() {
+      head.prev_ = &head;
+      head.next_ = &head;
+    }
+    bool Empty() const { return head.next_ == &head; }
+    void PushBack(Entry* e) {
+      e->prev_ = head.prev_;
+      e->next_ = &head;
+      head.prev_->next_ = e;
+      head.prev_ = e;
+    }
+    // other の要素を全てこのリストに移す
+    void Splice(List& other);
+
+    Entry head;
+  };
+
+  uint64_t NowTick() const;
+  void Insert(Entry* entry);
+  void Advance(uint64_t now);
+  void Cascade(int level);
+  void RunReady();
+  void Arm();
+  void OnTimer(const boost::system::error_code& ec);
+
+  boost::asio::io_context& ioc_;
+  boost::asio::steady_timer timer_;
+  std::chrono::steady_clock::time_point started_at_;
+  uint64_t current_tick_ = 0;
+  size_t count_ = 0;
+  std::array<std::array<List, kSlots>, kLevels> wheels_;
+  List ready_;
+  bool ready_posted_ = false;
+  // 現在 Asio タイマーを待っている tick（待っていなければ 0）
+  uint64_t armed_tick_ = 0;
+};
+
+#endif
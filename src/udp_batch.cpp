@@ -0,0 +1,337 @@
+#include "udp_batch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <netinet/in.h>
+
+#if defined(__linux__)
+#include <netinet/udp.h>
+#endif
+
+#if defined(__linux__)
+// 古いヘッダには無いので定義しておく
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+namespace {
+
+// 受信バッファのサイズ。GRO で結合されたパケットも入るようにする
+constexpr size_t kReceiveBufferSize = 65535;
+
+#if defined(__linux__)
+// GSO で 1 つのメッセージにまとめられるセグメント数とサイズの上限
+constexpr int kMaxGsoSegments = 64;
+constexpr size_t kMaxGsoBytes = 65000;
+
+bool IsSameAddress(const UdpDatagram& a, const UdpDatagram& b) {
+  return a.addr_len == b.addr_len &&
+         std::memcmp(&a.addr, &b.addr, a.addr_len) == 0;
+}
+#endif
+
+void Assign(UdpDatagram& d,
+            const void* data,
+            size_t size,
+            const sockaddr* addr,
+            socklen_t addr_len) {
+  d.addr_len = std::min<socklen_t>(addr_len, sizeof(d.addr));
+  std::memcpy(&d.addr, addr, d.addr_len);
+  d.data.assign((const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+}  // namespace
+
+void UdpBatchSender::Add(const void* data,
+                         size_t size,
+                         const sockaddr* addr,
+                         socklen_t addr_len) {
+  if (free_.empty()) {
+    pending_.emplace_back();
+  } else {
+    pending_.push_back(std::move(free_.back()));
+    free_.pop_back();
+  }
+  Assign(pending_.back(), data, size, addr, addr_len);
+}
+
+UdpBatchSender::Result UdpBatchSender::Flush() {
+  Result result;
+#if defined(__linux__)
+  auto& messages = messages_;
+  messages.clear();
+  size_t i = 0;
+  while (i < pending_.size()) {
+    Message m{i, i + 1, 0};
+    if (gso_) {
+      // 宛先とサイズが同じパケットを 1 つのメッセージにまとめる
+      // 最後のセグメントだけは小さくても良い
+      size_t size = pending_[i].data.size();
+      size_t total = size;
+      while (m.end < pending_.size() &&
+             m.end - m.begin < kMaxGsoSegments &&
+             IsSameAddress(pending_[i], pending_[m.end]) &&
+             pending_[m.end].data.size() <= size &&
+             total + pending_[m.end].data.size() <= kMaxGsoBytes) {
+        total += pending_[m.end].data.size();
+        bool last = pending_[m.end].data.size() < size;
+        m.end += 1;
+        if (last) {
+          break;
+        }
+      }
+      if (m.end - m.begin > 1) {
+        m.segment_size = size;
+      }
+    }
+    messages.push_back(m);
+    i = m.end;
+  }
+
+  auto& iovs = iovs_;
+  auto& msgs = msgs_;
+  auto& controls = controls_;
+  iovs.resize(pending_.size());
+  msgs.resize(messages.size());
+  controls.resize(messages.size() * CMSG_SPACE(sizeof(uint16_t)));
+  for (size_t n = 0; n < messages.size(); n++) {
+    const auto& m = messages[n];
+    for (size_t k = m.begin; k < m.end; k++) {
+      iovs[k].iov_base = pending_[k].data.data();
+      iovs[k].iov_len = pending_[k].data.size();
+    }
+    msghdr& h = msgs[n].msg_hdr;
+    std::memset(&h, 0, sizeof(h));
+    h.msg_name = &pending_[m.begin].addr;
+    h.msg_namelen = pending_[m.begin].addr_len;
+    h.msg_iov = &iovs[m.begin];
+    h.msg_iovlen = m.end - m.begin;
+    if (m.segment_size != 0) {
+      char* control = &controls[n * CMSG_SPACE(sizeof(uint16_t))];
+      h.msg_control = control;
+      h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+      cmsghdr* cm = CMSG_FIRSTHDR(&h);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      std::memcpy(CMSG_DATA(cm), &m.segment_size, sizeof(uint16_t));
+    }
+  }
+
+  size_t n = 0;
+  while (n < msgs.size()) {
+    int count = std::min<size_t>(msgs.size() - n, kMaxBatch);
+    int r = sendmmsg(fd_, &msgs[n], count, MSG_DONTWAIT);
+    result.syscalls += 1;
+    if (r > 0) {
+      for (int k = 0; k < r; k++) {
+        result.sent += messages[n + k].end - messages[n + k].begin;
+      }
+      n += r;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+      // 送信バッファが一杯なので、残りは全て捨てる
+      for (; n < msgs.size(); n++) {
+        result.dropped += messages[n].end - messages[n].begin;
+      }
+      break;
+    }
+    if (messages[n].segment_size != 0 &&
+        (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+      // カーネルかネットワークデバイスが GSO に対応していないので、
+      // まだ送っていないパケットを GSO 無しで送り直す
+      gso_ = false;
+      size_t begin = messages[n].begin;
+      for (size_t k = 0; k < begin; k++) {
+        free_.push_back(std::move(pending_[k]));
+      }
+      pending_.erase(pending_.begin(), pending_.begin() + begin);
+      Result rest = Flush();
+      result.syscalls += rest.syscalls;
+      result.sent += rest.sent;
+      result.dropped += rest.dropped;
+      return result;
+    }
+    // 宛先に届かないなど、このメッセージだけのエラーなので捨てて次に進む
+    result.dropped += messages[n].end - messages[n].begin;
+    n += 1;
+  }
+#else
+  for (const auto& d : pending_) {
+    int r = sendto(fd_, d.data.data(), d.data.size(), 0,
+                   (const sockaddr*)&d.addr, d.addr_len);
+    result.syscalls += 1;
+    if (r >= 0) {
+      result.sent += 1;
+    } else {
+      result.dropped += 1;
+    }
+  }
+#endif
+  for (auto& d : pending_) {
+    free_.push_back(std::move(d));
+  }
+  pending_.clear();
+  return result;
+}
+
+// スレッド毎の受信バッファ
+struct UdpReceiveArena {
+  std::vector<uint8_t> buffer;
+  // 受信バッファを指しているパケットを持つ UdpBatchReceiver
+  UdpBatchReceiver* owner = nullptr;
+};
+
+UdpBatchReceiver::~UdpBatchReceiver() {
+  if (arena_ != nullptr) {
+    arena_->owner = nullptr;
+  }
+}
+
+bool UdpBatchReceiver::EnableGro() {
+#if defined(__linux__)
+  int on = 1;
+  gro_ = setsockopt(fd_, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+#endif
+  return gro_;
+}
+
+int UdpBatchReceiver::Receive() {
+  thread_local UdpReceiveArena arena;
+  // 受信バッファを上書きする前に、まだ読まれていないパケットを逃がす
+  if (arena.owner != nullptr) {
+    arena.owner->Detach();
+  }
+  if (arena.buffer.empty()) {
+    arena.buffer.resize(kMaxBatch * kReceiveBufferSize);
+  }
+  std::vector<uint8_t>& buffer = arena.buffer;
+  int received = 0;
+#if defined(__linux__)
+  constexpr size_t kControlSize = CMSG_SPACE(sizeof(int));
+  char controls[kMaxBatch * kControlSize];
+  iovec iovs[kMaxBatch];
+  mmsghdr msgs[kMaxBatch];
+  sockaddr_storage addrs[kMaxBatch];
+  std::memset(msgs, 0, sizeof(msgs));
+  for (int i = 0; i < kMaxBatch; i++) {
+    iovs[i].iov_base = &buffer[i * kReceiveBufferSize];
+    iovs[i].iov_len = kReceiveBufferSize;
+    msghdr& h = msgs[i].msg_hdr;
+    h.msg_name = &addrs[i];
+    h.msg_namelen = sizeof(addrs[i]);
+    h.msg_iov = &iovs[i];
+    h.msg_iovlen = 1;
+    h.msg_control = &controls[i * kControlSize];
+    h.msg_controllen = kControlSize;
+  }
+  int r;
+  do {
+    r = recvmmsg(fd_, msgs, kMaxBatch, MSG_DONTWAIT, nullptr);
+  } while (r < 0 && errno == EINTR);
+  for (int i = 0; i < r; i++) {
+    const msghdr& h = msgs[i].msg_hdr;
+    if (h.msg_flags & MSG_TRUNC) {
+      continue;
+    }
+    size_t size = msgs[i].msg_len;
+    // GRO で結合されている場合はセグメントのサイズで分割する
+    size_t segment_size = size;
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&h); cm != nullptr;
+         cm = CMSG_NXTHDR(const_cast<msghdr*>(&h), cm)) {
+      if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+        int gso_size;
+        std::memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+        if (gso_size > 0) {
+          segment_size = gso_size;
+        }
+      }
+    }
+    const uint8_t* p = &buffer[i * kReceiveBufferSize];
+    for (size_t offset = 0; offset < size; offset += segment_size) {
+      auto& packet = Push((const sockaddr*)&addrs[i], h.msg_namelen);
+      packet.data = p + offset;
+      packet.size = std::min(segment_size, size - offset);
+      received += 1;
+    }
+  }
+#else
+  sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  int r = recvfrom(fd_, buffer.data(), kReceiveBufferSize, 0,
+                   (sockaddr*)&addr, &addr_len);
+  if (r >= 0) {
+    auto& packet = Push((const sockaddr*)&addr, addr_len);
+    packet.data = buffer.data();
+    packet.size = r;
+    received += 1;
+  }
+#endif
+  if (received > 0) {
+    arena.owner = this;
+    arena_ = &arena;
+  }
+  return received;
+}
+
+int UdpBatchReceiver::Pop(void* data,
+                          size_t size,
+                          sockaddr_storage* addr,
+                          socklen_t* addr_len) {
+  if (queue_.empty()) {
+    return -1;
+  }
+  auto& packet = queue_.front();
+  size_t n = std::min(size, packet.size);
+  std::memcpy(data, packet.data, n);
+  if (addr != nullptr) {
+    std::memcpy(addr, &packet.addr, packet.addr_len);
+  }
+  if (addr_len != nullptr) {
+    *addr_len = packet.addr_len;
+  }
+  free_.push_back(std::move(packet));
+  queue_.pop_front();
+  return n;
+}
+
+void UdpBatchReceiver::Detach() {
+  if (arena_ == nullptr) {
+    return;
+  }
+  for (auto& packet : queue_) {
+    if (packet.data != packet.storage.data()) {
+      packet.storage.assign(packet.data, packet.data + packet.size);
+      packet.data = packet.storage.data();
+    }
+  }
+  arena_->owner = nullptr;
+  arena_ = nullptr;
+}
+
+UdpReceivedPacket& UdpBatchReceiver::Push(const sockaddr* addr,
+                                          socklen_t addr_len) {
+  if (free_.empty()) {
+    queue_.emplace_back();
+  } else {
+    queue_.push_back(std::move(free_.back()));
+    free_.pop_back();
+  }
+  auto& packet = queue_.back();
+  packet.addr_len = std::min<socklen_t>(addr_len, sizeof(packet.addr));
+  std::memcpy(&packet.addr, addr, packet.addr_len);
+  return packet;
+}
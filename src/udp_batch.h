@@ -0,0 +1,124 @@
+#ifndef UDP_BATCH_H_
+#define UDP_BATCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// 複数の UDP パケットを 1 回のシステムコールで送受信する
+//
+// 送信は sendmmsg でまとめ、宛先とサイズが同じパケットが続く場合は
+// UDP GSO (UDP_SEGMENT) で 1 つのメッセージにする。
+// 受信は recvmmsg でまとめ、UDP GRO で結合されたパケットは分割して返す。
+// sendmmsg/recvmmsg と GSO/GRO は Linux でのみ使える。
+// 他の環境では 1 パケットずつ sendto/recvfrom する。
+
+struct UdpDatagram {
+  sockaddr_storage addr;
+  socklen_t addr_len = 0;
+  std::vector<uint8_t> data;
+};
+
+// 受信したパケット
+// data は受信バッファか storage を指す
+struct UdpReceivedPacket {
+  sockaddr_storage addr;
+  socklen_t addr_len = 0;
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  std::vector<uint8_t> storage;
+};
+
+class UdpBatchSender {
+ public:
+  // 1 回の Flush で送る最大のパケット数
+  static constexpr int kMaxBatch = 64;
+
+  explicit UdpBatchSender(int fd) : fd_(fd) {}
+
+  // GSO を使う。カーネルが対応していない場合は最初の送信で無効にする
+  void EnableGso() { gso_ = true; }
+  bool IsGsoEnabled() const { return gso_; }
+
+  void Add(const void* data,
+           size_t size,
+           const sockaddr* addr,
+           socklen_t addr_len);
+  size_t GetPendingCount() const { return pending_.size(); }
+
+  struct Result {
+    int syscalls = 0;
+    int sent = 0;
+    // 送信バッファが一杯だったり、エラーで送れずに捨てたパケット数
+    int dropped = 0;
+  };
+  // 溜まっているパケットを全て送る
+  Result Flush();
+
+ private:
+  // sendmmsg の 1 メッセージにする pending_ の範囲
+  struct Message {
+    size_t begin;
+    size_t end;
+    uint16_t segment_size;
+  };
+
+  int fd_;
+  bool gso_ = false;
+  std::vector<UdpDatagram> pending_;
+  // 送った後のバッファを使い回す
+  std::vector<UdpDatagram> free_;
+#if defined(__linux__)
+  // Flush 毎に確保しないように使い回す
+  std::vector<Message> messages_;
+  std::vector<iovec> iovs_;
+  std::vector<mmsghdr> msgs_;
+  std::vector<char> controls_;
+#endif
+};
+
+struct UdpReceiveArena;
+
+class UdpBatchReceiver {
+ public:
+  // 1 回の Receive で受信する最大のメッセージ数
+  static constexpr int kMaxBatch = 32;
+
+  explicit UdpBatchReceiver(int fd) : fd_(fd) {}
+  ~UdpBatchReceiver();
+
+  // GRO を有効にする。カーネルが対応していなければ false を返す
+  bool EnableGro();
+
+  // 受信できるだけ受信してキューに入れ、受信したパケット数を返す
+  // 受信するものが無い場合やエラーの場合は 0 を返す
+  //
+  // 受信バッファは大きいので同じスレッドの全ての UdpBatchReceiver で共有し、
+  // キューのパケットは受信バッファを直接指す。他の UdpBatchReceiver が
+  // Receive する時に、まだ読まれていないパケットだけを storage にコピーする。
+  int Receive();
+
+  bool IsEmpty() const { return queue_.empty(); }
+  size_t GetQueuedCount() const { return queue_.size(); }
+  // キューの先頭のパケットを data にコピーし、サイズを返す
+  // data に入りきらない分は捨てる。キューが空の場合は -1 を返す
+  int Pop(void* data, size_t size, sockaddr_storage* addr, socklen_t* addr_len);
+
+ private:
+  // 受信バッファを指しているパケットを storage にコピーする
+  void Detach();
+  UdpReceivedPacket& Push(const sockaddr* addr, socklen_t addr_len);
+
+  int fd_;
+  bool gro_ = false;
+  std::deque<UdpReceivedPacket> queue_;
+  std::vector<UdpReceivedPacket> free_;
+  // queue_ が指している受信バッファ。指していない場合は nullptr
+  UdpReceiveArena* arena_ = nullptr;
+};
+
+#endif
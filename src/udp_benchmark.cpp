@@ -0,0 +1,193 @@
+#include "udp_benchmark.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <time.h>
+
+// WebRTC
+#include <rtc_base/async_socket.h>
+#include <rtc_base/socket_address.h>
+#include <rtc_base/thread.h>
+
+#include "network_shard.h"
+
+namespace {
+
+// 1 回のタスクで送信するパケット数
+// 映像の 1 フレームを何パケットかに分けて送るのと同じくらいにする
+constexpr int kPacketsPerTask = 10;
+
+double GetThreadCpuSec() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// AsyncUDPSocket と同じく、読み込みイベント毎に 1 パケットずつ読む
+class ReceivingSocket : public webrtc::AsyncSocketAdapter {
+ public:
+  explicit ReceivingSocket(webrtc::Socket* socket)
+      : webrtc::AsyncSocketAdapter(socket), buffer_(65535) {}
+
+ protected:
+  void OnReadEvent(webrtc::Socket* socket) override {
+    webrtc::SocketAddress addr;
+    int64_t timestamp;
+    RecvFrom(buffer_.data(), buffer_.size(), &addr, &timestamp);
+  }
+
+ private:
+  std::vector<uint8_t> buffer_;
+};
+
+// ネットワークスレッドと、NetworkShard と同じソケットファクトリで作ったソケット
+struct Endpoint {
+  std::unique_ptr<webrtc::Thread> thread;
+  std::shared_ptr<NetworkShard::Counters> counters;
+  std::unique_ptr<webrtc::SocketFactory> factory;
+  std::unique_ptr<webrtc::Socket> socket;
+
+  bool Start(bool udp_batching, bool receiving) {
+    thread = webrtc::Thread::CreateWithSocketServer();
+    thread->Start();
+    counters = std::make_shared<NetworkShard::Counters>();
+    return thread->BlockingCall([&]() {
+      factory = NetworkShard::CreateSocketFactory(thread->socketserver(),
+                                                  counters, udp_batching);
+      std::unique_ptr<webrtc::Socket> s(
+          factory->CreateSocket(AF_INET, SOCK_DGRAM));
+      if (s == nullptr ||
+          s->Bind(webrtc::SocketAddress("127.0.0.1", 0)) != 0) {
+        return false;
+      }
+      s->SetOption(webrtc::Socket::OPT_RCVBUF, 8 * 1024 * 1024);
+      s->SetOption(webrtc::Socket::OPT_SNDBUF, 8 * 1024 * 1024);
+      if (receiving) {
+        socket.reset(new ReceivingSocket(s.release()));
+      } else {
+        socket = std::move(s);
+      }
+      return true;
+    });
+  }
+
+  void Stop() {
+    thread->BlockingCall([&]() {
+      socket.reset();
+      factory.reset();
+    });
+    thread->Stop();
+    thread.reset();
+  }
+
+  double GetCpuSec() { return thread->BlockingCall(GetThreadCpuSec); }
+};
+
+struct Result {
+  uint64_t packets = 0;
+  // 受信側は数えていないので 0
+  uint64_t syscalls = 0;
+  // 送信側は送れずに捨てたパケット数
+  // 受信側は送信できたのに受信できなかったパケット数
+  uint64_t dropped = 0;
+  double cpu_sec = 0;
+};
+
+// total は dropped の割合を計算するためのパケット数
+void Print(const char* name, const Result& r, double seconds, uint64_t total) {
+  double pps = r.packets / seconds;
+  double pps_per_core = r.cpu_sec == 0 ? 0 : r.packets / r.cpu_sec;
+  double dropped_rate = total == 0 ? 0 : 100.0 * r.dropped / total;
+  char per_syscall[32] = "-";
+  if (r.syscalls != 0) {
+    std::snprintf(per_syscall, sizeof(per_syscall), "%.1f",
+                  (double)r.packets / r.syscalls);
+  }
+  char line[256];
+  std::snprintf(line, sizeof(line),
+                "  %-8s packets=%-10llu pps=%-10.0f pps/core=%-10.0f "
+                "packets/syscall=%-6s cpu=%.2fs dropped=%llu (%.1f%%)",
+                name, (unsigned long long)r.packets, pps, pps_per_core,
+                per_syscall, r.cpu_sec, (unsigned long long)r.dropped,
+                dropped_rate);
+  std::cout << line << std::endl;
+}
+
+}  // namespace
+
+int RunUdpSocketBenchmark(double seconds, int packet_size) {
+  std::cout << "UDP socket benchmark: loopback, " << packet_size
+            << " bytes/packet, " << kPacketsPerTask << " packets/task, "
+            << seconds << " seconds per mode" << std::endl;
+
+  const std::pair<bool, const char*> modes[] = {
+      {false, "default (PhysicalSocketServer)"},
+      {true, "batching (--udp-batching)"},
+  };
+  for (const auto& [udp_batching, name] : modes) {
+    Endpoint receiver;
+    Endpoint sender;
+    if (!receiver.Start(udp_batching, true) ||
+        !sender.Start(udp_batching, false)) {
+      std::cerr << "failed to create socket" << std::endl;
+      return 1;
+    }
+    webrtc::SocketAddress to = receiver.thread->BlockingCall(
+        [&]() { return receiver.socket->GetLocalAddress(); });
+
+    double receiver_cpu = receiver.GetCpuSec();
+    double sender_cpu = sender.GetCpuSec();
+    std::vector<uint8_t> packet(packet_size, 0xab);
+    uint64_t attempts = 0;
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds((int64_t)(seconds * 1000));
+    // ネットワークスレッドと同じく、タスク毎に何パケットか送る
+    std::promise<void> done;
+    std::function<void()> send = [&]() {
+      for (int i = 0; i < kPacketsPerTask; i++) {
+        sender.socket->SendTo(packet.data(), packet.size(), to);
+        attempts += 1;
+      }
+      if (std::chrono::steady_clock::now() < deadline) {
+        sender.thread->PostTask([&]() { send(); });
+      } else {
+        done.set_value();
+      }
+    };
+    sender.thread->PostTask([&]() { send(); });
+    done.get_future().wait();
+    // 溜まっているパケットを送り終わるのを待つ
+    sender_cpu = sender.GetCpuSec() - sender_cpu;
+    // 受信しきれていないパケットを待つ
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    receiver_cpu = receiver.GetCpuSec() - receiver_cpu;
+
+    const auto& sc = *sender.counters;
+    Result sent;
+    sent.packets = sc.packets_sent.load() - sc.send_dropped.load();
+    sent.syscalls = sc.send_syscalls.load();
+    sent.dropped = attempts - sent.packets;
+    sent.cpu_sec = sender_cpu;
+    Result received;
+    received.packets = receiver.counters->packets_received.load();
+    // 受信バッファが溢れてカーネルが捨てたパケットは、送信できた数との差で分かる
+    received.dropped =
+        sent.packets > received.packets ? sent.packets - received.packets : 0;
+    received.cpu_sec = receiver_cpu;
+    sender.Stop();
+    receiver.Stop();
+
+    std::cout << name << std::endl;
+    Print("send", sent, seconds, attempts);
+    Print("receive", received, seconds, sent.packets);
+  }
+  return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef UDP_BENCHMARK_H_
+#define UDP_BENCHMARK_H_
+
+// ループバックで UDP の送受信の速度を測る
+//
+// NetworkShard と同じソケットファクトリで、--udp-batching を指定しない場合と
+// 指定した場合のソケットを作り、ネットワークスレッドで送受信した時の
+// パケット数/秒と CPU 1 コアあたりのパケット数/秒を表示する。
+// 成功したら 0 を返す
+int RunUdpSocketBenchmark(double seconds, int packet_size);
+
+#endif
@@ -1,7 +1,8 @@
 #include "util.h"
 
+#include <algorithm>
 #include <cstdlib>
-#include <regex>
+#include <map>
 #include <string>
 
 // CLI11
@@ -18,10 +19,10 @@
 #include <rtc_base/crypto_random.h>
 
 // Sora
-#include <sora/amf_context.h>
-#include <sora/cuda_context.h>
 #include <sora/sora_video_codec.h>
 
+#include "udp_benchmark.h"
+#include "video_codec_capability_cache.h"
 #include "zakuro.h"
 #include "zakuro_version.h"
 
@@ -42,6 +43,13 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
                      std::optional<std::string>& ui_remote_url,
                      std::string& connection_id_stats_file,
                      double& instance_hatch_rate,
+                     std::string& load_profile,
+                     AdmissionController::Config& admission_config,
+                     int& context_pool_size,
+                     int& workers,
+                     std::string& video_codec_capability_cache,
+                     bool& startup_profile,
+                     DistributedConfig& distributed_config,
                      ZakuroConfig& config,
                      bool ignore_config) {
   std::vector<std::string> args = cargs;
@@ -57,6 +65,10 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
   bool show_video_codec_capability = false;
   app.add_flag("--show-video-codec-capability", show_video_codec_capability,
                "Show available video codec capability");
+  bool benchmark_udp_socket = false;
+  app.add_flag("--benchmark-udp-socket", benchmark_udp_socket,
+               "Benchmark UDP send/receive on loopback with and without "
+               "--udp-batching");
 
   app.add_option("--config", config_file, "JSONC config file path")
       ->check(CLI::ExistingFile);
@@ -76,6 +88,50 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
   app.add_option("--instance-hatch-rate", instance_hatch_rate,
                  "Spawned instance per seconds (default: 1.0)")
       ->check(CLI::Range(0.1, 100.0));
+  app.add_option("--load-profile", load_profile,
+                 "Phases of total vcs across all instances in JSON "
+                 "(default: none)");
+  app.add_option("--max-inflight-connects", admission_config.max_in_flight,
+                 "Max number of connects in progress across all instances. "
+                 "0 means unlimited (default: 0)")
+      ->check(CLI::NonNegativeNumber);
+  double connect_latency_threshold = 5.0;
+  app.add_option("--connect-latency-threshold", connect_latency_threshold,
+                 "Seconds of connect time to back off --max-inflight-connects "
+                 "(default: 5)")
+      ->check(CLI::PositiveNumber);
+  app.add_option("--context-pool-size", context_pool_size,
+                 "Number of WebRTC contexts shared by instances with the same "
+                 "media and codec settings. 0 means one context per instance "
+                 "(default: 0)")
+      ->check(CLI::NonNegativeNumber);
+  app.add_option("--workers", workers,
+                 "Number of worker processes to run instances in. 0 means "
+                 "all instances run in this process (default: 0)")
+      ->check(CLI::Range(0, 256));
+  app.add_option("--video-codec-capability-cache", video_codec_capability_cache,
+                 "File to save the video encoder and decoder capability to. "
+                 "Loaded on the next startup instead of probing again "
+                 "(default: none)");
+  app.add_flag("--startup-profile", startup_profile,
+               "Print time spent in config parsing, capability probing and "
+               "context creation until all instances are ready");
+  app.add_flag("--follower", distributed_config.follower,
+               "Wait for a coordinator to send the config via JSON-RPC. "
+               "Requires --http-host and --http-port");
+  app.add_option("--followers", distributed_config.followers,
+                 "Comma-separated JSON-RPC URLs of followers "
+                 "(e.g. http://10.0.0.2:8080). Splits --config across them "
+                 "and runs as a coordinator")
+      ->delimiter(',');
+  app.add_option("--start-delay", distributed_config.start_delay,
+                 "Seconds from sending the config to followers until they "
+                 "start (default: 5)")
+      ->check(CLI::Range(0.0, 3600.0));
+  app.add_option("--follower-token", distributed_config.token,
+                 "Shared token between the coordinator and followers. "
+                 "Required for --follower unless --http-host is a loopback "
+                 "address");
 
   // インスタンス毎のオプション
   auto is_valid_resolution = CLI::Validator(
@@ -86,8 +142,13 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
         }
 
         // 数値x数値、というフォーマットになっているか確認する
-        std::regex re("^[1-9][0-9]*x[1-9][0-9]*$");
-        if (std::regex_match(input, re)) {
+        auto is_number = [](const std::string& s) {
+          return !s.empty() && s[0] != '0' &&
+                 s.find_first_not_of("0123456789") == std::string::npos;
+        };
+        auto x = input.find('x');
+        if (x != std::string::npos && is_number(input.substr(0, x)) &&
+            is_number(input.substr(x + 1))) {
           return std::string();
         }
 
@@ -104,10 +165,30 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
 
   app.add_option("--name", config.name, "Client Name");
   app.add_option("--vcs", config.vcs, "Virtual Clients (default: 1)")
-      ->check(CLI::Range(1, 1000));
+      ->check(CLI::Range(1, 100000));
   app.add_option("--vcs-hatch-rate", config.vcs_hatch_rate,
                  "Spawned virtual clients per seconds (default: 1.0)")
       ->check(CLI::Range(0.1, 100.0));
+  app.add_option("--network-threads", config.network_threads,
+                 "Number of network threads to distribute virtual clients. "
+                 "0 means the number of CPU cores divided by the number of "
+                 "instances (default: 0)")
+      ->check(CLI::Range(0, 256));
+  app.add_flag("--udp-batching", config.udp_batching,
+               "Send and receive UDP packets in batches with sendmmsg/recvmmsg "
+               "and UDP GSO/GRO (Linux only)");
+  app.add_option("--cpu-affinity", config.cpu_affinity,
+                 "CPUs to run the threads of this instance on, e.g. 0-3,8 or "
+                 "per thread role like network=0-3;worker=4-7;*=8-15. Roles "
+                 "are instance, network, worker, signaling, capturer and "
+                 "audio (default: none)")
+      ->check(CLI::Validator(
+          [](std::string input) { return ThreadAffinity::Validate(input); },
+          "CPUS"));
+  app.add_option("--numa-node", config.numa_node,
+                 "NUMA node to run the threads of this instance on and "
+                 "allocate memory from. -1 means none (default: -1)")
+      ->check(CLI::Range(-1, 1023));
   app.add_option("--duration", config.duration,
                  "(Experimental) Duration of virtual client running in seconds "
                  "(if not zero) (default: 0.0)");
@@ -125,6 +206,9 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
                "Do not use video device (default: false)");
   app.add_flag("--no-audio-device", config.no_audio_device,
                "Do not use audio device (default: false)");
+  app.add_flag("--data-channel-only", config.data_channel_only,
+               "Connect with DataChannels only, without media engine and "
+               "audio device module (default: false)");
   app.add_flag("--fake-capture-device", config.fake_capture_device,
                "Fake Capture Device (default: true)");
   app.add_option("--fake-video-capture", config.fake_video_capture,
@@ -135,6 +219,9 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
       ->check(CLI::ExistingFile);
   app.add_flag("--sandstorm", config.sandstorm,
                "Fake Sandstorm Video (default: false)");
+  app.add_flag("--frame-watermark", config.frame_watermark,
+               "Embed capture time and frame number into fake video "
+               "(default: false)");
 #if defined(__APPLE__)
   app.add_option("--video-device", config.video_device,
                  "Use the video device specified by an index or a name "
@@ -165,8 +252,8 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
                  "OpenH264 dynamic library path. \"OpenH264 Video Codec "
                  "provided by Cisco Systems, Inc.\"")
       ->check(CLI::ExistingFile);
-  app.add_option("--scenario", config.scenario, "Scenario type")
-      ->check(CLI::IsMember({"", "reconnect"}));
+  app.add_option("--scenario", config.scenario,
+                 "Scenario type (\"\", reconnect or a name in --scenarios)");
   app.add_option("--client-cert", config.client_cert,
                  "Cert file path for client certification (PEM format)")
       ->check(CLI::ExistingFile);
@@ -179,6 +266,39 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
   app.add_option("--initial-mute-audio", config.initial_mute_audio,
                  "Mute audio initialy (default: false)")
       ->transform(CLI::CheckedTransformer(bool_map, CLI::ignore_case));
+  app.add_option("--voice-activity-talk-duration",
+                 config.voice_activity_talk_duration,
+                 "Mean duration of talk spurts in seconds for voice activity "
+                 "model (0 means always talking) (default: 0)")
+      ->check(CLI::NonNegativeNumber);
+  app.add_option("--voice-activity-silence-duration",
+                 config.voice_activity_silence_duration,
+                 "Mean duration of silence in seconds for voice activity "
+                 "model (0 means always talking) (default: 0)")
+      ->check(CLI::NonNegativeNumber);
+  app.add_option("--real-video-decode-ratio", config.real_video_decode_ratio,
+                 "Ratio of received video streams decoded by a real decoder "
+                 "instead of NopVideoDecoder (default: 0)")
+      ->check(CLI::Range(0.0, 1.0));
+  app.add_option("--data-channel-backpressure",
+                 config.data_channel_backpressure,
+                 "What to do with DataChannel messages when the send buffer "
+                 "exceeds the high watermark (default: none)")
+      ->check(CLI::IsMember({"none", "block", "drop", "coalesce"}));
+  app.add_option("--data-channel-high-watermark",
+                 config.data_channel_high_watermark,
+                 "Estimated DataChannel send buffer size in bytes to start "
+                 "backpressure (default: 1048576)")
+      ->check(CLI::Range(1, 1024 * 1024 * 1024));
+  app.add_option("--data-channel-low-watermark",
+                 config.data_channel_low_watermark,
+                 "Estimated DataChannel send buffer size in bytes to stop "
+                 "backpressure (default: 262144)")
+      ->check(CLI::Range(0, 1024 * 1024 * 1024));
+  app.add_flag("--data-channel-stats-per-sender",
+               config.data_channel_stats_per_sender,
+               "Also collect DataChannel receive stats per sender "
+               "(default: false)");
   auto degradation_preference_map =
       std::vector<std::pair<std::string, webrtc::DegradationPreference>>(
           {{"disabled", webrtc::DegradationPreference::DISABLED},
@@ -299,6 +419,11 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
                  "Parameters for H.265 video codec (default: none)")
       ->check(is_json);
 
+  std::string scenarios;
+  app.add_option("--scenarios", scenarios,
+                 "User defined scenarios (default: none)")
+      ->check(is_json);
+
   // ビデオコーデック実装の選択肢
   auto video_codec_implementation_map =
       std::vector<std::pair<std::string, sora::VideoCodecImplementation>>(
@@ -349,8 +474,14 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
   try {
     app.parse(args);
   } catch (const CLI::ParseError& e) {
-    std::exit(app.exit(e));
+    // --help はヘルプを表示して終了する
+    if (e.get_exit_code() == static_cast<int>(CLI::ExitCodes::Success)) {
+      std::exit(app.exit(e));
+    }
+    throw InvalidArgsError(e.what());
   }
+  admission_config.latency_threshold =
+      std::chrono::milliseconds((int64_t)(connect_latency_threshold * 1000));
 
   if (version) {
     std::cout << ZakuroVersion::GetClientName() << std::endl;
@@ -364,19 +495,14 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
   if (show_video_codec_capability) {
     sora::VideoCodecCapabilityConfig capability_config;
 
-    if (sora::CudaContext::CanCreate()) {
-      capability_config.cuda_context = sora::CudaContext::Create();
-    }
-    if (sora::AMFContext::CanCreate()) {
-      capability_config.amf_context = sora::AMFContext::Create();
-    }
     // OpenH264 パスが指定されている場合
     // コマンドライン引数は既にパースされているので、config.openh264 に値が入っている
     if (!config.openh264.empty()) {
       capability_config.openh264_path = config.openh264;
     }
 
-    auto capability = sora::GetVideoCodecCapability(capability_config);
+    auto capability = VideoCodecCapabilityCache(video_codec_capability_cache)
+                          .Get(capability_config);
 
     for (const auto& engine : capability.engines) {
       std::cout << "Engine: "
@@ -411,8 +537,18 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
     std::exit(0);
   }
 
-  // 設定ファイルがある
-  if (!ignore_config && !config_file.empty()) {
+  if (benchmark_udp_socket) {
+    std::exit(RunUdpSocketBenchmark(3.0, 1200));
+  }
+
+  if (!ignore_config && !distributed_config.followers.empty() &&
+      config_file.empty()) {
+    throw InvalidArgsError("--followers requires --config");
+  }
+
+  // 設定ファイルがあるか、設定をコーディネーターから受け取る
+  if (!ignore_config &&
+      (!config_file.empty() || distributed_config.follower)) {
     return;
   }
 
@@ -420,22 +556,27 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
   // add_option()->required() を使うと --version や --config を指定した際に
   // エラーになってしまうので、ここでチェックする
   if (config.sora_signaling_urls.empty()) {
-    std::cerr << "--sora-signaling-url is required" << std::endl;
-    std::exit(1);
+    throw InvalidArgsError("--sora-signaling-url is required");
   }
   if (config.sora_channel_id.empty()) {
-    std::cerr << "--sora-channel-id is required" << std::endl;
-    std::exit(1);
+    throw InvalidArgsError("--sora-channel-id is required");
   }
   if (config.sora_role.empty()) {
-    std::cerr << "--sora-role is required" << std::endl;
-    std::exit(1);
+    throw InvalidArgsError("--sora-role is required");
   }
 
   // --openh264 のパスは絶対パスである必要がある
   if (!config.openh264.empty() && config.openh264[0] != '/') {
-    std::cerr << "--openh264 file path must be absolute path" << std::endl;
-    std::exit(1);
+    throw InvalidArgsError("--openh264 file path must be absolute path");
+  }
+
+  // 発話モデルは無音の後に音声を有効にするので、最初から音声を無効にする設定とは併用できない
+  if (config.initial_mute_audio && config.voice_activity_talk_duration > 0 &&
+      config.voice_activity_silence_duration > 0) {
+    throw InvalidArgsError(
+        "--initial-mute-audio cannot be used with "
+        "--voice-activity-talk-duration and "
+        "--voice-activity-silence-duration");
   }
 
   // メタデータのパース
@@ -461,182 +602,373 @@ void Util::ParseArgs(const std::vector<std::string>& cargs,
   if (!sora_video_h265_params.empty()) {
     config.sora_video_h265_params = boost::json::parse(sora_video_h265_params);
   }
+  if (!scenarios.empty()) {
+    config.scenarios = boost::json::parse(scenarios);
+  }
 }
 
-static std::string ConvertEnv(const std::string& input,
-                              const std::map<std::string, std::string>& envs) {
-  std::string result;
-  std::regex re("\\$\\{(.*?)\\}");
-  std::sregex_iterator it(input.begin(), input.end(), re);
-  std::sregex_iterator last_it;
-  std::sregex_iterator end;
-  for (; it != end; ++it) {
-    const std::smatch& m = *it;
-    result += m.prefix().str();
-    std::string name = m[1].str();
-    auto mit = envs.find(name);
-    if (mit != envs.end()) {
-      result += mit->second;
-    } else {
-      result += m.str();
+namespace {
+
+// ${NAME} を含む値を一度だけ分解しておき、インスタンス毎に置き換える
+class EnvTemplate {
+ public:
+  // expand が false の場合は ${} を置き換えない
+  explicit EnvTemplate(const std::string& input, bool expand = true) {
+    size_t pos = 0;
+    while (expand) {
+      auto begin = input.find("${", pos);
+      if (begin == std::string::npos) {
+        break;
+      }
+      auto end = input.find('}', begin + 2);
+      if (end == std::string::npos) {
+        break;
+      }
+      literals_.push_back(input.substr(pos, begin - pos));
+      names_.push_back(input.substr(begin + 2, end - begin - 2));
+      pos = end + 1;
     }
-    last_it = it;
+    literals_.push_back(input.substr(pos));
   }
-  if (last_it != end) {
-    result += last_it->suffix().str();
-  } else {
-    result = input;
+
+  // 見つからない名前は ${NAME} のまま残す
+  std::string Render(const std::map<std::string, std::string>& envs) const {
+    std::string result = literals_[0];
+    for (size_t i = 0; i < names_.size(); i++) {
+      auto it = envs.find(names_[i]);
+      result += it != envs.end() ? it->second : "${" + names_[i] + "}";
+      result += literals_[i + 1];
+    }
+    return result;
   }
-  return result;
-}
+
+ private:
+  // literals_[0] ${names_[0]} literals_[1] ... の順に並ぶ
+  std::vector<std::string> literals_;
+  std::vector<std::string> names_;
+};
+
+}  // namespace
 
 std::vector<std::vector<std::string>> Util::ParseInstanceToArgs(
     const boost::json::value& inst) {
   std::vector<std::vector<std::string>> argss;
 
-  bool has_error = false;
-
   int instance_num = 1;
   const auto& obj = inst.as_object();
-  auto it = obj.find("instance-num");
   if (obj.contains("instance-num")) {
     instance_num = boost::json::value_to<int>(obj.at("instance-num"));
   }
+  // コーディネーターが instance-num を分けた場合に、${} の番号をずらす
+  int instance_offset = 0;
+  if (obj.contains("instance-offset")) {
+    instance_offset = boost::json::value_to<int>(obj.at("instance-offset"));
+  }
+
+  // 引数はインスタンス毎に ${} を置き換えるだけなので、先に組み立てておく
+  std::vector<EnvTemplate> args;
+
+  // 値のあるオプション
+  auto add_option = [&args](const boost::json::object& obj,
+                            const std::string& prefix,
+                            const std::string& key) {
+    auto it = obj.find(key);
+    if (it != obj.end()) {
+      args.emplace_back("--" + prefix + key, false);
+      args.emplace_back(PrimitiveValueToString(it->value()));
+    }
+  };
+
+  // フラグオプション
+  auto add_flag = [&args](const boost::json::object& obj,
+                          const std::string& prefix, const std::string& key) {
+    auto it = obj.find(key);
+    if (it != obj.end() && it->value().is_bool() && it->value().as_bool()) {
+      args.emplace_back("--" + prefix + key, false);
+    }
+  };
+
+  // JSONオブジェクトをそのまま渡すオプション
+  auto add_json_option = [&args](const boost::json::object& obj,
+                                 const std::string& prefix,
+                                 const std::string& key) {
+    auto it = obj.find(key);
+    if (it != obj.end()) {
+      args.emplace_back("--" + prefix + key, false);
+      args.emplace_back(boost::json::serialize(it->value()), false);
+    }
+  };
+
+  // 一般オプション
+  add_option(obj, "", "name");
+  add_option(obj, "", "vcs");
+  add_option(obj, "", "vcs-hatch-rate");
+  add_option(obj, "", "network-threads");
+  add_flag(obj, "", "udp-batching");
+  add_option(obj, "", "cpu-affinity");
+  add_option(obj, "", "numa-node");
+  add_option(obj, "", "duration");
+  add_option(obj, "", "repeat-interval");
+  add_option(obj, "", "max-retry");
+  add_option(obj, "", "retry-interval");
+  add_flag(obj, "", "no-video-device");
+  add_flag(obj, "", "no-audio-device");
+  add_flag(obj, "", "data-channel-only");
+  add_flag(obj, "", "fake-capture-device");
+  add_option(obj, "", "fake-video-capture");
+  add_option(obj, "", "fake-audio-capture");
+  add_flag(obj, "", "sandstorm");
+  add_flag(obj, "", "frame-watermark");
+  add_option(obj, "", "video-device");
+  add_option(obj, "", "resolution");
+  add_option(obj, "", "framerate");
+  add_flag(obj, "", "fixed-resolution");
+  add_option(obj, "", "priority");
+  add_flag(obj, "", "insecure");
+  add_option(obj, "", "openh264");
+  add_option(obj, "", "scenario");
+  add_option(obj, "", "client-cert");
+  add_option(obj, "", "client-key");
+  add_option(obj, "", "initial-mute-video");
+  add_option(obj, "", "initial-mute-audio");
+  add_option(obj, "", "voice-activity-talk-duration");
+  add_option(obj, "", "voice-activity-silence-duration");
+  add_option(obj, "", "real-video-decode-ratio");
+  add_option(obj, "", "data-channel-backpressure");
+  add_option(obj, "", "data-channel-high-watermark");
+  add_option(obj, "", "data-channel-low-watermark");
+  add_flag(obj, "", "data-channel-stats-per-sender");
+  add_option(obj, "", "degradation-preference");
+
+  add_json_option(obj, "", "scenarios");
+
+  // コーデックプリファレンス
+  add_option(obj, "", "vp8-encoder");
+  add_option(obj, "", "vp9-encoder");
+  add_option(obj, "", "av1-encoder");
+  add_option(obj, "", "h264-encoder");
+  add_option(obj, "", "h265-encoder");
+
+  // soraオプション
+  auto sora_it = obj.find("sora");
+  if (sora_it != obj.end()) {
+    const auto& sora_obj = sora_it->value().as_object();
+
+    // --sora-signaling-url: string or string[]
+    {
+      auto it = sora_obj.find("signaling-url");
+      if (it != sora_obj.end()) {
+        const auto& value = it->value();
+        if (value.is_array()) {
+          args.emplace_back("--sora-signaling-url", false);
+          for (const auto& v : value.as_array()) {
+            args.emplace_back(PrimitiveValueToString(v));
+          }
+        } else if (value.is_string()) {
+          args.emplace_back("--sora-signaling-url", false);
+          args.emplace_back(PrimitiveValueToString(value));
+        } else {
+          throw std::runtime_error(
+              "sora.signaling-url must be string or string[]");
+        }
+      }
+    }
+
+    add_flag(sora_obj, "sora-", "disable-signaling-url-randomization");
+    add_option(sora_obj, "sora-", "channel-id");
+    add_option(sora_obj, "sora-", "client-id");
+    add_option(sora_obj, "sora-", "bundle-id");
+    add_option(sora_obj, "sora-", "role");
+    add_option(sora_obj, "sora-", "video");
+    add_option(sora_obj, "sora-", "audio");
+    add_option(sora_obj, "sora-", "video-codec-type");
+    add_option(sora_obj, "sora-", "audio-codec-type");
+    add_option(sora_obj, "sora-", "video-bit-rate");
+    add_option(sora_obj, "sora-", "audio-bit-rate");
+    add_option(sora_obj, "sora-", "simulcast");
+    add_option(sora_obj, "sora-", "simulcast-rid");
+    add_option(sora_obj, "sora-", "spotlight");
+    add_option(sora_obj, "sora-", "spotlight-number");
+    add_option(sora_obj, "sora-", "spotlight-focus-rid");
+    add_option(sora_obj, "sora-", "spotlight-unfocus-rid");
+    add_option(sora_obj, "sora-", "data-channel-signaling");
+    add_option(sora_obj, "sora-", "data-channel-signaling-timeout");
+    add_option(sora_obj, "sora-", "ignore-disconnect-websocket");
+    add_option(sora_obj, "sora-", "disconnect-wait-timeout");
+
+    add_json_option(sora_obj, "sora-", "metadata");
+    add_json_option(sora_obj, "sora-", "signaling-notify-metadata");
+    add_json_option(sora_obj, "sora-", "data-channels");
+    add_json_option(sora_obj, "sora-", "video-vp9-params");
+    add_json_option(sora_obj, "sora-", "video-av1-params");
+    add_json_option(sora_obj, "sora-", "video-h264-params");
+    add_json_option(sora_obj, "sora-", "video-h265-params");
+  }
 
   for (int i = 0; i < instance_num; i++) {
     std::map<std::string, std::string> envs;
-    envs[""] = std::to_string(i + 1);
-    std::vector<std::string> args;
-
-    // 値のあるオプション
-    auto add_option = [&args, &envs](const boost::json::object& obj,
-                                     const std::string& prefix,
-                                     const std::string& key) {
-      auto it = obj.find(key);
-      if (it != obj.end()) {
-        args.push_back("--" + prefix + key);
-        args.push_back(ConvertEnv(PrimitiveValueToString(it->value()), envs));
-      }
-    };
-
-    // フラグオプション
-    auto add_flag = [&args, &envs](const boost::json::object& obj,
-                                   const std::string& prefix,
-                                   const std::string& key) {
-      auto it = obj.find(key);
-      if (it != obj.end() && it->value().is_bool() && it->value().as_bool()) {
-        args.push_back("--" + prefix + key);
-      }
-    };
-
-    // JSONオブジェクトをそのまま渡すオプション
-    auto add_json_option = [&args, &envs](const boost::json::object& obj,
-                                          const std::string& prefix,
-                                          const std::string& key) {
-      auto it = obj.find(key);
-      if (it != obj.end()) {
-        args.push_back("--" + prefix + key);
-        args.push_back(boost::json::serialize(it->value()));
+    envs[""] = std::to_string(instance_offset + i + 1);
+    std::vector<std::string> rendered;
+    rendered.reserve(args.size());
+    for (const auto& arg : args) {
+      rendered.push_back(arg.Render(envs));
+    }
+    argss.push_back(std::move(rendered));
+  }
+
+  return argss;
+}
+
+std::vector<std::string> Util::ParseConfigToCommonArgs(
+    const boost::json::object& obj) {
+  std::vector<std::string> args;
+
+  // 値のあるオプション
+  auto add_option = [&args, &obj](const std::string& key) {
+    if (auto p = obj.if_contains(key); p != nullptr) {
+      args.push_back("--" + key);
+      args.push_back(PrimitiveValueToString(*p));
+    }
+  };
+
+  // フラグオプション
+  auto add_flag = [&args, &obj](const std::string& key) {
+    if (auto p = obj.if_contains(key); p != nullptr && p->as_bool()) {
+      args.push_back("--" + key);
+    }
+  };
+
+  add_option("log-level");
+  add_option("http-port");
+  add_option("http-host");
+  add_flag("ui");
+  add_option("ui-remote-url");
+  add_option("output-file-connection-id");
+  add_option("instance-hatch-rate");
+  if (auto p = obj.if_contains("load-profile"); p != nullptr) {
+    args.push_back("--load-profile");
+    args.push_back(boost::json::serialize(*p));
+  }
+  add_option("max-inflight-connects");
+  add_option("connect-latency-threshold");
+  add_option("context-pool-size");
+  add_option("workers");
+  add_option("video-codec-capability-cache");
+  add_flag("startup-profile");
+  return args;
+}
+
+bool Util::ValidateConfig(const boost::json::value& config,
+                          const std::vector<std::string>& post_args,
+                          std::string& error) {
+  if (!config.is_object()) {
+    error = "config must be an object";
+    return false;
+  }
+  const auto& obj = config.as_object();
+  auto instances = obj.if_contains("instances");
+  if (instances == nullptr || !instances->is_array() ||
+      instances->as_array().empty()) {
+    error = "config must have a non-empty instances array";
+    return false;
+  }
+  try {
+    auto common_args = ParseConfigToCommonArgs(obj);
+    for (const auto& instance : instances->as_array()) {
+      if (!instance.is_object()) {
+        error = "instances must be an array of objects";
+        return false;
       }
-    };
-
-    const auto& obj = inst.as_object();
-
-    // 一般オプション
-    add_option(obj, "", "name");
-    add_option(obj, "", "vcs");
-    add_option(obj, "", "vcs-hatch-rate");
-    add_option(obj, "", "duration");
-    add_option(obj, "", "repeat-interval");
-    add_option(obj, "", "max-retry");
-    add_option(obj, "", "retry-interval");
-    add_flag(obj, "", "no-video-device");
-    add_flag(obj, "", "no-audio-device");
-    add_flag(obj, "", "fake-capture-device");
-    add_option(obj, "", "fake-video-capture");
-    add_option(obj, "", "fake-audio-capture");
-    add_flag(obj, "", "sandstorm");
-    add_option(obj, "", "video-device");
-    add_option(obj, "", "resolution");
-    add_option(obj, "", "framerate");
-    add_flag(obj, "", "fixed-resolution");
-    add_option(obj, "", "priority");
-    add_flag(obj, "", "insecure");
-    add_option(obj, "", "openh264");
-    add_option(obj, "", "scenario");
-    add_option(obj, "", "client-cert");
-    add_option(obj, "", "client-key");
-    add_option(obj, "", "initial-mute-video");
-    add_option(obj, "", "initial-mute-audio");
-    add_option(obj, "", "degradation-preference");
-
-    // コーデックプリファレンス
-    add_option(obj, "", "vp8-encoder");
-    add_option(obj, "", "vp9-encoder");
-    add_option(obj, "", "av1-encoder");
-    add_option(obj, "", "h264-encoder");
-    add_option(obj, "", "h265-encoder");
-
-    // soraオプション
-    auto sora_it = obj.find("sora");
-    if (sora_it != obj.end()) {
-      const auto& sora_obj = sora_it->value().as_object();
-
-      // --sora-signaling-url: string or string[]
-      {
-        auto it = sora_obj.find("signaling-url");
-        if (it != sora_obj.end()) {
-          const auto& value = it->value();
-          if (value.is_array()) {
-            args.push_back("--sora-signaling-url");
-            for (const auto& v : value.as_array()) {
-              args.push_back(ConvertEnv(PrimitiveValueToString(v), envs));
-            }
-          } else if (value.is_string()) {
-            args.push_back("--sora-signaling-url");
-            args.push_back(ConvertEnv(PrimitiveValueToString(value), envs));
-          } else {
-            throw std::runtime_error(
-                "sora.signaling-url must be string or string[]");
+      auto argss = ParseInstanceToArgs(instance);
+      ZakuroConfig first_config;
+      for (size_t n = 0; n < argss.size(); n++) {
+        // 実行する時と同じく、${} で変わる値だけならパースし直さない
+        if (n > 0) {
+          ZakuroConfig config = first_config;
+          if (ApplyInstanceArgs(argss[0], argss[n], post_args, config)) {
+            continue;
           }
         }
+        auto args = argss[n];
+        args.insert(args.begin(), common_args.begin(), common_args.end());
+        args.insert(args.end(), post_args.begin(), post_args.end());
+
+        // 結果は使わないので、全て捨てる
+        std::string config_file;
+        int log_level = 0;
+        std::optional<std::string> http_host;
+        std::optional<int> http_port;
+        bool ui = false;
+        std::optional<std::string> ui_remote_url;
+        std::string connection_id_stats_file;
+        double instance_hatch_rate = 1.0;
+        std::string load_profile;
+        AdmissionController::Config admission_config;
+        int context_pool_size = 0;
+        int workers = 0;
+        std::string video_codec_capability_cache;
+        bool startup_profile = false;
+        DistributedConfig distributed_config;
+        ZakuroConfig config;
+        ParseArgs(args, config_file, log_level, http_host, http_port, ui,
+                  ui_remote_url, connection_id_stats_file,
+                  instance_hatch_rate, load_profile, admission_config,
+                  context_pool_size, workers, video_codec_capability_cache,
+                  startup_profile, distributed_config, config, true);
+        if (n == 0) {
+          first_config = config;
+        }
       }
-
-      add_flag(sora_obj, "sora-", "disable-signaling-url-randomization");
-      add_option(sora_obj, "sora-", "channel-id");
-      add_option(sora_obj, "sora-", "client-id");
-      add_option(sora_obj, "sora-", "bundle-id");
-      add_option(sora_obj, "sora-", "role");
-      add_option(sora_obj, "sora-", "video");
-      add_option(sora_obj, "sora-", "audio");
-      add_option(sora_obj, "sora-", "video-codec-type");
-      add_option(sora_obj, "sora-", "audio-codec-type");
-      add_option(sora_obj, "sora-", "video-bit-rate");
-      add_option(sora_obj, "sora-", "audio-bit-rate");
-      add_option(sora_obj, "sora-", "simulcast");
-      add_option(sora_obj, "sora-", "simulcast-rid");
-      add_option(sora_obj, "sora-", "spotlight");
-      add_option(sora_obj, "sora-", "spotlight-number");
-      add_option(sora_obj, "sora-", "spotlight-focus-rid");
-      add_option(sora_obj, "sora-", "spotlight-unfocus-rid");
-      add_option(sora_obj, "sora-", "data-channel-signaling");
-      add_option(sora_obj, "sora-", "data-channel-signaling-timeout");
-      add_option(sora_obj, "sora-", "ignore-disconnect-websocket");
-      add_option(sora_obj, "sora-", "disconnect-wait-timeout");
-
-      add_json_option(sora_obj, "sora-", "metadata");
-      add_json_option(sora_obj, "sora-", "signaling-notify-metadata");
-      add_json_option(sora_obj, "sora-", "data-channels");
-      add_json_option(sora_obj, "sora-", "video-vp9-params");
-      add_json_option(sora_obj, "sora-", "video-av1-params");
-      add_json_option(sora_obj, "sora-", "video-h264-params");
-      add_json_option(sora_obj, "sora-", "video-h265-params");
     }
-
-    argss.push_back(args);
+  } catch (const std::exception& e) {
+    error = e.what();
+    return false;
   }
+  return true;
+}
 
-  return argss;
+bool Util::ApplyInstanceArgs(const std::vector<std::string>& base_args,
+                             const std::vector<std::string>& args,
+                             const std::vector<std::string>& override_args,
+                             ZakuroConfig& config) {
+  if (base_args.size() != args.size()) {
+    return false;
+  }
+  // オプション名は ${} を置き換えないので、違うのは値だけになる
+  size_t option_index = 0;
+  for (size_t i = 0; i < args.size(); i++) {
+    if (args[i] == base_args[i]) {
+      if (args[i].rfind("--", 0) == 0) {
+        option_index = i;
+      }
+      continue;
+    }
+    const auto& option = args[option_index];
+    // 後ろのオプションで上書きされている場合は最初のインスタンスと同じ値になる
+    // CLI11 は --opt value と --opt=value のどちらの形式も受け付ける
+    if (std::any_of(override_args.begin(), override_args.end(),
+                    [&option](const std::string& arg) {
+                      return arg == option || arg.rfind(option + "=", 0) == 0;
+                    })) {
+      continue;
+    }
+    if (option == "--name") {
+      config.name = args[i];
+    } else if (option == "--sora-channel-id") {
+      config.sora_channel_id = args[i];
+    } else if (option == "--sora-client-id") {
+      config.sora_client_id = args[i];
+    } else if (option == "--sora-bundle-id") {
+      config.sora_bundle_id = args[i];
+    } else if (option == "--sora-signaling-url" &&
+               i - option_index - 1 < config.sora_signaling_urls.size()) {
+      config.sora_signaling_urls[i - option_index - 1] = args[i];
+    } else {
+      // 検証や変換が必要なオプションは ParseArgs でパースし直す
+      return false;
+    }
+  }
+  return true;
 }
 
 boost::json::value Util::LoadJsoncFile(const std::string& file_path) {
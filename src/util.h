@@ -2,6 +2,9 @@
 #define UTIL_H_
 
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 // Boost
 #include <boost/json.hpp>
@@ -9,10 +12,20 @@
 // WebRTC
 #include <api/peer_connection_interface.h>
 
+#include "coordinator.h"
 #include "zakuro.h"
 
+// ParseArgs で引数が不正だった場合に投げる
+// what() はそのまま表示できるメッセージになっている
+class InvalidArgsError : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
 class Util {
  public:
+  // 引数が不正な場合は InvalidArgsError を投げる
+  // --version や --help など、表示して終了するオプションの場合は終了する
   static void ParseArgs(const std::vector<std::string>& args,
                         std::string& config_file,
                         int& log_level,
@@ -22,10 +35,35 @@ class Util {
                         std::optional<std::string>& ui_remote_url,
                         std::string& connection_id_stats_file,
                         double& instance_hatch_rate,
+                        std::string& load_profile,
+                        AdmissionController::Config& admission_config,
+                        int& context_pool_size,
+                        int& workers,
+                        std::string& video_codec_capability_cache,
+                        bool& startup_profile,
+                        DistributedConfig& distributed_config,
                         ZakuroConfig& config,
                         bool ignore_config);
+  // 設定ファイルのトップレベルのキーから、全てのインスタンスに共通の引数を作る
+  static std::vector<std::string> ParseConfigToCommonArgs(
+      const boost::json::object& obj);
+  // 設定ファイルの全てのインスタンスの引数を、実行する前にパースして確かめる
+  // post_args は各インスタンスの引数の後ろに追加する引数
+  // 不正な場合は error にメッセージを入れて false を返す
+  static bool ValidateConfig(const boost::json::value& config,
+                             const std::vector<std::string>& post_args,
+                             std::string& error);
+  // instance-num の数だけ引数を作り、値の ${} をインスタンスの番号に置き換える
   static std::vector<std::vector<std::string>> ParseInstanceToArgs(
       const boost::json::value& inst);
+  // ParseInstanceToArgs で作った同じインスタンスの引数のうち、
+  // base_args と違う値を base_args からパースした config に直接反映する
+  // override_args は後ろに追加してパースした引数で、こちらが優先される
+  // 直接反映できないオプションの場合は false を返すので、ParseArgs でパースする
+  static bool ApplyInstanceArgs(const std::vector<std::string>& base_args,
+                                const std::vector<std::string>& args,
+                                const std::vector<std::string>& override_args,
+                                ZakuroConfig& config);
   static boost::json::value LoadJsoncFile(const std::string& file_path);
   static std::string GenerateRandomChars();
   static std::string GenerateRandomChars(size_t length);
@@ -0,0 +1,192 @@
+#include "video_codec_capability_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+// Boost
+#include <boost/json.hpp>
+
+#include "zakuro_version.h"
+
+namespace {
+
+// ファイルの形式を変えたら上げる
+constexpr int kFileVersion = 1;
+
+// 同じキーなら同じ結果になるとみなす
+// バージョン、マシン、OpenH264 のライブラリが変わったら確認し直す
+std::string MakeKey(const std::string& openh264) {
+  char hostname[256] = {};
+  gethostname(hostname, sizeof(hostname) - 1);
+  std::string key = ZakuroVersion::GetClientName() + "|" +
+                    ZakuroVersion::GetSoraCppSdkVersion() + "|" +
+                    ZakuroVersion::GetLibwebrtcName() + "|" + hostname + "|" +
+                    openh264;
+  struct stat st;
+  if (!openh264.empty() && stat(openh264.c_str(), &st) == 0) {
+    key += "|" + std::to_string(st.st_size) + "|" +
+           std::to_string(st.st_mtime);
+  }
+  return key;
+}
+
+bool HasEngine(const sora::VideoCodecCapability& capability,
+               sora::VideoCodecImplementation name) {
+  for (const auto& engine : capability.engines) {
+    if (engine.name == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+VideoCodecCapabilityCache::VideoCodecCapabilityCache(std::string file)
+    : file_(std::move(file)) {}
+
+sora::VideoCodecCapability VideoCodecCapabilityCache::Get(
+    sora::VideoCodecCapabilityConfig& config) {
+  // 確認には時間がかかるけど、重複して確認しないようにロックしたまま行う
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!loaded_) {
+    Load();
+    loaded_ = true;
+  }
+
+  auto key = MakeKey(config.openh264_path ? *config.openh264_path : "");
+  auto it = capabilities_.find(key);
+  if (it != capabilities_.end()) {
+    // 覚えている結果に必要なコンテキストだけ作る
+    bool cuda =
+        HasEngine(it->second,
+                  sora::VideoCodecImplementation::kNvidiaVideoCodecSdk);
+    bool amf =
+        HasEngine(it->second, sora::VideoCodecImplementation::kAmdAmf);
+    CreateContexts(cuda, amf);
+    // ファイルを保存した後で GPU が使えなくなっていたら確認し直す
+    if ((cuda && cuda_context_ == nullptr) ||
+        (amf && amf_context_ == nullptr)) {
+      RTC_LOG(LS_WARNING) << "Cached video codec capability is stale";
+      capabilities_.erase(it);
+      it = capabilities_.end();
+    }
+  }
+  if (it == capabilities_.end()) {
+    CreateContexts(true, true);
+    sora::VideoCodecCapabilityConfig probe_config = config;
+    probe_config.cuda_context = cuda_context_;
+    probe_config.amf_context = amf_context_;
+    probe_config.get_custom_engines = nullptr;
+    it = capabilities_
+             .emplace(key, sora::GetVideoCodecCapability(probe_config))
+             .first;
+    Save();
+  }
+
+  config.cuda_context = cuda_context_;
+  config.amf_context = amf_context_;
+  auto capability = it->second;
+  if (config.get_custom_engines) {
+    for (auto& engine : config.get_custom_engines()) {
+      capability.engines.push_back(std::move(engine));
+    }
+  }
+  return capability;
+}
+
+void VideoCodecCapabilityCache::Load() {
+  if (file_.empty()) {
+    return;
+  }
+  std::ifstream ifs(file_);
+  if (!ifs) {
+    return;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  boost::system::error_code ec;
+  auto value = boost::json::parse(ss.str(), ec);
+  if (ec || !value.is_object()) {
+    RTC_LOG(LS_WARNING) << "Ignore invalid video codec capability cache: "
+                        << file_;
+    return;
+  }
+  const auto& obj = value.as_object();
+  auto version = obj.if_contains("version");
+  auto entries = obj.if_contains("entries");
+  if (version == nullptr || !version->is_int64() ||
+      version->as_int64() != kFileVersion || entries == nullptr ||
+      !entries->is_array()) {
+    return;
+  }
+  for (const auto& entry : entries->as_array()) {
+    try {
+      capabilities_[boost::json::value_to<std::string>(entry.at("key"))] =
+          boost::json::value_to<sora::VideoCodecCapability>(
+              entry.at("capability"));
+    } catch (const std::exception& e) {
+      RTC_LOG(LS_WARNING) << "Ignore invalid video codec capability cache "
+                             "entry: "
+                          << e.what();
+    }
+  }
+  RTC_LOG(LS_INFO) << "Loaded " << capabilities_.size()
+                   << " video codec capabilities from " << file_;
+}
+
+void VideoCodecCapabilityCache::Save() {
+  if (file_.empty()) {
+    return;
+  }
+  boost::json::array entries;
+  for (const auto& p : capabilities_) {
+    entries.push_back(boost::json::object{
+        {"key", p.first},
+        {"capability", boost::json::value_from(p.second)},
+    });
+  }
+  boost::json::object obj;
+  obj["version"] = kFileVersion;
+  obj["entries"] = std::move(entries);
+
+  // 他のプロセスが途中まで書いたファイルを読まないように、書き終えてから置き換える
+  std::string tmp = file_ + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream ofs(tmp);
+    ofs << boost::json::serialize(obj);
+    if (!ofs) {
+      RTC_LOG(LS_WARNING) << "Failed to write video codec capability cache: "
+                          << tmp;
+      std::remove(tmp.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmp.c_str(), file_.c_str()) != 0) {
+    RTC_LOG(LS_WARNING) << "Failed to write video codec capability cache: "
+                        << file_;
+    std::remove(tmp.c_str());
+  }
+}
+
+void VideoCodecCapabilityCache::CreateContexts(bool cuda, bool amf) {
+  if (cuda && !cuda_checked_) {
+    cuda_checked_ = true;
+    if (sora::CudaContext::CanCreate()) {
+      cuda_context_ = sora::CudaContext::Create();
+    }
+  }
+  if (amf && !amf_checked_) {
+    amf_checked_ = true;
+    if (sora::AMFContext::CanCreate()) {
+      amf_context_ = sora::AMFContext::Create();
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef VIDEO_CODEC_CAPABILITY_CACHE_H_
+#define VIDEO_CODEC_CAPABILITY_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Sora C++ SDK
+#include <sora/amf_context.h>
+#include <sora/cuda_context.h>
+#include <sora/sora_video_codec.h>
+
+// 映像のエンコーダーとデコーダーの対応状況の確認をプロセスで 1 回だけ行い、
+// 全てのインスタンスで共有する
+//
+// sora::GetVideoCodecCapability は実際にエンコーダーやデコーダーを作ったり
+// OpenH264 のライブラリを読み込んだりするので時間がかかる。
+// 結果は OpenH264 のパス毎に覚えておき、CUDA と AMF のコンテキストも共有する。
+// file を指定すると結果を保存して、次に起動した時はファイルから読み込む。
+class VideoCodecCapabilityCache {
+ public:
+  // file が空の場合はファイルに保存しない
+  explicit VideoCodecCapabilityCache(std::string file);
+
+  // config.openh264_path 毎の対応状況を返し、
+  // config に共有している CUDA と AMF のコンテキストを設定する
+  // config.get_custom_engines のエンジンは覚えずに、毎回結果に追加する
+  sora::VideoCodecCapability Get(sora::VideoCodecCapabilityConfig& config);
+
+ private:
+  void Load();
+  void Save();
+  void CreateContexts(bool cuda, bool amf);
+
+  std::string file_;
+  bool loaded_ = false;
+  // キーは MakeKey で作る
+  std::map<std::string, sora::VideoCodecCapability> capabilities_;
+  bool cuda_checked_ = false;
+  bool amf_checked_ = false;
+  std::shared_ptr<sora::CudaContext> cuda_context_;
+  std::shared_ptr<sora::AMFContext> amf_context_;
+  std::mutex mutex_;
+};
+
+#endif
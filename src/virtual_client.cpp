@@ -10,6 +10,8 @@
 #include <api/audio_codecs/builtin_audio_decoder_factory.h>
 #include <api/audio_codecs/builtin_audio_encoder_factory.h>
 #include <api/video_codecs/builtin_video_decoder_factory.h>
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtcstats_objects.h>
 #include <api/video_codecs/builtin_video_encoder_factory.h>
 #include <media/engine/webrtc_media_engine.h>
 #include <modules/audio_device/include/audio_device.h>
@@ -18,12 +20,74 @@
 #include <rtc_base/crypto_random.h>
 #include <rtc_base/logging.h>
 
+// Boost
+#include <boost/asio/post.hpp>
+
+#include "memory_usage.h"
+
+namespace {
+
+class RTCStatsCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  typedef std::function<void(
+      const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report)>
+      ResultCallback;
+
+  static webrtc::scoped_refptr<RTCStatsCallback> Create(
+      ResultCallback result_callback) {
+    return webrtc::make_ref_counted<RTCStatsCallback>(
+        std::move(result_callback));
+  }
+
+  void OnStatsDelivered(
+      const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    std::move(result_callback_)(report);
+  }
+
+ protected:
+  RTCStatsCallback(ResultCallback result_callback)
+      : result_callback_(std::move(result_callback)) {}
+  ~RTCStatsCallback() override = default;
+
+ private:
+  ResultCallback result_callback_;
+};
+
+void ApplyVideoEncoding(const VideoEncodingParameters& encoding,
+                        webrtc::RtpParameters& parameters) {
+  // サイマルキャストの場合は全てのエンコーディングに同じ設定を適用する
+  for (auto& e : parameters.encodings) {
+    if (encoding.max_bitrate_kbps) {
+      e.max_bitrate_bps = *encoding.max_bitrate_kbps * 1000;
+    }
+    if (encoding.max_framerate) {
+      e.max_framerate = *encoding.max_framerate;
+    }
+    if (encoding.scale_resolution_down_by) {
+      e.scale_resolution_down_by = *encoding.scale_resolution_down_by;
+    }
+  }
+}
+
+}  // namespace
+
 std::shared_ptr<VirtualClient> VirtualClient::Create(
-    VirtualClientConfig config) {
-  return std::shared_ptr<VirtualClient>(new VirtualClient(config));
+    std::shared_ptr<const VirtualClientConfig> config,
+    std::shared_ptr<NetworkShard> network_shard) {
+  return std::shared_ptr<VirtualClient>(
+      new VirtualClient(std::move(config), std::move(network_shard)));
 }
-VirtualClient::VirtualClient(const VirtualClientConfig& config)
-    : config_(config), retry_timer_(*config.sora_config.io_context) {}
+VirtualClient::VirtualClient(std::shared_ptr<const VirtualClientConfig> config,
+                             std::shared_ptr<NetworkShard> network_shard)
+    : config_(std::move(config)),
+      network_shard_(std::move(network_shard)),
+      context_(network_shard_->context()),
+      audio_enabled_(!config_->initial_mute_audio),
+      video_enabled_(!config_->initial_mute_video),
+      retry_timer_(*config_->sora_config.io_context),
+      dc_stats_timer_(*config_->sora_config.io_context),
+      dc_receive_stats_(config_->dc_stats_per_sender) {}
 
 void VirtualClient::Connect() {
   if (closing_) {
@@ -40,54 +104,80 @@ void VirtualClient::Connect() {
 
   retry_timer_.cancel();
 
-  if (config_.audio_type != VirtualClientConfig::AudioType::NoAudio) {
+  // 同時に接続処理できる数を制限している場合は、許可されるまで待つ
+  if (config_->admission != nullptr &&
+      admission_state_ != AdmissionState::InFlight) {
+    if (admission_state_ == AdmissionState::None) {
+      admission_state_ = AdmissionState::Queued;
+      config_->admission->Request(
+          *config_->sora_config.io_context,
+          [weak = weak_from_this(), admission = config_->admission]() {
+            auto self = weak.lock();
+            // 許可を待っている間に Close された
+            if (self == nullptr ||
+                self->admission_state_ != AdmissionState::Queued) {
+              admission->Release();
+              return;
+            }
+            self->admission_state_ = AdmissionState::InFlight;
+            self->connect_started_at_ = std::chrono::steady_clock::now();
+            self->Connect();
+          });
+    }
+    return;
+  }
+
+  // トラックは再接続しても作り直さずに使い回す
+  if (config_->audio_type != VirtualClientConfig::AudioType::NoAudio &&
+      audio_track_ == nullptr) {
     webrtc::AudioOptions ao;
-    if (config_.disable_echo_cancellation)
+    if (config_->disable_echo_cancellation)
       ao.echo_cancellation = false;
-    if (config_.disable_auto_gain_control)
+    if (config_->disable_auto_gain_control)
       ao.auto_gain_control = false;
-    if (config_.disable_noise_suppression)
+    if (config_->disable_noise_suppression)
       ao.noise_suppression = false;
-    if (config_.disable_highpass_filter)
+    if (config_->disable_highpass_filter)
       ao.highpass_filter = false;
     std::string audio_track_id = webrtc::CreateRandomString(16);
-    audio_track_ = config_.context->peer_connection_factory()->CreateAudioTrack(
-        audio_track_id, config_.context->peer_connection_factory()
-                            ->CreateAudioSource(ao)
-                            .get());
+    audio_track_ = context_->peer_connection_factory()->CreateAudioTrack(
+        audio_track_id,
+        context_->peer_connection_factory()->CreateAudioSource(ao).get());
   }
-  if (!config_.no_video_device) {
+  if (!config_->no_video_device && video_track_ == nullptr) {
     std::string video_track_id = webrtc::CreateRandomString(16);
-    video_track_ = config_.context->peer_connection_factory()->CreateVideoTrack(
-        config_.capturer, video_track_id);
+    video_track_ = context_->peer_connection_factory()->CreateVideoTrack(
+        config_->capturer, video_track_id);
 
-    if (config_.fixed_resolution) {
+    if (config_->fixed_resolution) {
       video_track_->set_content_hint(
           webrtc::VideoTrackInterface::ContentHint::kText);
     }
   }
 
-  sora::SoraSignalingConfig config = config_.sora_config;
-  config.pc_factory = config_.context->peer_connection_factory();
+  sora::SoraSignalingConfig config = config_->sora_config;
+  config.pc_factory = context_->peer_connection_factory();
   config.observer = shared_from_this();
   config.network_manager =
-      config_.context->signaling_thread()->BlockingCall([this]() {
-        return config_.context->connection_context()->default_network_manager();
-      });
-  config.socket_factory =
-      config_.context->signaling_thread()->BlockingCall([this]() {
-        return config_.context->connection_context()->default_socket_factory();
+      network_shard_->signaling_thread()->BlockingCall([this]() {
+        return context_->connection_context()->default_network_manager();
       });
+  config.socket_factory = network_shard_->socket_factory();
 
   signaling_ = sora::SoraSignaling::Create(config);
   signaling_->Connect();
 }
 
 void VirtualClient::Close(std::function<void(std::string)> on_close) {
+  // Close の後に Connect が呼ばれるまでは再接続しない
+  need_reconnect_ = false;
+  if (admission_state_ == AdmissionState::Queued) {
+    admission_state_ = AdmissionState::None;
+  }
   if (closing_) {
     if (on_close_ == nullptr) {
       on_close_ = on_close;
-    } else {
+    } else if (on_close) {
       on_close("already closing");
     }
     return;
@@ -97,48 +187,243 @@ void VirtualClient::Close(std::function<void(std::string)> on_close) {
     on_close_ = on_close;
     signaling_->Disconnect();
   } else {
-    on_close("already closed");
+    // 再接続を待っている場合はそれも止める
+    retry_timer_.cancel();
+    if (on_close) {
+      on_close("already closed");
+    }
   }
 }
 
 void VirtualClient::Clear() {
+  if (admission_state_ == AdmissionState::InFlight) {
+    config_->admission->Release();
+  }
+  admission_state_ = AdmissionState::None;
   retry_timer_.cancel();
+  dc_stats_timer_.cancel();
+  dc_stats_polling_ = false;
   signaling_.reset();
 }
 
-void VirtualClient::SendMessage(const std::string& label,
+bool VirtualClient::SendMessage(const std::string& label,
                                 const std::string& data) {
   if (signaling_ == nullptr || closing_) {
+    return false;
+  }
+  auto it = dc_send_queues_.find(label);
+  if (it == dc_send_queues_.end()) {
+    it = dc_send_queues_
+             .emplace(label,
+                      DataChannelSendQueue(config_->dc_backpressure, label))
+             .first;
+  }
+  bool sent = it->second.Send(data, [this, &label](const std::string& data) {
+    return signaling_->SendDataChannel(label, data);
+  });
+  // 送信中のメッセージがある間だけ統計情報を取得する
+  if (!dc_stats_polling_ && it->second.HasInFlight()) {
+    StartDataChannelStatsTimer();
+  }
+  return sent;
+}
+
+void VirtualClient::StartDataChannelStatsTimer() {
+  dc_stats_polling_ = true;
+  dc_stats_timer_.expires_after(
+      std::chrono::milliseconds(config_->dc_backpressure.poll_interval_ms));
+  dc_stats_timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      return;
+    }
+    if (signaling_ == nullptr || signaling_->GetPeerConnection() == nullptr) {
+      dc_stats_polling_ = false;
+      return;
+    }
+    // 統計情報は signaling スレッドで返ってくるので、このスレッドに戻す
+    auto ioc = config_->sora_config.io_context;
+    signaling_->GetPeerConnection()->GetStats(
+        RTCStatsCallback::Create(
+            [ioc, weak = weak_from_this(), connection_id = connection_id_](
+                const webrtc::scoped_refptr<const webrtc::RTCStatsReport>&
+                    report) {
+              std::map<std::string, uint64_t> messages_sent;
+              for (const auto* st :
+                   report->GetStatsOfType<webrtc::RTCDataChannelStats>()) {
+                if (st->label && st->messages_sent) {
+                  messages_sent[*st->label] = *st->messages_sent;
+                }
+              }
+              boost::asio::post(*ioc, [weak, connection_id, messages_sent]() {
+                auto self = weak.lock();
+                // 再接続していたら古い接続の統計なので捨てる
+                if (self == nullptr || self->connection_id_ != connection_id) {
+                  return;
+                }
+                self->OnDataChannelStats(messages_sent);
+              });
+            })
+            .get());
+  });
+}
+
+void VirtualClient::OnDataChannelStats(
+    std::map<std::string, uint64_t> messages_sent) {
+  dc_stats_polling_ = false;
+  if (signaling_ == nullptr || closing_) {
+    return;
+  }
+  bool in_flight = false;
+  for (auto& p : dc_send_queues_) {
+    auto it = messages_sent.find(p.first);
+    if (it != messages_sent.end()) {
+      const std::string& label = p.first;
+      p.second.OnMessagesSent(it->second,
+                              [this, &label](const std::string& data) {
+                                return signaling_->SendDataChannel(label,
+                                                                   data);
+                              });
+    }
+    in_flight = in_flight || p.second.HasInFlight();
+  }
+  if (in_flight) {
+    StartDataChannelStatsTimer();
+  }
+}
+
+void VirtualClient::SetAudioEnabled(bool enabled) {
+  audio_enabled_ = enabled;
+  if (audio_track_ == nullptr) {
+    return;
+  }
+  // トラックの状態変更は signaling スレッドで行う
+  network_shard_->signaling_thread()->PostTask(
+      [track = audio_track_, enabled]() { track->set_enabled(enabled); });
+}
+
+void VirtualClient::SetAudioActive(bool active) {
+  audio_active_ = active;
+  if (audio_sender_ == nullptr) {
+    return;
+  }
+  network_shard_->signaling_thread()->PostTask(
+      [sender = audio_sender_, active]() {
+        webrtc::RtpParameters parameters = sender->GetParameters();
+        if (parameters.encodings.empty()) {
+          return;
+        }
+        parameters.encodings[0].active = active;
+        sender->SetParameters(parameters);
+      });
+}
+
+void VirtualClient::SetVideoEnabled(bool enabled) {
+  video_enabled_ = enabled;
+  if (video_track_ == nullptr) {
+    return;
+  }
+  network_shard_->signaling_thread()->PostTask(
+      [track = video_track_, enabled]() { track->set_enabled(enabled); });
+}
+
+void VirtualClient::SetVideoEncoding(const VideoEncodingParameters& params) {
+  if (params.max_bitrate_kbps) {
+    video_encoding_.max_bitrate_kbps = params.max_bitrate_kbps;
+  }
+  if (params.max_framerate) {
+    video_encoding_.max_framerate = params.max_framerate;
+  }
+  if (params.scale_resolution_down_by) {
+    video_encoding_.scale_resolution_down_by = params.scale_resolution_down_by;
+  }
+  if (video_sender_ == nullptr) {
     return;
   }
-  signaling_->SendDataChannel(label, data);
+  network_shard_->signaling_thread()->PostTask(
+      [sender = video_sender_, encoding = video_encoding_]() {
+        webrtc::RtpParameters parameters = sender->GetParameters();
+        ApplyVideoEncoding(encoding, parameters);
+        sender->SetParameters(parameters);
+      });
+}
+
+uint64_t VirtualClient::NextDataChannelCounter(int label_id) {
+  if (label_id >= dc_counter_.size()) {
+    dc_counter_.resize(label_id + 1);
+  }
+  return dc_counter_[label_id]++;
+}
+
+const std::string& VirtualClient::GetConnectionID() const {
+  return connection_id_;
 }
 
 VirtualClientStats VirtualClient::GetStats() const {
+  VirtualClientStats st;
+  st.memory = GetMemory();
   if (signaling_ == nullptr) {
-    return VirtualClientStats();
+    return st;
   }
-  VirtualClientStats st;
-  st.channel_id = config_.sora_config.channel_id;
+  st.channel_id = config_->sora_config.channel_id;
   st.connection_id = signaling_->GetConnectionID();
   st.connected_url = signaling_->GetConnectedSignalingURL();
   st.datachannel_connected = signaling_->IsConnectedDataChannel();
   st.websocket_connected = signaling_->IsConnectedWebsocket();
+  st.data_channel_receive = dc_receive_stats_.Get();
+  st.data_channel_unknown_messages = dc_receive_stats_.GetUnknownMessages();
+  for (const auto& p : dc_send_queues_) {
+    st.data_channel_send.push_back(p.second.GetStats());
+  }
   return st;
 }
 
+VirtualClientMemory VirtualClient::GetMemory() const {
+  VirtualClientMemory m;
+  m.client_bytes = sizeof(VirtualClient) + StringHeapBytes(connection_id_) +
+                   dc_counter_.capacity() * sizeof(uint64_t);
+  m.data_channel_bytes = dc_receive_stats_.GetMemoryUsage();
+  for (const auto& p : dc_send_queues_) {
+    // map のノードはキーと値の他にポインタ 3 つと色を持つ
+    m.data_channel_bytes += sizeof(std::string) + 4 * sizeof(void*) +
+                            StringHeapBytes(p.first) +
+                            p.second.GetMemoryUsage();
+  }
+  if (signaling_ != nullptr) {
+    m.signalings = 1;
+    m.signaling_config_bytes = config_->sora_config_bytes;
+    if (signaling_->GetPeerConnection() != nullptr) {
+      m.peer_connections = 1;
+    }
+  }
+  m.audio_tracks = audio_track_ != nullptr ? 1 : 0;
+  m.video_tracks = video_track_ != nullptr ? 1 : 0;
+  return m;
+}
+
 void VirtualClient::OnSetOffer(std::string offer) {
+  connection_id_ = signaling_->GetConnectionID();
   std::string stream_id = webrtc::CreateRandomString(16);
   if (audio_track_ != nullptr) {
-    if (config_.initial_mute_audio) {
+    if (!audio_enabled_) {
       audio_track_->set_enabled(false);
     }
     webrtc::RTCErrorOr<webrtc::scoped_refptr<webrtc::RtpSenderInterface>>
         audio_result = signaling_->GetPeerConnection()->AddTrack(audio_track_,
                                                                  {stream_id});
+    if (audio_result.ok()) {
+      audio_sender_ = audio_result.value();
+      // 再接続した場合も、無音の間は送信しないままにする
+      if (!audio_active_) {
+        webrtc::RtpParameters parameters = audio_sender_->GetParameters();
+        if (!parameters.encodings.empty()) {
+          parameters.encodings[0].active = false;
+          audio_sender_->SetParameters(parameters);
+        }
+      }
+    }
   }
   if (video_track_ != nullptr) {
-    if (config_.initial_mute_video) {
+    if (!video_enabled_) {
       video_track_->set_enabled(false);
     }
     webrtc::RTCErrorOr<webrtc::scoped_refptr<webrtc::RtpSenderInterface>>
@@ -148,32 +433,67 @@ void VirtualClient::OnSetOffer(std::string offer) {
       webrtc::scoped_refptr<webrtc::RtpSenderInterface> video_sender =
           video_result.value();
       webrtc::RtpParameters parameters = video_sender->GetParameters();
-      if (config_.priority == "FRAMERATE") {
+      if (config_->priority == "FRAMERATE") {
         parameters.degradation_preference =
             webrtc::DegradationPreference::MAINTAIN_RESOLUTION;
-      } else if (config_.priority == "RESOLUTION") {
+      } else if (config_->priority == "RESOLUTION") {
         parameters.degradation_preference =
             webrtc::DegradationPreference::MAINTAIN_FRAMERATE;
       } else {
         parameters.degradation_preference =
             webrtc::DegradationPreference::BALANCED;
       }
+      ApplyVideoEncoding(video_encoding_, parameters);
       video_sender->SetParameters(parameters);
+      video_sender_ = video_sender;
     }
   }
+
+  // 受信側で遅延を計測できるように abs-capture-time ヘッダー拡張を有効にする
+  // Sora のオファーに含まれている場合のみネゴシエーションされる
+  for (const auto& transceiver :
+       signaling_->GetPeerConnection()->GetTransceivers()) {
+    if (transceiver->media_type() != webrtc::MediaType::VIDEO) {
+      continue;
+    }
+    auto extensions = transceiver->GetHeaderExtensionsToNegotiate();
+    for (auto& extension : extensions) {
+      if (extension.uri == webrtc::RtpExtension::kAbsoluteCaptureTimeUri) {
+        extension.direction = webrtc::RtpTransceiverDirection::kSendRecv;
+      }
+    }
+    transceiver->SetHeaderExtensionsToNegotiate(extensions);
+  }
 }
 void VirtualClient::OnDisconnect(sora::SoraSignalingErrorCode ec,
                                  std::string message) {
+  if (closing_) {
+    // Close や再接続のために自分から切断した場合は、接続の失敗として数えずに枠を返す
+    if (admission_state_ == AdmissionState::InFlight) {
+      admission_state_ = AdmissionState::None;
+      config_->admission->Release();
+    }
+  } else {
+    FinishAdmission(false);
+  }
+  connection_id_.clear();
+  audio_sender_ = nullptr;
+  video_sender_ = nullptr;
+  dc_stats_timer_.cancel();
+  dc_stats_polling_ = false;
+  for (auto& p : dc_send_queues_) {
+    p.second.Reset();
+  }
   signaling_.reset();
   retry_timer_.cancel();
 
   if (!closing_) {
     // VirtualClient の外から明示的に呼び出されていない、つまり不意に接続が切れた場合にここに来る
     // この場合は、設定次第で再接続を試みる
-    if (retry_count_ < config_.max_retry) {
+    if (retry_count_ < config_->max_retry) {
       retry_count_ += 1;
       retry_timer_.expires_after(
-          std::chrono::milliseconds((int)(config_.retry_interval * 1000)));
+          std::chrono::milliseconds((int)(config_->retry_interval * 1000)));
       retry_timer_.async_wait([this](boost::system::error_code ec) {
         if (ec) {
           return;
@@ -199,6 +519,10 @@ void VirtualClient::OnDisconnect(sora::SoraSignalingErrorCode ec,
     on_close_ = nullptr;
   }
 }
+void VirtualClient::OnMessage(std::string label, std::string data) {
+  dc_receive_stats_.OnMessage(label, data);
+}
+
 void VirtualClient::OnNotify(std::string text) {
   auto json = boost::json::parse(text);
   if (json.at("event_type").as_string() == "connection.created") {
@@ -206,5 +530,21 @@ void VirtualClient::OnNotify(std::string text) {
     // 他人が接続された時もリセットされることになるけど、
     // その時は 0 のままになってるはずなので問題ない
     retry_count_ = 0;
+    const auto& obj = json.as_object();
+    auto it = obj.find("connection_id");
+    if (it != obj.end() && it->value().is_string() &&
+        it->value().as_string() == connection_id_) {
+      FinishAdmission(true);
+    }
+  }
+}
+
+void VirtualClient::FinishAdmission(bool success) {
+  if (admission_state_ != AdmissionState::InFlight) {
+    return;
   }
+  admission_state_ = AdmissionState::None;
+  config_->admission->Done(
+      success, std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - connect_started_at_));
 }
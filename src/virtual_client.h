@@ -1,7 +1,11 @@
 #ifndef VIRTUAL_CLIENT_H_
 #define VIRTUAL_CLIENT_H_
 
+#include <chrono>
+#include <map>
 #include <memory>
+#include <optional>
+#include <vector>
 
 // Sora C++ SDK
 #include <sora/sora_client_context.h>
@@ -10,19 +14,58 @@
 // Boost
 #include <boost/asio/io_context.hpp>
 
+#include "admission_controller.h"
+#include "data_channel_backpressure.h"
+#include "data_channel_stats.h"
+#include "network_shard.h"
 #include "zakuro_audio_device_module.h"
 
+// 仮想クライアント 1 つが使っているメモリの内訳
+// libwebrtc と Sora C++ SDK の中で確保しているメモリは測れないので、
+// 生きているオブジェクトの数を返す
+struct VirtualClientMemory {
+  // VirtualClient 自体と、接続毎に持っている状態
+  size_t client_bytes = 0;
+  // 接続中の SoraSignaling が持っている SoraSignalingConfig のコピー
+  size_t signaling_config_bytes = 0;
+  // DataChannel の送信待ちのメッセージと受信統計
+  size_t data_channel_bytes = 0;
+  // ScenarioPlayer がこの仮想クライアントのために持っている状態
+  size_t scenario_bytes = 0;
+  int signalings = 0;
+  int peer_connections = 0;
+  int audio_tracks = 0;
+  int video_tracks = 0;
+};
+
 struct VirtualClientStats {
   std::string channel_id;
   std::string connection_id;
   std::string connected_url;
   bool websocket_connected = false;
   bool datachannel_connected = false;
+  std::vector<DataChannelReceiveStatsEntry> data_channel_receive;
+  uint64_t data_channel_unknown_messages = 0;
+  std::vector<DataChannelSendStats> data_channel_send;
+  // 接続していなくても設定される
+  VirtualClientMemory memory;
+};
+
+// シナリオから変更する映像の送信設定
+// 値が無い項目は変更しない
+struct VideoEncodingParameters {
+  std::optional<int> max_bitrate_kbps;
+  std::optional<double> max_framerate;
+  std::optional<double> scale_resolution_down_by;
 };
 
+// インスタンス内の全ての仮想クライアントで 1 つを共有するので、
+// 仮想クライアント毎に変わる値は入れないこと
 struct VirtualClientConfig {
   webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> capturer;
   sora::SoraSignalingConfig sora_config;
+  // 接続する度に sora_config をコピーするので、そのコピーが使うメモリの見積もり
+  size_t sora_config_bytes = 0;
 
   int max_retry = 0;
   double retry_interval = 60;
@@ -55,27 +98,53 @@ struct VirtualClientConfig {
 
   std::string openh264;
 
-  std::shared_ptr<sora::SoraClientContext> context;
+  DataChannelBackpressureConfig dc_backpressure;
+  bool dc_stats_per_sender = false;
+  // nullptr の場合は接続処理の数を制限しない
+  std::shared_ptr<AdmissionController> admission;
 };
 
 class VirtualClient : public std::enable_shared_from_this<VirtualClient>,
                       public sora::SoraSignalingObserver {
  public:
-  static std::shared_ptr<VirtualClient> Create(VirtualClientConfig config);
+  // network_shard のコンテキストを使い、そのネットワークスレッドのソケットで接続する
+  static std::shared_ptr<VirtualClient> Create(
+      std::shared_ptr<const VirtualClientConfig> config,
+      std::shared_ptr<NetworkShard> network_shard);
 
   void Connect();
   void Close(std::function<void(std::string)> on_close = nullptr);
   void Clear();
-  void SendMessage(const std::string& label, const std::string& data);
+  // SendDataChannel に渡した場合は true を返す
+  // 接続していない場合や、バックプレッシャーで破棄したり保留したりした場合は false
+  bool SendMessage(const std::string& label, const std::string& data);
+  // 音声トラックの有効/無効を切り替える
+  // 無効にすると無音（全サンプル 0）が送信される
+  void SetAudioEnabled(bool enabled);
+  // 音声の送信エンコーディングの active を切り替える
+  // false の間は音声の RTP を送信しない
+  void SetAudioActive(bool active);
+  // 映像トラックの有効/無効を切り替える
+  // 無効にすると黒いフレームが送信される
+  void SetVideoEnabled(bool enabled);
+  // 映像の送信設定を変更する
+  // 再接続した後も同じ設定を使う
+  void SetVideoEncoding(const VideoEncodingParameters& params);
+  // 送信する DataChannel メッセージのヘッダーに入れるカウンターを払い出す
+  // 受信側で欠落や順序の入れ替わりを検出するため、ラベル毎に連番になっている
+  // label_id は CompiledScenario::Symbols::labels のインデックス
+  uint64_t NextDataChannelCounter(int label_id);
 
   VirtualClientStats GetStats() const;
+  // 接続中でなければ空文字列を返す
+  const std::string& GetConnectionID() const;
 
   void OnSetOffer(std::string offer) override;
   void OnDisconnect(sora::SoraSignalingErrorCode ec,
                     std::string message) override;
   void OnNotify(std::string text) override;
   void OnPush(std::string text) override {}
-  void OnMessage(std::string label, std::string data) override {}
+  void OnMessage(std::string label, std::string data) override;
 
   void OnTrack(webrtc::scoped_refptr<webrtc::RtpTransceiverInterface>
                    transceiver) override {}
@@ -85,17 +154,50 @@ class VirtualClient : public std::enable_shared_from_this<VirtualClient>,
   void OnDataChannel(std::string label) override {}
 
  private:
-  VirtualClient(const VirtualClientConfig& config);
-
-  VirtualClientConfig config_;
+  VirtualClient(std::shared_ptr<const VirtualClientConfig> config,
+                std::shared_ptr<NetworkShard> network_shard);
+
+  // 接続処理が終わったら AdmissionController に結果を返す
+  void FinishAdmission(bool success);
+  VirtualClientMemory GetMemory() const;
+  void StartDataChannelStatsTimer();
+  void OnDataChannelStats(std::map<std::string, uint64_t> messages_sent);
+
+  std::shared_ptr<const VirtualClientConfig> config_;
+  std::shared_ptr<NetworkShard> network_shard_;
+  std::shared_ptr<sora::SoraClientContext> context_;
   bool closing_ = false;
+  bool audio_enabled_ = true;
+  bool audio_active_ = true;
+  bool video_enabled_ = true;
+  VideoEncodingParameters video_encoding_;
   bool need_reconnect_ = false;
   int retry_count_ = 0;
   std::function<void(std::string)> on_close_;
+  enum class AdmissionState {
+    None,
+    // AdmissionController の許可を待っている
+    Queued,
+    // 許可されて接続処理中
+    InFlight,
+  };
+  AdmissionState admission_state_ = AdmissionState::None;
+  std::chrono::steady_clock::time_point connect_started_at_;
   boost::asio::steady_timer retry_timer_;
+  boost::asio::steady_timer dc_stats_timer_;
+  // dc_stats_timer_ を待っているか、統計情報の取得中
+  bool dc_stats_polling_ = false;
   std::shared_ptr<sora::SoraSignaling> signaling_;
   webrtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
   webrtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
+  webrtc::scoped_refptr<webrtc::RtpSenderInterface> audio_sender_;
+  webrtc::scoped_refptr<webrtc::RtpSenderInterface> video_sender_;
+  // OnSetOffer で確定し、OnDisconnect でクリアする
+  std::string connection_id_;
+  // ラベル ID 毎のカウンター
+  std::vector<uint64_t> dc_counter_;
+  DataChannelReceiveStats dc_receive_stats_;
+  std::map<std::string, DataChannelSendQueue> dc_send_queues_;
 };
 
 #endif
@@ -0,0 +1,276 @@
+#include "worker.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "プロセス間で共有するにはロックフリーである必要がある");
+
+struct WorkerStatsRing::Header {
+  // 最新のスロットの番号 + 1。0 ならまだ書き込まれていない
+  std::atomic<uint64_t> latest;
+  // 書き込んだ回数
+  std::atomic<uint64_t> writes;
+  // 最後の書き込みが slot_size を超えていたら 1
+  std::atomic<int32_t> truncated;
+  std::atomic<uint64_t> truncated_count;
+  std::atomic<uint64_t> truncated_size;
+  std::atomic<int32_t> pid;
+  std::atomic<int32_t> state;
+  std::atomic<int32_t> status;
+};
+
+struct WorkerStatsRing::Slot {
+  // 書き込み中は奇数になる
+  std::atomic<uint64_t> seq;
+  std::atomic<uint64_t> size;
+  std::atomic<int64_t> written_at_ms;
+  // この後ろに slot_size バイトのデータが続く
+};
+
+namespace {
+
+constexpr size_t kAlignment = 64;
+
+size_t Align(size_t n) {
+  return (n + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// シグナルハンドラから参照するので、Wait の間だけ設定する
+pid_t* g_worker_pids = nullptr;
+int g_worker_count = 0;
+
+void ForwardSignal(int sig) {
+  for (int i = 0; i < g_worker_count; i++) {
+    if (g_worker_pids[i] > 0) {
+      kill(g_worker_pids[i], sig);
+    }
+  }
+}
+
+}  // namespace
+
+std::shared_ptr<WorkerStatsRing> WorkerStatsRing::Create(int workers,
+                                                         size_t slot_size) {
+  std::shared_ptr<WorkerStatsRing> ring(new WorkerStatsRing());
+  ring->workers_ = workers;
+  ring->slot_size_ = slot_size;
+  ring->worker_size_ =
+      Align(sizeof(Header)) + kSlots * Align(sizeof(Slot) + slot_size);
+  ring->memory_size_ = workers * ring->worker_size_;
+  // 実際に書き込むまで物理メモリは割り当てられない
+  void* p = mmap(nullptr, ring->memory_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+  ring->memory_ = p;
+  for (int i = 0; i < workers; i++) {
+    new (ring->GetHeader(i)) Header();
+    for (int j = 0; j < kSlots; j++) {
+      new (ring->GetSlot(i, j)) Slot();
+    }
+  }
+  return ring;
+}
+
+WorkerStatsRing::~WorkerStatsRing() {
+  if (memory_ != nullptr) {
+    munmap(memory_, memory_size_);
+  }
+}
+
+WorkerStatsRing::Header* WorkerStatsRing::GetHeader(int worker) const {
+  return (Header*)((char*)memory_ + worker * worker_size_);
+}
+
+WorkerStatsRing::Slot* WorkerStatsRing::GetSlot(int worker, int slot) const {
+  return (Slot*)((char*)GetHeader(worker) + Align(sizeof(Header)) +
+                 slot * Align(sizeof(Slot) + slot_size_));
+}
+
+bool WorkerStatsRing::Write(int worker, const std::string& data) {
+  Header* h = GetHeader(worker);
+  if (data.size() > slot_size_) {
+    h->truncated_count.fetch_add(1, std::memory_order_relaxed);
+    h->truncated_size.store(data.size(), std::memory_order_relaxed);
+    h->truncated.store(1, std::memory_order_release);
+    return false;
+  }
+  // 書き込むのは 1 つのワーカーの 1 つのスレッドだけ
+  uint64_t n = h->writes.fetch_add(1, std::memory_order_relaxed);
+  Slot* s = GetSlot(worker, n % kSlots);
+  s->seq.fetch_add(1, std::memory_order_acq_rel);
+  std::atomic_thread_fence(std::memory_order_release);
+  s->size.store(data.size(), std::memory_order_relaxed);
+  s->written_at_ms.store(NowMs(), std::memory_order_relaxed);
+  std::memcpy((char*)s + sizeof(Slot), data.data(), data.size());
+  s->seq.fetch_add(1, std::memory_order_release);
+  h->latest.store(n % kSlots + 1, std::memory_order_release);
+  h->truncated.store(0, std::memory_order_release);
+  return true;
+}
+
+bool WorkerStatsRing::Read(int worker,
+                           std::string& data,
+                           int64_t* age_ms) const {
+  const Header* h = GetHeader(worker);
+  // 書き込みと重なったら読み直す
+  while (true) {
+    uint64_t latest = h->latest.load(std::memory_order_acquire);
+    if (latest == 0) {
+      return false;
+    }
+    const Slot* s = GetSlot(worker, latest - 1);
+    uint64_t seq = s->seq.load(std::memory_order_acquire);
+    if (seq % 2 != 0) {
+      continue;
+    }
+    size_t size = std::min<size_t>(s->size.load(std::memory_order_relaxed),
+                                   slot_size_);
+    int64_t written_at_ms = s->written_at_ms.load(std::memory_order_relaxed);
+    data.assign((const char*)s + sizeof(Slot), size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s->seq.load(std::memory_order_relaxed) != seq) {
+      continue;
+    }
+    if (age_ms != nullptr) {
+      *age_ms = NowMs() - written_at_ms;
+    }
+    return true;
+  }
+}
+
+WorkerStatsRing::Truncation WorkerStatsRing::GetTruncation(int worker) const {
+  const Header* h = GetHeader(worker);
+  Truncation t;
+  t.truncated = h->truncated.load(std::memory_order_acquire) != 0;
+  t.count = h->truncated_count.load(std::memory_order_relaxed);
+  t.last_size = h->truncated_size.load(std::memory_order_relaxed);
+  return t;
+}
+
+void WorkerStatsRing::SetWorkerState(int worker, const WorkerState& state) {
+  Header* h = GetHeader(worker);
+  h->pid.store(state.pid);
+  h->status.store(state.status);
+  h->state.store((int32_t)state.state);
+}
+
+WorkerStatsRing::WorkerState WorkerStatsRing::GetWorkerState(
+    int worker) const {
+  const Header* h = GetHeader(worker);
+  WorkerState st;
+  st.pid = h->pid.load();
+  st.state = (State)h->state.load();
+  st.status = h->status.load();
+  return st;
+}
+
+int Workers::Fork(int workers, std::shared_ptr<WorkerStatsRing> ring) {
+#if defined(__linux__)
+  pid_t parent = getpid();
+#endif
+  for (int i = 0; i < workers; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+#if defined(__linux__)
+      // 親プロセスが SIGKILL などで死んだ場合に、ワーカープロセスが
+      // 残り続けないようにする
+      // prctl の前に親プロセスが死んでいた場合は届かないので自分で終了する
+      if (prctl(PR_SET_PDEATHSIG, SIGTERM) != 0 || getppid() != parent) {
+        _exit(1);
+      }
+#endif
+      return i;
+    }
+    if (pid < 0) {
+      std::cerr << "failed to fork worker " << i << ": "
+                << std::strerror(errno) << std::endl;
+      for (int j = 0; j < i; j++) {
+        pid_t p = ring->GetWorkerState(j).pid;
+        kill(p, SIGTERM);
+        waitpid(p, nullptr, 0);
+      }
+      return -2;
+    }
+    ring->SetWorkerState(i, {pid, WorkerStatsRing::State::Running, 0});
+  }
+  return -1;
+}
+
+int Workers::Wait(std::shared_ptr<WorkerStatsRing> ring,
+                  std::function<void(int worker)> on_exit) {
+  int workers = ring->GetWorkerCount();
+  std::vector<pid_t> pids(workers);
+  for (int i = 0; i < workers; i++) {
+    pids[i] = ring->GetWorkerState(i).pid;
+  }
+  g_worker_pids = pids.data();
+  g_worker_count = workers;
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = ForwardSignal;
+  sigemptyset(&sa.sa_mask);
+  struct sigaction old_int, old_term;
+  sigaction(SIGINT, &sa, &old_int);
+  sigaction(SIGTERM, &sa, &old_term);
+
+  int result = 0;
+  int running = workers;
+  while (running > 0) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (int i = 0; i < workers; i++) {
+      if (pids[i] != pid) {
+        continue;
+      }
+      pids[i] = 0;
+      running -= 1;
+      ring->SetWorkerState(i, {pid, WorkerStatsRing::State::Exited, status});
+      if (WIFSIGNALED(status)) {
+        std::cerr << "[worker " << i << "] killed by signal "
+                  << WTERMSIG(status) << std::endl;
+        result = 1;
+      } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        std::cerr << "[worker " << i << "] exited with code "
+                  << WEXITSTATUS(status) << std::endl;
+        result = 1;
+      }
+      if (on_exit) {
+        on_exit(i);
+      }
+    }
+  }
+
+  sigaction(SIGINT, &old_int, nullptr);
+  sigaction(SIGTERM, &old_term, nullptr);
+  g_worker_pids = nullptr;
+  g_worker_count = 0;
+  return result;
+}
@@ -0,0 +1,98 @@
+#ifndef WORKER_H_
+#define WORKER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+// --workers で起動したワーカープロセスから親プロセスに統計を渡す共有メモリ
+//
+// fork する前に作り、親プロセスとワーカープロセスで同じメモリを参照する。
+// ワーカー毎に統計の JSON を入れるスロットのリングを持ち、ワーカーは
+// 次のスロットに書き込んでから最新のスロットの位置を更新する。
+// 親プロセスは最新のスロットを読み、読んでいる間に書き換えられていたら
+// 読み直す（seqlock）。
+class WorkerStatsRing {
+ public:
+  // ワーカー 1 つあたりのスロット数
+  static constexpr int kSlots = 4;
+
+  // slot_size は 1 回に書き込める JSON の最大サイズ
+  // 失敗した場合は nullptr を返す
+  static std::shared_ptr<WorkerStatsRing> Create(int workers,
+                                                 size_t slot_size);
+  ~WorkerStatsRing();
+
+  int GetWorkerCount() const { return workers_; }
+
+  // ワーカープロセスから統計を書き込む
+  // slot_size を超える場合は書き込まずに false を返し、GetTruncation で
+  // 親プロセスから分かるようにする
+  bool Write(int worker, const std::string& data);
+  // 親プロセスから最新の統計を読む
+  // まだ書き込まれていない場合は false を返す
+  // age_ms には書き込まれてからの経過時間が入る
+  bool Read(int worker, std::string& data, int64_t* age_ms = nullptr) const;
+
+  enum class State {
+    Starting,
+    Running,
+    Exited,
+  };
+  struct WorkerState {
+    pid_t pid;
+    State state;
+    // waitpid で取得したステータス
+    int status;
+  };
+  struct Truncation {
+    // 最後の書き込みが slot_size を超えていて、読める統計が古いままか
+    bool truncated;
+    // slot_size を超えて書き込めなかった回数と、最後のその時のサイズ
+    uint64_t count;
+    uint64_t last_size;
+  };
+  Truncation GetTruncation(int worker) const;
+
+  // 親プロセスからワーカーの状態を設定する
+  void SetWorkerState(int worker, const WorkerState& state);
+  WorkerState GetWorkerState(int worker) const;
+
+ private:
+  struct Header;
+  struct Slot;
+
+  WorkerStatsRing() = default;
+  Header* GetHeader(int worker) const;
+  Slot* GetSlot(int worker, int slot) const;
+
+  int workers_ = 0;
+  size_t slot_size_ = 0;
+  size_t worker_size_ = 0;
+  void* memory_ = nullptr;
+  size_t memory_size_ = 0;
+};
+
+class Workers {
+ public:
+  // workers 個のワーカープロセスを fork する
+  // ワーカープロセスでは自分の番号を、親プロセスでは -1 を返す
+  // Linux では親プロセスが異常終了した場合にワーカープロセスに SIGTERM が届く
+  // fork に失敗した場合は作ったワーカープロセスを止めて -2 を返す
+  // スレッドを作る前に呼ぶこと
+  static int Fork(int workers, std::shared_ptr<WorkerStatsRing> ring);
+  // 全てのワーカープロセスが終了するまで待つ
+  // 親プロセスが SIGINT や SIGTERM を受け取ったらワーカープロセスに送る
+  // on_exit はワーカープロセスが終了する度に呼ばれる
+  // 全てのワーカープロセスが正常に終了したら 0 を返す
+  static int Wait(std::shared_ptr<WorkerStatsRing> ring,
+                  std::function<void(int worker)> on_exit);
+};
+
+#endif
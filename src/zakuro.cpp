@@ -1,5 +1,6 @@
 #include "zakuro.h"
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <csignal>
@@ -14,14 +15,20 @@
 #include <api/enable_media.h>
 #include <api/environment/environment_factory.h>
 #include <api/video_codecs/video_codec.h>
+#include <api/video_codecs/video_decoder_factory.h>
 
 // Sora C++ SDK
 #include <sora/camera_device_capturer.h>
+#include <sora/sora_video_codec_factory.h>
 #include <sora/sora_video_encoder_factory.h>
 
 #include "fake_audio_key_trigger.h"
 #include "fake_video_capturer.h"
+#include "memory_usage.h"
+#include "network_shard.h"
 #include "nop_video_decoder.h"
+#include "sampled_video_decoder.h"
+#include "scenario_parser.h"
 #include "scenario_player.h"
 #include "util.h"
 #include "virtual_client.h"
@@ -42,6 +49,17 @@ struct DataChannels {
     int interval = 500;
     int size_min = MESSAGE_SIZE_MIN;
     int size_max = MESSAGE_SIZE_MIN;
+    // rate か bit-rate が指定されていれば interval の代わりにこちらを使う
+    double rate = 0;
+    double bit_rate = 0;
+    DataChannelTraffic::SizeDistribution size_distribution =
+        DataChannelTraffic::SizeDistribution::Uniform;
+    double size_sigma = 1.0;
+    double bimodal_ratio = 0.1;
+    int burst_on = 0;
+    int burst_off = 0;
+    BinaryPool::Payload payload = BinaryPool::Payload::Random;
+    double payload_random_ratio = 0.5;
   };
   std::vector<Channel> channels;
   std::vector<sora::SoraSignalingConfig::DataChannel> schannels;
@@ -155,6 +173,110 @@ static bool ParseDataChannels(boost::json::value data_channels,
       ch.size_max = ch.size_min;
     }
 
+    // rate, bit-rate, size-sigma, bimodal-ratio
+    for (auto [key, value] : std::vector<std::pair<const char*, double*>>{
+             {"rate", &ch.rate},
+             {"bit-rate", &ch.bit_rate},
+             {"size-sigma", &ch.size_sigma},
+             {"bimodal-ratio", &ch.bimodal_ratio}}) {
+      auto it = obj.find(key);
+      if (it != obj.end()) {
+        if (!it->value().is_number()) {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+        *value = boost::json::value_to<double>(it->value());
+        if (*value < 0) {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+      }
+    }
+    if (ch.bimodal_ratio > 1) {
+      std::cout << __LINE__ << std::endl;
+      return false;
+    }
+
+    // size-distribution
+    {
+      auto it = obj.find("size-distribution");
+      if (it != obj.end()) {
+        if (!it->value().is_string()) {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+        auto s = boost::json::value_to<std::string>(it->value());
+        if (s == "fixed") {
+          ch.size_distribution = DataChannelTraffic::SizeDistribution::Fixed;
+        } else if (s == "uniform") {
+          ch.size_distribution = DataChannelTraffic::SizeDistribution::Uniform;
+        } else if (s == "lognormal") {
+          ch.size_distribution =
+              DataChannelTraffic::SizeDistribution::LogNormal;
+        } else if (s == "bimodal") {
+          ch.size_distribution = DataChannelTraffic::SizeDistribution::Bimodal;
+        } else {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+      }
+    }
+
+    // payload, payload-random-ratio
+    {
+      auto it = obj.find("payload");
+      if (it != obj.end()) {
+        if (!it->value().is_string()) {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+        auto s = boost::json::value_to<std::string>(it->value());
+        if (s == "random") {
+          ch.payload = BinaryPool::Payload::Random;
+        } else if (s == "dictionary") {
+          ch.payload = BinaryPool::Payload::Dictionary;
+        } else if (s == "json") {
+          ch.payload = BinaryPool::Payload::Json;
+        } else if (s == "mixed") {
+          ch.payload = BinaryPool::Payload::Mixed;
+        } else {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+      }
+    }
+    {
+      auto it = obj.find("payload-random-ratio");
+      if (it != obj.end()) {
+        if (!it->value().is_number()) {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+        ch.payload_random_ratio = boost::json::value_to<double>(it->value());
+        if (ch.payload_random_ratio < 0 || ch.payload_random_ratio > 1) {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+      }
+    }
+
+    // burst-on, burst-off
+    for (auto [key, value] : std::vector<std::pair<const char*, int*>>{
+             {"burst-on", &ch.burst_on}, {"burst-off", &ch.burst_off}}) {
+      auto it = obj.find(key);
+      if (it != obj.end()) {
+        if (!it->value().is_number()) {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+        *value = boost::json::value_to<int>(it->value());
+        if (*value < 0) {
+          std::cout << __LINE__ << std::endl;
+          return false;
+        }
+      }
+    }
+
     // boost::optional<bool> ordered;
     {
       auto it = obj.find("ordered");
@@ -205,10 +327,89 @@ static bool ParseDataChannels(boost::json::value data_channels,
   return true;
 }
 
+// SoraClientContext を共有できるかどうかを決める設定
+// ADM とコーデックの設定が同じなら同じコンテキストを使える
+static std::string GetContextKey(const ZakuroConfig& config,
+                                 const VirtualClientConfig& vc_config) {
+  auto impl = [](const std::optional<sora::VideoCodecImplementation>& v) {
+    return v ? std::to_string((int)*v) : std::string("-");
+  };
+  std::string key;
+  key += "data_channel_only=" + std::to_string(config.data_channel_only);
+  key += ",audio_type=" + std::to_string((int)vc_config.audio_type);
+  key += ",fake_audio_capture=" + config.fake_audio_capture;
+  key += ",openh264=" + config.openh264;
+  key += ",encoders=" + impl(config.vp8_encoder) + "/" +
+         impl(config.vp9_encoder) + "/" + impl(config.av1_encoder) + "/" +
+         impl(config.h264_encoder) + "/" + impl(config.h265_encoder);
+  key += ",real_video_decode_ratio=" +
+         std::to_string(config.real_video_decode_ratio);
+  key += ",frame_watermark=" + std::to_string(config.frame_watermark);
+  key += ",udp_batching=" + std::to_string(config.udp_batching);
+  // スレッドの配置が違うインスタンス同士では共有しない
+  key += ",cpu_affinity=" + config.cpu_affinity;
+  key += ",numa_node=" + std::to_string(config.numa_node);
+  // キー入力で鳴らす擬似音声はインスタンス毎に持つので、ADM を共有できない
+  if (vc_config.audio_type == VirtualClientConfig::AudioType::External) {
+    key += ",instance=" + std::to_string(config.id);
+  }
+  return key;
+}
+
+// SoraSignalingConfig のコピー 1 つが使うメモリを見積もる
+// 大きくなりうる文字列と JSON だけ数えて、オブジェクトの大きさに足す
+static size_t EstimateSoraConfigBytes(const sora::SoraSignalingConfig& c) {
+  auto json_bytes = [](const boost::json::value& v) -> size_t {
+    return v.is_null() ? 0 : boost::json::serialize(v).size();
+  };
+  auto optional_bytes = [](const auto& v) -> size_t {
+    return v ? StringHeapBytes(*v) : 0;
+  };
+  size_t size = sizeof(c);
+  for (const auto& url : c.signaling_urls) {
+    size += sizeof(url) + StringHeapBytes(url);
+  }
+  size += StringHeapBytes(c.channel_id) + StringHeapBytes(c.client_id) +
+          StringHeapBytes(c.bundle_id);
+  size += optional_bytes(c.client_cert) + optional_bytes(c.client_key);
+  size += json_bytes(c.metadata) + json_bytes(c.signaling_notify_metadata);
+  size += json_bytes(c.video_vp9_params) + json_bytes(c.video_av1_params) +
+          json_bytes(c.video_h264_params) + json_bytes(c.video_h265_params);
+  for (const auto& dc : c.data_channels) {
+    size += sizeof(dc) + StringHeapBytes(dc.label) +
+            StringHeapBytes(dc.direction);
+  }
+  return size;
+}
+
 int Zakuro::Run() {
+  // 仮想クライアントを開始するまでを起動時間として計る
+  StartupProfile::Instance startup(config_.startup_profile);
+
+  // このスレッドから作るスレッドは全て同じ CPU とメモリの配置を引き継ぐ
+  std::string affinity_error;
+  auto affinity =
+      ThreadAffinity::Create(config_.cpu_affinity, config_.numa_node,
+                             config_.id, config_.thread_registry,
+                             affinity_error);
+  if (affinity == nullptr) {
+    std::cerr << "[" << config_.name << "] " << affinity_error << std::endl;
+    return 1;
+  }
+  affinity->Apply(ThreadRole::Instance);
+
+  // DataChannel だけを使う場合は映像も音声も扱わない
+  if (config_.data_channel_only) {
+    config_.no_video_device = true;
+    config_.no_audio_device = true;
+    config_.sora_video = false;
+    config_.sora_audio = false;
+  }
+
   std::unique_ptr<GameAudioManager> gam;
 
-  bool fake_audio_key_trigger = config_.fake_audio_capture.empty();
+  bool fake_audio_key_trigger =
+      config_.fake_audio_capture.empty() && !config_.data_channel_only;
   std::unique_ptr<FakeAudioKeyTrigger> trigger;
   if (fake_audio_key_trigger) {
     gam.reset(new GameAudioManager());
@@ -216,6 +417,7 @@ int Zakuro::Run() {
 
   auto capturer =
       ([&]() -> webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> {
+        StartupProfile::Scope scope(config_.startup_profile, "capturer");
         if (config_.no_video_device) {
           return nullptr;
         }
@@ -226,6 +428,8 @@ int Zakuro::Run() {
           config.width = size.width;
           config.height = size.height;
           config.fps = config_.framerate;
+          config.watermark = config_.frame_watermark;
+          config.affinity = affinity;
           if (config_.fake_video_capture.empty()) {
             config.type = config_.sandstorm
                               ? FakeVideoCapturerConfig::Type::Sandstorm
@@ -261,6 +465,26 @@ int Zakuro::Run() {
     }
   }
 
+  // 設定ファイルで定義したシナリオ
+  bool has_custom_scenario = config_.scenarios.is_object() &&
+                             config_.scenarios.as_object().contains(
+                                 config_.scenario);
+  ScenarioData custom_scenario;
+  int custom_loop_index = 0;
+  if (has_custom_scenario) {
+    std::string error;
+    if (!ParseScenario(config_.scenarios, config_.scenario, custom_scenario,
+                       custom_loop_index, error)) {
+      std::cerr << "[" << config_.name
+                << "] failed to parse scenario: " << error << std::endl;
+      return 2;
+    }
+  } else if (config_.scenario != "" && config_.scenario != "reconnect") {
+    std::cerr << "[" << config_.name
+              << "] unknown scenario: " << config_.scenario << std::endl;
+    return 2;
+  }
+
   VirtualClientConfig vc_config;
   sora::SoraSignalingConfig& sora_config = vc_config.sora_config;
   vc_config.capturer = capturer;
@@ -272,6 +496,20 @@ int Zakuro::Run() {
   vc_config.openh264 = config_.openh264;
   vc_config.initial_mute_video = config_.initial_mute_video;
   vc_config.initial_mute_audio = config_.initial_mute_audio;
+  vc_config.dc_backpressure.policy =
+      config_.data_channel_backpressure == "block"
+          ? DataChannelBackpressureConfig::Policy::Block
+      : config_.data_channel_backpressure == "drop"
+          ? DataChannelBackpressureConfig::Policy::Drop
+      : config_.data_channel_backpressure == "coalesce"
+          ? DataChannelBackpressureConfig::Policy::Coalesce
+          : DataChannelBackpressureConfig::Policy::None;
+  vc_config.dc_backpressure.high_watermark =
+      config_.data_channel_high_watermark;
+  vc_config.dc_backpressure.low_watermark = std::min(
+      config_.data_channel_low_watermark, config_.data_channel_high_watermark);
+  vc_config.dc_stats_per_sender = config_.data_channel_stats_per_sender;
+  vc_config.admission = config_.admission;
   if (config_.no_audio_device) {
     vc_config.audio_type = VirtualClientConfig::AudioType::NoAudio;
   } else if (fake_audio_key_trigger) {
@@ -302,10 +540,24 @@ int Zakuro::Run() {
   context_config.use_audio_device = false;
 
   context_config.configure_dependencies =
-      [vc =
-           vc_config](webrtc::PeerConnectionFactoryDependencies& dependencies) {
+      [vc = vc_config, data_channel_only = config_.data_channel_only,
+       affinity, gam = gam.get(), adm_count = std::make_shared<int>(0)](
+          webrtc::PeerConnectionFactoryDependencies& dependencies) {
+        // メディアエンジンも ADM も作らず、DataChannel だけを扱う
+        // PeerConnectionFactory にする
+        if (data_channel_only) {
+          dependencies.adm = nullptr;
+          dependencies.audio_encoder_factory = nullptr;
+          dependencies.audio_decoder_factory = nullptr;
+          dependencies.video_encoder_factory = nullptr;
+          dependencies.video_decoder_factory = nullptr;
+          dependencies.audio_processing_builder = nullptr;
+          return;
+        }
+
         auto adm = dependencies.worker_thread->BlockingCall([&] {
           ZakuroAudioDeviceModuleConfig admconfig;
+          admconfig.affinity = affinity;
           auto env = webrtc::CreateEnvironment();
           if (vc.audio_type == VirtualClientConfig::AudioType::Device) {
 #if defined(__linux__)
@@ -332,7 +584,11 @@ int Zakuro::Run() {
           } else if (vc.audio_type ==
                      VirtualClientConfig::AudioType::External) {
             admconfig.type = ZakuroAudioDeviceModuleConfig::Type::External;
-            admconfig.render = vc.render_audio;
+            // ネットワークスレッド毎に ADM を作るので、2 つ目以降の ADM には
+            // 同じ音声を再生する出力を追加する
+            admconfig.render = (*adm_count)++ == 0
+                                   ? vc.render_audio
+                                   : gam->AddGameAudioOutput(0, vc.sample_rate);
             admconfig.sample_rate = vc.sample_rate;
             admconfig.channels = vc.channels;
           }
@@ -358,22 +614,27 @@ int Zakuro::Run() {
     return std::vector<sora::VideoCodecCapability::Engine>{engine};
   };
 
-  if (sora::CudaContext::CanCreate()) {
-    context_config.video_codec_factory_config.capability_config.cuda_context =
-        sora::CudaContext::Create();
-  }
-  if (sora::AMFContext::CanCreate()) {
-    context_config.video_codec_factory_config.capability_config.amf_context =
-        sora::AMFContext::Create();
-  }
   if (!vc_config.openh264.empty()) {
     context_config.video_codec_factory_config.capability_config.openh264_path =
         vc_config.openh264;
   }
 
+  // DataChannel だけを使う場合は、時間のかかるエンコーダーやデコーダーの確認をしない
+  // 確認した結果と CUDA や AMF のコンテキストは全てのインスタンスで共有する
+  auto capability_cache =
+      config_.video_codec_capability_cache != nullptr
+          ? config_.video_codec_capability_cache
+          : std::make_shared<VideoCodecCapabilityCache>("");
+  sora::VideoCodecCapability capability;
+  if (!config_.data_channel_only) {
+    StartupProfile::Scope scope(config_.startup_profile, "capability");
+    capability = capability_cache->Get(
+        context_config.video_codec_factory_config.capability_config);
+  }
+
   // コーデックプリファレンスの設定
   context_config.video_codec_factory_config.preference =
-      std::invoke([this, &context_config]() {
+      std::invoke([this, &capability]() {
         std::optional<sora::VideoCodecPreference> preference;
 
         // 個別のコーデックプリファレンスを設定
@@ -403,9 +664,6 @@ int Zakuro::Run() {
         add_codec_preference(webrtc::kVideoCodecAV1, config_.av1_encoder,
                              std::nullopt);
 
-        auto capability = sora::GetVideoCodecCapability(
-            context_config.video_codec_factory_config.capability_config);
-
         // デフォルトのプリファレンスがない場合は、従来の実装を使用
         if (!preference) {
           preference = sora::VideoCodecPreference();
@@ -421,18 +679,148 @@ int Zakuro::Run() {
 
         return preference;
       });
+  auto video_receive_stats = std::make_shared<NopVideoDecoderStats>();
+  auto sampled_decode_stats = std::make_shared<SampledVideoDecoderStats>();
+
+  // 一部の受信ストリームは本物のデコーダーでデコードする
+  std::shared_ptr<webrtc::VideoDecoderFactory> real_decoder_factory;
+  if (config_.real_video_decode_ratio > 0 && !config_.data_channel_only) {
+    sora::VideoCodecFactoryConfig real_config;
+    real_config.capability_config =
+        context_config.video_codec_factory_config.capability_config;
+    real_config.capability_config.get_custom_engines = nullptr;
+    sora::VideoCodecPreference real_preference;
+    real_preference.Merge(sora::CreateVideoCodecPreferenceFromImplementation(
+        capability, sora::VideoCodecImplementation::kInternal));
+    real_preference.Merge(sora::CreateVideoCodecPreferenceFromImplementation(
+        capability, sora::VideoCodecImplementation::kCiscoOpenH264));
+    real_config.preference = real_preference;
+    auto factory = sora::CreateVideoCodecFactory(real_config);
+    if (!factory) {
+      std::cerr << "[" << config_.name
+                << "] failed to create real video decoder factory"
+                << std::endl;
+      return 1;
+    }
+    real_decoder_factory = std::move(factory->decoder_factory);
+  }
+
+  // 何本目のストリームを本物のデコーダーにするかは、乱数ではなく
+  // 割合から決定的に決める（1/100 なら 100 本に 1 本）
+  auto decoder_count = std::make_shared<std::atomic<uint64_t>>(0);
   context_config.video_codec_factory_config.create_video_decoder =
-      [](sora::VideoCodecImplementation implementation,
-         const sora::VideoCodecCapabilityConfig& capability_config,
-         webrtc::VideoCodecType type) {
-        if (implementation == sora::VideoCodecImplementation::kCustom_1) {
-          return std::make_unique<NopVideoDecoder>();
-        } else {
+      [video_receive_stats, sampled_decode_stats, real_decoder_factory,
+       decoder_count, ratio = config_.real_video_decode_ratio,
+       watermark = config_.frame_watermark](
+          sora::VideoCodecImplementation implementation,
+          const sora::VideoCodecCapabilityConfig& capability_config,
+          webrtc::VideoCodecType type)
+      -> std::unique_ptr<webrtc::VideoDecoder> {
+        if (implementation != sora::VideoCodecImplementation::kCustom_1) {
           throw "Invalid implementation";
         }
+        if (real_decoder_factory != nullptr) {
+          uint64_t n = decoder_count->fetch_add(1);
+          if ((uint64_t)((n + 1) * ratio) > (uint64_t)(n * ratio)) {
+            for (const auto& format :
+                 real_decoder_factory->GetSupportedFormats()) {
+              if (webrtc::PayloadStringToCodecType(format.name) != type) {
+                continue;
+              }
+              auto decoder = real_decoder_factory->Create(
+                  webrtc::CreateEnvironment(), format);
+              if (decoder != nullptr) {
+                return std::make_unique<SampledVideoDecoder>(
+                    std::move(decoder), sampled_decode_stats, watermark);
+              }
+            }
+            RTC_LOG(LS_WARNING)
+                << "Real video decoder is not available: codec="
+                << webrtc::CodecTypeToPayloadString(type);
+          }
+        }
+        return std::make_unique<NopVideoDecoder>(video_receive_stats);
       };
 
-  vc_config.context = sora::SoraClientContext::Create(context_config);
+  // ネットワークスレッド毎にコンテキストを作り、仮想クライアントを振り分ける
+  // PeerConnectionFactory はネットワークスレッド毎に必要だけど、ワーカーと
+  // シグナリングのスレッドは最初のコンテキストのものを使う
+  std::shared_ptr<sora::SoraClientContext> threads_context;
+  auto create_shard = [this, &context_config, affinity, &threads_context]()
+      -> std::shared_ptr<NetworkShard> {
+    StartupProfile::Scope scope(config_.startup_profile, "context");
+    sora::SoraClientContextConfig shard_config = context_config;
+    if (threads_context != nullptr) {
+      // SoraClientContext が作るワーカーとシグナリングのスレッドは使わずに
+      // 待機したままになる
+      shard_config.configure_dependencies =
+          [configure = context_config.configure_dependencies,
+           worker_thread = threads_context->worker_thread(),
+           signaling_thread = threads_context->signaling_thread()](
+              webrtc::PeerConnectionFactoryDependencies& dependencies) {
+            dependencies.worker_thread = worker_thread;
+            dependencies.signaling_thread = signaling_thread;
+            configure(dependencies);
+          };
+    }
+    auto context = sora::SoraClientContext::Create(shard_config);
+    if (context == nullptr) {
+      return nullptr;
+    }
+    context->network_thread()->BlockingCall(
+        [&]() { affinity->Apply(ThreadRole::Network); });
+    if (threads_context == nullptr) {
+      context->worker_thread()->BlockingCall(
+          [&]() { affinity->Apply(ThreadRole::Worker); });
+      context->signaling_thread()->BlockingCall(
+          [&]() { affinity->Apply(ThreadRole::Signaling); });
+      threads_context = context;
+    }
+    return NetworkShard::Create(context, threads_context, config_.udp_batching);
+  };
+  bool external_audio =
+      vc_config.audio_type == VirtualClientConfig::AudioType::External;
+  std::vector<std::shared_ptr<NetworkShard>> shards;
+  if (config_.context_pool != nullptr) {
+    if (external_audio) {
+      std::cerr << "[" << config_.name
+                << "] Warning: contexts are not shared with other instances "
+                   "because of the key-triggered fake audio. Specify "
+                   "--no-audio-device or --fake-audio-capture to share them"
+                << std::endl;
+    }
+    // 設定が同じインスタンス同士でコンテキストを共有する
+    // 受信した映像の統計はどのインスタンスの仮想クライアントの分か区別できないので、
+    // インスタンスの統計には入れず、コンテキストの組毎に 1 つだけ登録する
+    auto entry = config_.context_pool->Get(GetContextKey(config_, vc_config),
+                                           video_receive_stats,
+                                           sampled_decode_stats, create_shard);
+    shards = entry.shards;
+    if (!shards.empty() && config_.stats != nullptr) {
+      config_.stats->AddSharedVideoStats(config_.id, entry.video_receive_stats,
+                                         entry.sampled_decode_stats);
+    }
+    video_receive_stats = nullptr;
+    sampled_decode_stats = nullptr;
+  } else {
+    int network_threads = std::clamp(config_.network_threads, 1, config_.vcs);
+    for (int i = 0; i < network_threads; i++) {
+      auto shard = create_shard();
+      if (shard == nullptr) {
+        shards.clear();
+        break;
+      }
+      shards.push_back(shard);
+    }
+  }
+  if (shards.empty()) {
+    std::cerr << "[" << config_.name << "] failed to create context"
+              << std::endl;
+    return 1;
+  }
+  if (config_.stats != nullptr) {
+    config_.stats->AddNetworkShards(shards);
+  }
 
   // signaling URL のバリデーション
   for (const auto& url : config_.sora_signaling_urls) {
@@ -484,10 +872,7 @@ int Zakuro::Run() {
   sora_config.data_channels = dcs.schannels;
   sora_config.degradation_preference = config_.degradation_preference;
 
-  std::vector<VirtualClientConfig> vc_configs;
-  for (int i = 0; i < config_.vcs; i++) {
-    vc_configs.push_back(vc_config);
-  }
+  vc_config.sora_config_bytes = EstimateSoraConfigBytes(sora_config);
 
   std::vector<std::shared_ptr<VirtualClient>> vcs;
 
@@ -500,13 +885,25 @@ int Zakuro::Run() {
     signals.async_wait(
         [&](const boost::system::error_code&, int) { ioc.stop(); });
 
-    for (auto& config : vc_configs) {
-      config.sora_config.io_context = &ioc;
-    }
+    // 設定は全ての仮想クライアントで共有する
+    sora_config.io_context = &ioc;
+    auto shared_vc_config =
+        std::make_shared<const VirtualClientConfig>(std::move(vc_config));
+    // 共有している設定のバイト数
+    // SoraSignalingConfig の分は長さが変わる項目も含めた見積もりに置き換える
+    size_t shared_config_bytes = sizeof(VirtualClientConfig) -
+                                 sizeof(sora::SoraSignalingConfig) +
+                                 shared_vc_config->sora_config_bytes;
 
-    for (int i = 0; i < config_.vcs; i++) {
-      auto vc = VirtualClient::Create(vc_configs[i]);
-      vcs.push_back(std::move(vc));
+    {
+      StartupProfile::Scope scope(config_.startup_profile, "clients");
+      vcs.reserve(config_.vcs);
+      for (int i = 0; i < config_.vcs; i++) {
+        // 複数のコンテキストがある場合は仮想クライアントを振り分ける
+        const auto& shard = shards[(config_.id + i) % shards.size()];
+        shard->AddClients(1);
+        vcs.push_back(VirtualClient::Create(shared_vc_config, shard));
+      }
     }
 
     ScenarioPlayerConfig spc;
@@ -516,12 +913,57 @@ int Zakuro::Run() {
     spc.binary_pool.reset(new BinaryPool(BINARY_POOL_SIZE));
 
     // メインのシナリオとは別に、ラベル毎に裏で DataChannel を送信し続けるシナリオを作る
-    std::vector<std::tuple<std::string, ScenarioData>> dcs_data;
+    std::vector<std::shared_ptr<DataChannelTraffic>> data_channel_traffics;
+    std::vector<std::tuple<std::string, ScenarioData>> background_data;
     for (const auto& ch : dcs.channels) {
+      // 乱数以外のペイロードを使う場合はラベル毎にプールを作る
+      std::shared_ptr<BinaryPool> binary_pool;
+      if (ch.payload != BinaryPool::Payload::Random) {
+        binary_pool.reset(new BinaryPool(BINARY_POOL_SIZE, ch.payload,
+                                         ch.payload_random_ratio));
+      }
       ScenarioData sd;
-      sd.Sleep(ch.interval, ch.interval);
-      sd.SendDataChannelMessage(ch.label, ch.size_min, ch.size_max);
-      dcs_data.push_back(std::make_tuple("scenario-dcs-" + ch.label, sd));
+      if (ch.rate > 0 || ch.bit_rate > 0) {
+        // 目標のレートに合わせて送信する
+        auto traffic = std::make_shared<DataChannelTraffic>();
+        traffic->label = ch.label;
+        traffic->rate = ch.rate;
+        traffic->bit_rate = ch.bit_rate;
+        traffic->size_distribution = ch.size_distribution;
+        traffic->size_min = ch.size_min;
+        traffic->size_max = ch.size_max;
+        traffic->size_sigma = ch.size_sigma;
+        traffic->bimodal_ratio = ch.bimodal_ratio;
+        traffic->burst_on_ms = ch.burst_on;
+        traffic->burst_off_ms = ch.burst_off;
+        traffic->binary_pool = binary_pool;
+        sd.SendDataChannelTraffic(traffic);
+        data_channel_traffics.push_back(traffic);
+      } else {
+        sd.Sleep(ch.interval, ch.interval);
+        sd.SendDataChannelMessage(ch.label, ch.size_min, ch.size_max,
+                                  binary_pool);
+      }
+      background_data.push_back(
+          std::make_tuple("scenario-dcs-" + ch.label, sd));
+    }
+
+    // 発話モデルが有効な場合、裏で発話と無音を切り替え続けるシナリオを作る
+    // 2 状態のマルコフモデルなので、各状態の継続時間は指数分布に従う
+    // 無音の間はトラックを無効にするだけだと無音のパケットを送り続けるので、
+    // Opus の DTX で送らなくなるのと同じように音声の送信自体を止める
+    if (!config_.no_audio_device && config_.voice_activity_talk_duration > 0 &&
+        config_.voice_activity_silence_duration > 0) {
+      // 極端に短い発話や無音にならないようにする
+      const int min_time_ms = 200;
+      ScenarioData sd;
+      sd.SetAudioActive(false);
+      sd.SleepExponential(
+          (int)(config_.voice_activity_silence_duration * 1000), min_time_ms);
+      sd.SetAudioActive(true);
+      sd.SleepExponential((int)(config_.voice_activity_talk_duration * 1000),
+                          min_time_ms);
+      background_data.push_back(std::make_tuple("scenario-voice-activity", sd));
     }
 
     // 切断と再接続のシナリオを追加する関数
@@ -553,16 +995,24 @@ int Zakuro::Run() {
     ScenarioPlayer scenario_player(spc);
     ScenarioData data;
     int loop_index;
-    if (!fake_audio_key_trigger) {
+    if (has_custom_scenario) {
       data.Reconnect();
-      for (const auto& d : dcs_data) {
+      for (const auto& d : background_data) {
+        data.PlaySubScenario(std::get<0>(d), std::get<1>(d), 0);
+      }
+      loop_index = data.ops.size() + custom_loop_index;
+      data.ops.insert(data.ops.end(), custom_scenario.ops.begin(),
+                      custom_scenario.ops.end());
+    } else if (!fake_audio_key_trigger) {
+      data.Reconnect();
+      for (const auto& d : background_data) {
         data.PlaySubScenario(std::get<0>(d), std::get<1>(d), 0);
       }
       add_reconnect_scenario(data, true);
-      loop_index = 1 + dcs_data.size();
+      loop_index = 1 + background_data.size();
     } else if (config_.scenario == "") {
       data.Reconnect();
-      for (const auto& d : dcs_data) {
+      for (const auto& d : background_data) {
         data.PlaySubScenario(std::get<0>(d), std::get<1>(d), 0);
       }
       ScenarioData sd;
@@ -570,7 +1020,7 @@ int Zakuro::Run() {
       sd.PlayVoiceNumberClient();
       data.PlaySubScenario("scenario-voice-number-client", sd, 0);
       add_reconnect_scenario(data, true);
-      loop_index = 1 + dcs_data.size() + 1;
+      loop_index = 1 + background_data.size() + 1;
     } else if (config_.scenario == "reconnect") {
       data.Reconnect();
       data.Sleep(1000, 5000);
@@ -593,14 +1043,56 @@ int Zakuro::Run() {
       loop_index = 0;
     }
 
-    for (int i = 0; i < config_.vcs; i++) {
-      ScenarioData cdata;
-      int first_wait_ms = (int)(1000 * i / config_.vcs_hatch_rate);
-      cdata.Sleep(first_wait_ms, first_wait_ms);
-      cdata.ops.insert(cdata.ops.end(), data.ops.begin(), data.ops.end());
-      // 先頭に1個付け足したので +1 する
-      const int li = loop_index + 1;
-      scenario_player.Play(i, std::move(cdata), li);
+    // シナリオは一度だけコンパイルして全てのクライアントで共有する
+    auto scenario = CompiledScenario::Compile(data);
+    if (config_.load_profile == nullptr) {
+      for (int i = 0; i < config_.vcs; i++) {
+        int first_wait_ms = (int)(1000 * i / config_.vcs_hatch_rate);
+        scenario_player.Play(i, scenario, loop_index,
+                             std::chrono::milliseconds(first_wait_ms));
+      }
+    }
+
+    // 負荷プロファイルがある場合は、このインスタンスの目標の vcs に合わせて
+    // 先頭の仮想クライアントから順にシナリオを開始し、後ろから順に止めて切断する
+    boost::asio::steady_timer load_timer(ioc);
+    std::function<void(const boost::system::error_code& ec)> load_f;
+    int active_vcs = 0;
+    if (config_.load_profile != nullptr) {
+      load_f = [this, &ioc, &vcs, &scenario_player, &scenario, loop_index,
+                &active_vcs, &load_timer,
+                &load_f](const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+          return;
+        }
+        auto& lp = *config_.load_profile;
+        int phase;
+        int total = lp.GetTarget(lp.GetElapsedSec(), &phase);
+        int target = std::min(lp.GetInstanceTarget(total, config_.id),
+                              (int)vcs.size());
+        while (active_vcs < target) {
+          scenario_player.Play(active_vcs, scenario, loop_index);
+          active_vcs += 1;
+        }
+        while (active_vcs > target) {
+          active_vcs -= 1;
+          scenario_player.Stop(active_vcs);
+          vcs[active_vcs]->Close();
+        }
+        int connected = std::count_if(vcs.begin(), vcs.end(), [](auto& vc) {
+          return !vc->GetConnectionID().empty();
+        });
+        lp.SetInstanceCount(config_.id, active_vcs, connected);
+
+        // 最後のフェーズが終わって全て切断したら終了する
+        if (phase == lp.GetPhaseCount() && target == 0 && connected == 0) {
+          ioc.stop();
+          return;
+        }
+        load_timer.expires_after(std::chrono::milliseconds(100));
+        load_timer.async_wait(load_f);
+      };
+      load_f(boost::system::error_code());
     }
 
     if (fake_audio_key_trigger) {
@@ -612,22 +1104,32 @@ int Zakuro::Run() {
     boost::asio::steady_timer timer(ioc);
     timer.expires_after(std::chrono::seconds(5));
     std::function<void(const boost::system::error_code& ec)> f;
-    f = [&vcs, c = config_, &timer, &f](const boost::system::error_code& ec) {
+    f = [&vcs, c = config_, &timer, &f, &scenario_player,
+         shared_config_bytes, video_receive_stats, sampled_decode_stats,
+         &data_channel_traffics](const boost::system::error_code& ec) {
       if (ec == boost::asio::error::operation_aborted) {
         return;
       }
       std::vector<VirtualClientStats> ss;
-      for (auto& vc : vcs) {
-        ss.push_back(vc->GetStats());
+      ss.reserve(vcs.size());
+      for (int i = 0; i < vcs.size(); i++) {
+        ss.push_back(vcs[i]->GetStats());
+        ss.back().memory.scenario_bytes = scenario_player.GetMemoryUsage(i);
       }
-      c.stats->Set(c.id, c.name, ss);
+      c.stats->Set(c.id, c.name, ss, shared_config_bytes, video_receive_stats,
+                   sampled_decode_stats, data_channel_traffics);
       timer.expires_after(std::chrono::seconds(10));
       timer.async_wait(f);
     };
     timer.async_wait(f);
 
+    startup.Ready();
     ioc.run();
 
+    // まだ許可されていない接続を捨てて、接続処理中の枠を返す
+    if (config_.admission != nullptr) {
+      config_.admission->Cancel(ioc);
+    }
     for (auto& vc : vcs) {
       vc->Clear();
     }
@@ -15,7 +15,13 @@
 // Sora
 #include <sora/sora_video_codec.h>
 
+#include "admission_controller.h"
 #include "game/game_key_core.h"
+#include "load_profile.h"
+#include "sora_client_context_pool.h"
+#include "startup_profile.h"
+#include "thread_affinity.h"
+#include "video_codec_capability_cache.h"
 
 class ZakuroStats;
 
@@ -31,6 +37,8 @@ struct ZakuroConfig {
 
   bool no_video_device = false;
   bool no_audio_device = false;
+  // 映像と音声を使わず、DataChannel だけで接続する
+  bool data_channel_only = false;
   std::string video_device = "";
   std::string resolution = "VGA";
   int framerate = 30;
@@ -39,14 +47,29 @@ struct ZakuroConfig {
   bool insecure = false;
   bool fake_capture_device = true;
   bool sandstorm = false;
+  bool frame_watermark = false;
   std::string fake_video_capture = "";
   std::string fake_audio_capture = "";
   std::string openh264 = "";
   std::string scenario;
+  // --scenario で指定できるシナリオの定義
+  boost::json::value scenarios;
   std::string client_cert;
   std::string client_key;
   bool initial_mute_video = false;
   bool initial_mute_audio = false;
+  // 発話モデル（発話区間と無音区間の平均秒数）
+  // どちらかが 0 の場合は常に発話している
+  double voice_activity_talk_duration = 0;
+  double voice_activity_silence_duration = 0;
+  // 受信した映像ストリームのうち、本物のデコーダーでデコードする割合
+  double real_video_decode_ratio = 0;
+  // DataChannel の送信バッファが溜まった時の挙動
+  std::string data_channel_backpressure = "none";
+  int data_channel_high_watermark = 1024 * 1024;
+  int data_channel_low_watermark = 256 * 1024;
+  // DataChannel の受信統計を送信元毎にも集計するか
+  bool data_channel_stats_per_sender = false;
   std::optional<webrtc::DegradationPreference> degradation_preference;
 
   std::vector<std::string> sora_signaling_urls;
@@ -91,6 +114,32 @@ struct ZakuroConfig {
   std::shared_ptr<GameKeyCore> key_core;
 
   std::shared_ptr<ZakuroStats> stats;
+  // 全てのインスタンスで共有する負荷プロファイル
+  // nullptr の場合は vcs_hatch_rate に従って全ての仮想クライアントを接続する
+  std::shared_ptr<LoadProfile> load_profile;
+  // 全てのインスタンスで共有する
+  // nullptr の場合は接続処理の数を制限しない
+  std::shared_ptr<AdmissionController> admission;
+  // 仮想クライアントを振り分けるネットワークスレッドの数
+  // 0 の場合は CPU のコア数をインスタンス数で割った数にする
+  int network_threads = 0;
+  // UDP のパケットを sendmmsg/recvmmsg と GSO/GRO でまとめて送受信する
+  bool udp_batching = false;
+  // 全てのインスタンスで共有する
+  // nullptr の場合はインスタンス毎に network_threads 個の SoraClientContext を作る
+  std::shared_ptr<SoraClientContextPool> context_pool;
+  // インスタンスのスレッドを動かす CPU。書式は ThreadAffinity を参照
+  std::string cpu_affinity;
+  // スレッドを動かしてメモリを確保する NUMA ノード。-1 の場合は指定しない
+  int numa_node = -1;
+  // 全てのインスタンスで共有する
+  std::shared_ptr<ThreadRegistry> thread_registry;
+  // 全てのインスタンスで共有する
+  // nullptr の場合はインスタンス毎にエンコーダーとデコーダーを確認する
+  std::shared_ptr<VideoCodecCapabilityCache> video_codec_capability_cache;
+  // 全てのインスタンスで共有する
+  // nullptr の場合は起動時間を計らない
+  std::shared_ptr<StartupProfile> startup_profile;
 
   struct Size {
     int width;
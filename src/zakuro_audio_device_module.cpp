@@ -70,6 +70,9 @@ void ZakuroAudioDeviceModule::StartAudioThread() {
 
   StopAudioThread();
   audio_thread_.reset(new std::thread([this]() {
+    if (config_.affinity != nullptr) {
+      config_.affinity->Apply(ThreadRole::Audio);
+    }
     int index = 0;
     // 10 ミリ秒毎に送信
     std::vector<int16_t> buf;
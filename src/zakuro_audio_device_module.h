@@ -17,6 +17,8 @@
 #include "rtc_base/ref_counted_object.h"
 #include "rtc_base/thread.h"
 
+#include "thread_affinity.h"
+
 struct FakeAudioData {
   int sample_rate;
   int channels;
@@ -39,6 +41,8 @@ struct ZakuroAudioDeviceModuleConfig {
   std::function<void(std::vector<int16_t>&)> render;
   int sample_rate;
   int channels;
+  // 音声を生成するスレッドを動かす CPU。nullptr の場合は指定しない
+  std::shared_ptr<ThreadAffinity> affinity;
 };
 
 class ZakuroAudioDeviceModule : public webrtc::AudioDeviceModule {
@@ -1,22 +1,43 @@
 #ifndef ZAKURO_STATS_H_
 #define ZAKURO_STATS_H_
 
+#include <algorithm>
 #include <chrono>
 #include <string>
 #include <thread>
 
+#include "admission_controller.h"
+#include "coordinator.h"
+#include "data_channel_traffic.h"
+#include "follower.h"
+#include "load_profile.h"
+#include "memory_usage.h"
+#include "network_shard.h"
+#include "nop_video_decoder.h"
+#include "sampled_video_decoder.h"
+#include "thread_affinity.h"
 #include "virtual_client.h"
+#include "worker.h"
 
 class ZakuroStats {
  public:
   void Set(int id,
            const std::string& name,
-           const std::vector<VirtualClientStats>& stats) {
+           const std::vector<VirtualClientStats>& stats,
+           size_t shared_config_bytes,
+           std::shared_ptr<NopVideoDecoderStats> video_receive_stats,
+           std::shared_ptr<SampledVideoDecoderStats> sampled_decode_stats,
+           const std::vector<std::shared_ptr<DataChannelTraffic>>&
+               data_channel_traffics) {
     std::lock_guard<std::mutex> guard(m_);
     auto& d = data_[id];
     d.id = id;
     d.name = name;
     d.stats = stats;
+    d.shared_config_bytes = shared_config_bytes;
+    d.video_receive_stats = video_receive_stats;
+    d.sampled_decode_stats = sampled_decode_stats;
+    d.data_channel_traffics = data_channel_traffics;
     d.last_updated_at = std::chrono::steady_clock::now();
   }
 
@@ -24,6 +45,14 @@ class ZakuroStats {
     int id;
     std::string name;
     std::vector<VirtualClientStats> stats;
+    // 全ての仮想クライアントで共有している設定のバイト数
+    size_t shared_config_bytes = 0;
+    // デコーダーから随時更新されるので、参照する度に最新の値が取れる
+    std::shared_ptr<NopVideoDecoderStats> video_receive_stats;
+    // 本物のデコーダーでデコードしているストリームの統計
+    std::shared_ptr<SampledVideoDecoderStats> sampled_decode_stats;
+    // 目標レートを指定した DataChannel の送信統計
+    std::vector<std::shared_ptr<DataChannelTraffic>> data_channel_traffics;
     std::chrono::steady_clock::time_point last_updated_at;
   };
 
@@ -32,8 +61,133 @@ class ZakuroStats {
     return data_;
   }
 
+  // インスタンスを開始する前のメモリ使用量
+  // 仮想クライアント 1 つあたりのメモリを計算するのに使う
+  void SetBaselineMemory(const ProcessMemory& memory) {
+    std::lock_guard<std::mutex> guard(m_);
+    baseline_memory_ = memory;
+  }
+  ProcessMemory GetBaselineMemory() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return baseline_memory_;
+  }
+
+  void SetLoadProfile(std::shared_ptr<LoadProfile> load_profile) {
+    std::lock_guard<std::mutex> guard(m_);
+    load_profile_ = load_profile;
+  }
+  std::shared_ptr<LoadProfile> GetLoadProfile() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return load_profile_;
+  }
+
+  void SetAdmissionController(std::shared_ptr<AdmissionController> admission) {
+    std::lock_guard<std::mutex> guard(m_);
+    admission_ = admission;
+  }
+  std::shared_ptr<AdmissionController> GetAdmissionController() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return admission_;
+  }
+
+  // インスタンス間で共有している NetworkShard は 1 つだけ登録する
+  void AddNetworkShards(
+      const std::vector<std::shared_ptr<NetworkShard>>& shards) {
+    std::lock_guard<std::mutex> guard(m_);
+    for (const auto& shard : shards) {
+      if (std::find(network_shards_.begin(), network_shards_.end(), shard) ==
+          network_shards_.end()) {
+        network_shards_.push_back(shard);
+      }
+    }
+  }
+  std::vector<std::shared_ptr<NetworkShard>> GetNetworkShards() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return network_shards_;
+  }
+
+  // --context-pool-size でコンテキストを共有している場合のデコーダーの統計
+  // 共有しているインスタンス同士で同じオブジェクトになるので 1 つだけ登録し、
+  // 共有しているインスタンスの id を記録する
+  struct SharedVideoStats {
+    std::vector<int> instances;
+    std::shared_ptr<NopVideoDecoderStats> video_receive_stats;
+    std::shared_ptr<SampledVideoDecoderStats> sampled_decode_stats;
+  };
+  void AddSharedVideoStats(
+      int id,
+      std::shared_ptr<NopVideoDecoderStats> video_receive_stats,
+      std::shared_ptr<SampledVideoDecoderStats> sampled_decode_stats) {
+    std::lock_guard<std::mutex> guard(m_);
+    auto it = std::find_if(shared_video_stats_.begin(),
+                           shared_video_stats_.end(), [&](const auto& s) {
+                             return s.video_receive_stats ==
+                                    video_receive_stats;
+                           });
+    if (it == shared_video_stats_.end()) {
+      shared_video_stats_.push_back(
+          {{}, video_receive_stats, sampled_decode_stats});
+      it = shared_video_stats_.end() - 1;
+    }
+    it->instances.push_back(id);
+  }
+  std::vector<SharedVideoStats> GetSharedVideoStats() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return shared_video_stats_;
+  }
+
+  // --workers の親プロセスの場合に設定する
+  // 設定されている場合は、統計をワーカープロセスから集める
+  void SetWorkerStatsRing(std::shared_ptr<WorkerStatsRing> ring) {
+    std::lock_guard<std::mutex> guard(m_);
+    worker_ring_ = ring;
+  }
+  std::shared_ptr<WorkerStatsRing> GetWorkerStatsRing() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return worker_ring_;
+  }
+
+  void SetThreadRegistry(std::shared_ptr<ThreadRegistry> registry) {
+    std::lock_guard<std::mutex> guard(m_);
+    thread_registry_ = registry;
+  }
+  std::shared_ptr<ThreadRegistry> GetThreadRegistry() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return thread_registry_;
+  }
+
+  // --follower の場合に設定する
+  void SetFollower(std::shared_ptr<Follower> follower) {
+    std::lock_guard<std::mutex> guard(m_);
+    follower_ = follower;
+  }
+  std::shared_ptr<Follower> GetFollower() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return follower_;
+  }
+
+  // --followers の場合に設定する
+  // 設定されている場合は、統計を全てのフォロワーから集める
+  void SetCoordinator(std::shared_ptr<Coordinator> coordinator) {
+    std::lock_guard<std::mutex> guard(m_);
+    coordinator_ = coordinator;
+  }
+  std::shared_ptr<Coordinator> GetCoordinator() const {
+    std::lock_guard<std::mutex> guard(m_);
+    return coordinator_;
+  }
+
  private:
   std::map<int, Data> data_;
+  ProcessMemory baseline_memory_;
+  std::shared_ptr<LoadProfile> load_profile_;
+  std::shared_ptr<AdmissionController> admission_;
+  std::vector<std::shared_ptr<NetworkShard>> network_shards_;
+  std::vector<SharedVideoStats> shared_video_stats_;
+  std::shared_ptr<WorkerStatsRing> worker_ring_;
+  std::shared_ptr<ThreadRegistry> thread_registry_;
+  std::shared_ptr<Follower> follower_;
+  std::shared_ptr<Coordinator> coordinator_;
   mutable std::mutex m_;
 };
 
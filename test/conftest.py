@@ -125,14 +125,19 @@ def sora_config() -> SoraConfig:
     )
 
 
+def find_free_port() -> int:
+    """OS に空きポートを割り当ててもらい、そのポート番号を返す"""
+    import socket
+
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
 @pytest.fixture
 def free_port():
     """利用可能なポート番号を提供するフィクスチャ
 
     OS に空きポートを割り当ててもらうことで、ポート衝突を回避します。
     """
-    import socket
-
-    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
-        s.bind(("127.0.0.1", 0))
-        return s.getsockname()[1]
+    return find_free_port()
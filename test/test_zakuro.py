@@ -1,6 +1,13 @@
 """Zakuro の基本的なテスト"""
 
-from conftest import SoraConfig, get_deps_versions, get_zakuro_version
+import time
+
+from conftest import (
+    SoraConfig,
+    find_free_port,
+    get_deps_versions,
+    get_zakuro_version,
+)
 from zakuro import Zakuro
 
 
@@ -24,3 +31,153 @@ def test_version(sora_config: SoraConfig, free_port: int) -> None:
         expected_libwebrtc = deps["WEBRTC_BUILD_VERSION"].removeprefix("m")
         assert version["libwebrtc"] == expected_libwebrtc
         assert version["boost"] == deps["BOOST_VERSION"]
+
+
+def test_stats(sora_config: SoraConfig, free_port: int) -> None:
+    """受信した映像の統計情報を取得できることを確認"""
+    with Zakuro(
+        instances=[
+            sora_config.build_instance(
+                channel_name="stats",
+                role="sendrecv",
+                vcs=2,
+                no_video_device=False,
+                resolution="QVGA",
+            )
+        ],
+        http_port=free_port,
+    ) as z:
+        # 2 つの仮想クライアントが接続して映像を受信するまで待つ
+        frames = 0
+        for _ in range(30):
+            stats = z.rpc.get_stats()
+            instances = stats["instances"]
+            if len(instances) == 1 and "video_receive" in instances[0]:
+                frames = instances[0]["video_receive"]["frames"]
+                if frames > 0:
+                    break
+            time.sleep(1)
+
+        assert frames > 0
+        instance = stats["instances"][0]
+        assert instance["name"] == "zakuro"
+        video_receive = instance["video_receive"]
+        assert video_receive["inter_frame_jitter_ms"]["count"] > 0
+        assert len(video_receive["latency_ms"]["counts"]) == (
+            len(video_receive["latency_ms"]["bounds"]) + 1
+        )
+
+
+def measure_packets_sent_per_sec(z: Zakuro, seconds: float) -> float:
+    """全てのネットワークスレッドで送信したパケット数の 1 秒あたりの平均を返す"""
+
+    def packets_sent() -> int:
+        stats = z.rpc.get_stats()
+        return sum(t["packets_sent"] for t in stats["network_threads"])
+
+    begin = packets_sent()
+    time.sleep(seconds)
+    return (packets_sent() - begin) / seconds
+
+
+def test_voice_activity(sora_config: SoraConfig, free_port: int) -> None:
+    """発話モデルの無音の間は音声のパケットを送信しないことを確認"""
+    # 発話し続ける場合と、最初の無音がほぼ終わらない場合を比べる
+    silent = {
+        "voice-activity-talk-duration": 0.2,
+        "voice-activity-silence-duration": 3600,
+    }
+    rates = []
+    for voice_activity in [{}, silent]:
+        with Zakuro(
+            instances=[
+                sora_config.build_instance(
+                    channel_name="voice-activity",
+                    role="sendonly",
+                    no_audio_device=False,
+                    **voice_activity,
+                )
+            ],
+            http_port=free_port,
+        ) as z:
+            # 接続して送信が始まるまで待つ
+            time.sleep(5)
+            rates.append(measure_packets_sent_per_sec(z, 5))
+
+    # 発話し続ける場合は 20ms 毎に送信する
+    assert rates[0] > 30
+    # 無音の間は RTCP や STUN だけになる
+    assert rates[1] < rates[0] / 5
+
+
+def test_followers(sora_config: SoraConfig, free_port: int) -> None:
+    """コーディネーターから 2 つのフォロワーに設定を送り、まとめて操作できることを確認"""
+    follower_ports = [find_free_port(), find_free_port()]
+    follower_args = ["--follower", "--follower-token", "test-token"]
+    with (
+        Zakuro(instances=None, http_port=follower_ports[0], extra_args=follower_args) as f1,
+        Zakuro(instances=None, http_port=follower_ports[1], extra_args=follower_args) as f2,
+    ):
+        followers = [f1, f2]
+        for f in followers:
+            assert f.rpc.get_follower_status()["state"] == "waiting"
+
+        followers_arg = ",".join(f"http://127.0.0.1:{port}" for port in follower_ports)
+        with Zakuro(
+            instances=[
+                sora_config.build_instance(channel_name="followers", role="sendrecv", vcs=1),
+                sora_config.build_instance(channel_name="followers", role="sendrecv", vcs=1),
+            ],
+            http_port=free_port,
+            extra_args=[
+                "--followers",
+                followers_arg,
+                "--follower-token",
+                "test-token",
+                "--start-delay",
+                "3",
+            ],
+        ) as c:
+            # Prepare で全てのフォロワーに同じ開始時刻が届いている
+            for _ in range(10):
+                statuses = [f.rpc.get_follower_status() for f in followers]
+                if all(status["state"] != "waiting" for status in statuses):
+                    break
+                time.sleep(0.5)
+            for status in statuses:
+                assert status["state"] in ("scheduled", "running")
+            start_at_ms = statuses[0]["start_at_ms"]
+            assert start_at_ms > 0
+            assert all(status["start_at_ms"] == start_at_ms for status in statuses)
+
+            # 開始時刻を過ぎたら全てのフォロワーが動き出す
+            for _ in range(30):
+                statuses = [f.rpc.get_follower_status() for f in followers]
+                if all(status["state"] == "running" for status in statuses):
+                    break
+                time.sleep(1)
+            assert all(status["state"] == "running" for status in statuses)
+            assert time.time() * 1000 >= start_at_ms
+
+            # GetStats は全てのフォロワーの統計をまとめ、フォロワー毎に nodes を返す
+            # 負荷プロファイルは設定を読み込んだ後に作るので、揃うまで待つ
+            for _ in range(30):
+                stats = c.rpc.get_stats()
+                if stats.get("load_profile", {}).get("target_vcs") == 2:
+                    break
+                time.sleep(1)
+            nodes = stats["nodes"]
+            assert len(nodes) == 2
+            assert [node["index"] for node in nodes] == [0, 1]
+            for node, port in zip(nodes, follower_ports):
+                assert "error" not in node
+                assert node["url"] == f"http://127.0.0.1:{port}"
+                assert node["vcs"] == 1
+                assert node["follower"]["state"] == "running"
+            assert stats["load_profile"]["target_vcs"] == 2
+
+            # SetLoad で変更した全体の仮想クライアント数がフォロワーの目標に反映される
+            c.rpc.set_load(1)
+            stats = c.rpc.get_stats()
+            assert stats["load_profile"]["target_vcs"] == 1
+            assert len(stats["nodes"]) == 2
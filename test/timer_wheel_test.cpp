@@ -0,0 +1,145 @@
+// TimerWheel の単体テスト
+//
+// TimerWheel は Sora や WebRTC に依存しないので、zakuro とは別にビルドして動かす。
+// 失敗したらメッセージを表示して 1 を返す。
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Boost
+#include <boost/asio/io_context.hpp>
+
+#include "timer_wheel.h"
+
+namespace {
+
+int g_failures = 0;
+
+#define CHECK(cond)                                                        \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond \
+                << std::endl;                                              \
+      g_failures += 1;                                                     \
+    }                                                                      \
+  } while (0)
+
+typedef std::chrono::steady_clock Clock;
+
+int64_t ElapsedMs(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                               start)
+      .count();
+}
+
+// 全ての段にまたがる遅延で、順番通りに遅れずに呼ばれる
+void TestCascade() {
+  boost::asio::io_context ioc;
+  TimerWheel wheel(ioc);
+  // 1 段目 (64 ms 未満)、2 段目 (4096 ms 未満)、3 段目にそれぞれ入る
+  const std::vector<int> delays = {1, 5, 63, 64, 65, 130, 1000, 4100};
+  std::vector<std::unique_ptr<TimerWheel::Entry>> entries;
+  std::vector<int64_t> fired(delays.size(), -1);
+  std::vector<int> order;
+  auto start = Clock::now();
+  // 逆順にスケジュールしても、期限の順に呼ばれる
+  for (int i = (int)delays.size() - 1; i >= 0; i--) {
+    auto& e = entries.emplace_back(new TimerWheel::Entry());
+    e->callback = [&, i]() {
+      fired[i] = ElapsedMs(start);
+      order.push_back(i);
+    };
+    wheel.Schedule(e.get(), std::chrono::milliseconds(delays[i]));
+  }
+  ioc.run_for(std::chrono::seconds(10));
+
+  CHECK(ioc.stopped());
+  CHECK(order.size() == delays.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    CHECK(order[i] == (int)i);
+  }
+  for (size_t i = 0; i < delays.size(); i++) {
+    CHECK(fired[i] >= delays[i]);
+    // 負荷の高い CI でも通るように余裕を持たせる
+    CHECK(fired[i] < delays[i] + 500);
+  }
+}
+
+// キャンセルしたエントリは呼ばれず、スケジュールし直したエントリは新しい期限で呼ばれる
+void TestCancel() {
+  boost::asio::io_context ioc;
+  TimerWheel wheel(ioc);
+  TimerWheel::Entry a, b, c, ready;
+  int a_count = 0, b_count = 0, c_count = 0, ready_count = 0;
+  a.callback = [&]() { a_count += 1; };
+  b.callback = [&]() { b_count += 1; };
+  c.callback = [&]() { c_count += 1; };
+  ready.callback = [&]() { ready_count += 1; };
+
+  wheel.Schedule(&a, std::chrono::milliseconds(10));
+  wheel.Schedule(&b, std::chrono::milliseconds(100));
+  wheel.Schedule(&c, std::chrono::milliseconds(5000));
+  wheel.Schedule(&ready, std::chrono::milliseconds(0));
+  CHECK(a.IsScheduled() && b.IsScheduled() && c.IsScheduled());
+
+  wheel.Cancel(&a);
+  CHECK(!a.IsScheduled());
+  // ready キューに入っているエントリもキャンセルできる
+  wheel.Cancel(&ready);
+  // 遠い期限のエントリを近い期限でスケジュールし直す
+  auto start = Clock::now();
+  wheel.Schedule(&c, std::chrono::milliseconds(20));
+  ioc.run_for(std::chrono::seconds(10));
+
+  // 全てのエントリが終わったら、Asio タイマーを待たずに run が返る
+  CHECK(ioc.stopped());
+  CHECK(ElapsedMs(start) < 1000);
+  CHECK(a_count == 0);
+  CHECK(b_count == 1);
+  CHECK(c_count == 1);
+  CHECK(ready_count == 0);
+  // キャンセルした後でもスケジュールし直せる
+  ioc.restart();
+  wheel.Schedule(&a, std::chrono::milliseconds(1));
+  ioc.run_for(std::chrono::seconds(10));
+  CHECK(a_count == 1);
+}
+
+// スケジュールされたまま破棄したエントリはキャンセルされる
+void TestDestroyScheduled() {
+  boost::asio::io_context ioc;
+  TimerWheel wheel(ioc);
+  TimerWheel::Entry kept;
+  int kept_count = 0;
+  kept.callback = [&]() { kept_count += 1; };
+  {
+    TimerWheel::Entry destroyed;
+    destroyed.callback = []() { std::abort(); };
+    wheel.Schedule(&destroyed, std::chrono::milliseconds(50));
+  }
+  wheel.Schedule(&kept, std::chrono::milliseconds(10));
+  auto start = Clock::now();
+  ioc.run_for(std::chrono::seconds(10));
+
+  // 破棄したエントリが数に残っていると、タイマーを待ち続けて run が返らない
+  CHECK(ioc.stopped());
+  CHECK(ElapsedMs(start) < 1000);
+  CHECK(kept_count == 1);
+}
+
+}  // namespace
+
+int main() {
+  TestCascade();
+  TestCancel();
+  TestDestroyScheduled();
+  if (g_failures != 0) {
+    std::cerr << g_failures << " check(s) failed" << std::endl;
+    return 1;
+  }
+  std::cout << "OK" << std::endl;
+  return 0;
+}
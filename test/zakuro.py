@@ -52,11 +52,24 @@ class RpcClient:
         """バージョン情報を取得"""
         return self._call("GetVersion")
 
+    def get_stats(self) -> dict[str, Any]:
+        """統計情報を取得"""
+        return self._call("GetStats")
+
+    def get_follower_status(self) -> dict[str, Any]:
+        """--follower の状態を取得"""
+        return self._call("GetFollowerStatus")
+
+    def set_load(self, vcs: int) -> None:
+        """全てのインスタンスを合わせた仮想クライアント数を変更"""
+        self._call("SetLoad", {"vcs": vcs})
+
 
 class Zakuro:
     """Zakuro プロセスを管理するクラス
 
     instances にインスタンス設定のリストを渡します。
+    --follower のように設定ファイルを使わない場合は None を渡します。
 
     使用例:
         # 単一インスタンス
@@ -75,11 +88,19 @@ class Zakuro:
             http_port=18080,
         ) as z:
             ...
+
+        # フォロワー
+        with Zakuro(
+            instances=None,
+            http_port=18081,
+            extra_args=["--follower"],
+        ) as f:
+            ...
     """
 
     def __init__(
         self,
-        instances: list[dict[str, Any]],
+        instances: list[dict[str, Any]] | None,
         # HTTP サーバー設定
         http_port: int = 18080,
         http_host: str = "127.0.0.1",
@@ -87,13 +108,16 @@ class Zakuro:
         log_level: Literal["verbose", "info", "warning", "error", "none"] | None = None,
         # 起動待機設定
         startup_timeout: int = 30,
+        # その他のコマンドライン引数
+        extra_args: list[str] | None = None,
     ) -> None:
         # 実行ファイルのパスを自動検出
         self._executable_path = self._get_zakuro_executable_path()
         self._process: subprocess.Popen[Any] | None = None
 
         # 設定
-        self._config = {"instances": instances}
+        self._config = None if instances is None else {"instances": instances}
+        self._extra_args = extra_args or []
         self._http_port = http_port
         self._http_host = http_host
         self._log_level = log_level
@@ -232,11 +256,14 @@ class Zakuro:
             args.extend(["--log-level", self._log_level])
 
         # config を一時ファイルに書き出し
-        fd, temp_path = tempfile.mkstemp(suffix=".jsonc", prefix="zakuro_config_")
-        with open(fd, "w", encoding="utf-8") as f:
-            json.dump(self._config, f, ensure_ascii=False, indent=2)
-        self._temp_config_file = temp_path
-        args.extend(["--config", temp_path])
+        if self._config is not None:
+            fd, temp_path = tempfile.mkstemp(suffix=".jsonc", prefix="zakuro_config_")
+            with open(fd, "w", encoding="utf-8") as f:
+                json.dump(self._config, f, ensure_ascii=False, indent=2)
+            self._temp_config_file = temp_path
+            args.extend(["--config", temp_path])
+
+        args.extend(self._extra_args)
 
         return args
 